@@ -0,0 +1,301 @@
+#include "ActionLogReplay.h"
+#include "DQN.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+
+ActionLogReplay::ActionLogReplay(size_t capacity, const ObservationSpec& observation, int decode_threads, size_t cached_frames)
+{
+    this->capacity = capacity;
+    channels = observation.channels;
+    height = observation.height;
+    width = observation.width;
+    frame_bytes = static_cast<size_t>(channels) * height * width;
+    this->decode_threads = std::max(1, decode_threads);
+    this->cached_frames = cached_frames;
+    rng.seed(std::random_device{}());
+    for (int i = 0; i < this->decode_threads; i++)
+        workers.emplace_back(&ActionLogReplay::workerLoop, this);
+}
+
+ActionLogReplay::~ActionLogReplay()
+{
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ActionLogReplay::beginEpisode(const std::string& level, uint32_t seed, float dt)
+{
+    auto it = std::find(levels.begin(), levels.end(), level);
+    uint16_t levelId = static_cast<uint16_t>(std::distance(levels.begin(), it));
+    if (it == levels.end())
+    {
+        auto parsed = std::make_shared<LevelData>();
+        parsed->LoadData(level);
+        levels.push_back(level);
+        parsed_levels.push_back(parsed);
+    }
+
+    Trajectory trajectory;
+    trajectory.level = levelId;
+    trajectory.seed = seed;
+    trajectory.dt = dt;
+    trajectories.push_back(trajectory);
+    recording = true;
+}
+
+void ActionLogReplay::record(Action action, float reward, bool terminated, bool truncated)
+{
+    if (!recording)
+        return;
+    Trajectory& trajectory = trajectories.back();
+    trajectory.actions.push_back(static_cast<uint8_t>(action));
+    trajectory.rewards.push_back(reward);
+    trajectory.flags.push_back(static_cast<uint8_t>((terminated ? 1 : 0) | (truncated ? 2 : 0)));
+    stored_steps++;
+    if (terminated || truncated)
+        recording = false;
+
+    // Drop whole episodes from the front, never the one being recorded
+    while (stored_steps > capacity && trajectories.size() > 1)
+    {
+        stored_steps -= trajectories.front().actions.size();
+        trajectories.pop_front();
+        first_id++;
+    }
+}
+
+size_t ActionLogReplay::size() const
+{
+    return stored_steps;
+}
+
+Tensor_step_return ActionLogReplay::sample(int batch_size)
+{
+    int count = static_cast<int>(std::min<size_t>(batch_size, stored_steps));
+    torch::Tensor states = torch::empty({ count, channels, height, width }, torch::kByte);
+    torch::Tensor next_states = torch::empty_like(states);
+    torch::Tensor actions = torch::empty({ count, 1 }, torch::kFloat);
+    torch::Tensor rewards = torch::empty({ count, 1 }, torch::kFloat);
+    torch::Tensor dones = torch::empty({ count, 1 }, torch::kFloat);
+    uint8_t* state_pixels = states.data_ptr<uint8_t>();
+    uint8_t* next_state_pixels = next_states.data_ptr<uint8_t>();
+
+    // Map uniformly drawn step indices onto trajectories
+    std::vector<size_t> ends;
+    size_t total = 0;
+    for (auto& trajectory : trajectories)
+    {
+        total += trajectory.actions.size();
+        ends.push_back(total);
+    }
+
+    std::map<uint64_t, std::vector<Request>> groups;
+    std::uniform_int_distribution<size_t> pick(0, total > 0 ? total - 1 : 0);
+    for (int row = 0; row < count; row++)
+    {
+        size_t index = pick(rng);
+        size_t position = std::upper_bound(ends.begin(), ends.end(), index) - ends.begin();
+        const Trajectory& trajectory = trajectories[position];
+        uint32_t step = static_cast<uint32_t>(index - (position > 0 ? ends[position - 1] : 0));
+        uint64_t id = first_id + position;
+
+        actions.data_ptr<float>()[row] = static_cast<float>(trajectory.actions[step]);
+        rewards.data_ptr<float>()[row] = trajectory.rewards[step];
+        dones.data_ptr<float>()[row] = static_cast<float>(trajectory.flags[step] & 1);
+
+        Request request{ row, step, false, false };
+        request.has_state = cachedFrame({ id, step }, state_pixels + row * frame_bytes);
+        request.has_next_state = cachedFrame({ id, step + 1 }, next_state_pixels + row * frame_bytes);
+        if (!request.has_state || !request.has_next_state)
+            groups[id].push_back(request);
+    }
+
+    // Every trajectory is re-simulated once for all of its requests, the pool takes them one at a time
+    Work batch(groups.begin(), groups.end());
+    if (!batch.empty())
+    {
+        std::unique_lock<std::mutex> lock(work_mutex);
+        work = &batch;
+        work_states = state_pixels;
+        work_next_states = next_state_pixels;
+        next_item = 0;
+        active_workers = static_cast<int>(workers.size());
+        generation++;
+        work_ready.notify_all();
+        work_done.wait(lock, [this]() { return active_workers == 0; });
+        work = nullptr;
+    }
+
+    Tensor_step_return tensor;
+    tensor.states = states.to(torch::kFloat).div_(255);
+    tensor.next_states = next_states.to(torch::kFloat).div_(255);
+    tensor.actions = actions;
+    tensor.rewards = rewards;
+    tensor.dones = dones;
+    return tensor;
+}
+
+void ActionLogReplay::workerLoop()
+{
+    // Created once, a render texture brings its own GL context
+    sf::RenderTexture target;
+    target.create(width, height);
+
+    uint64_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(work_mutex);
+            work_ready.wait(lock, [&]() { return generation != seen || stopping; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        for (size_t i = next_item.fetch_add(1); i < work->size(); i = next_item.fetch_add(1))
+            decodeTrajectory(target, (*work)[i].first, (*work)[i].second, work_states, work_next_states);
+        {
+            std::lock_guard<std::mutex> lock(work_mutex);
+            if (--active_workers == 0)
+                work_done.notify_all();
+        }
+    }
+}
+
+void ActionLogReplay::decodeTrajectory(sf::RenderTexture& target, uint64_t id, std::vector<Request>& requests, uint8_t* states, uint8_t* next_states)
+{
+    const Trajectory& trajectory = trajectories[id - first_id];
+    uint32_t first_frame = std::numeric_limits<uint32_t>::max();
+    uint32_t last_frame = 0;
+    for (auto& request : requests)
+    {
+        first_frame = std::min(first_frame, request.has_state ? request.step + 1 : request.step);
+        last_frame = std::max(last_frame, request.step + 1);
+    }
+
+    // Start from the nearest snapshot before the first missing frame, or from a copy of the parsed level
+    uint32_t start_frame = first_frame;
+    std::shared_ptr<const LevelData> snapshot = findSnapshot(id, start_frame);
+    std::unique_ptr<LevelData> level;
+    if (snapshot)
+    {
+        level = std::make_unique<LevelData>(*snapshot);
+    }
+    else
+    {
+        start_frame = 0;
+        level = std::make_unique<LevelData>(*parsed_levels[trajectory.level]);
+        level->StartSimulation(true);
+    }
+
+    for (uint32_t frame = start_frame; frame <= last_frame; frame++)
+    {
+        if (frame > start_frame)
+        {
+            level->Update(trajectory.dt, static_cast<Action>(trajectory.actions[frame - 1]));
+            if (snapshot_every > 0 && frame % snapshot_every == 0)
+                storeSnapshot({ id, frame }, *level);
+        }
+
+        bool needed = false;
+        for (auto& request : requests)
+            needed |= (!request.has_state && request.step == frame) || (!request.has_next_state && request.step + 1 == frame);
+        if (!needed)
+            continue;
+
+        target.clear();
+        level->DrawScene(target);
+        target.display();
+        sf::Image image = target.getTexture().copyToImage();
+        const uint8_t* pixels = image.getPixelsPtr();
+
+        for (auto& request : requests)
+        {
+            if (!request.has_state && request.step == frame)
+                std::memcpy(states + request.row * frame_bytes, pixels, frame_bytes);
+            if (!request.has_next_state && request.step + 1 == frame)
+                std::memcpy(next_states + request.row * frame_bytes, pixels, frame_bytes);
+        }
+        storeFrame({ id, frame }, pixels);
+    }
+}
+
+bool ActionLogReplay::cachedFrame(const FrameKey& key, uint8_t* pixels)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(key);
+    if (it == cache.end())
+        return false;
+    lru.splice(lru.begin(), lru, it->second.second);
+    std::memcpy(pixels, it->second.first.data(), frame_bytes);
+    return true;
+}
+
+void ActionLogReplay::storeFrame(const FrameKey& key, const uint8_t* pixels)
+{
+    if (cached_frames == 0)
+        return;
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (cache.find(key) != cache.end())
+        return;
+
+    std::vector<uint8_t> frame;
+    if (cache.size() >= cached_frames)
+    {
+        // Reuse the evicted frame's memory
+        auto oldest = cache.find(lru.back());
+        frame = std::move(oldest->second.first);
+        cache.erase(oldest);
+        lru.pop_back();
+    }
+    frame.assign(pixels, pixels + frame_bytes);
+    lru.push_front(key);
+    cache.emplace(key, std::make_pair(std::move(frame), lru.begin()));
+}
+
+std::shared_ptr<const LevelData> ActionLogReplay::findSnapshot(uint64_t id, uint32_t& frame)
+{
+    if (snapshot_every == 0 || cached_snapshots == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    for (uint32_t candidate = frame / snapshot_every * snapshot_every; candidate > 0; candidate -= snapshot_every)
+    {
+        auto it = snapshots.find({ id, candidate });
+        if (it == snapshots.end())
+            continue;
+        snapshot_lru.splice(snapshot_lru.begin(), snapshot_lru, it->second.second);
+        frame = candidate;
+        return it->second.first;
+    }
+    return nullptr;
+}
+
+void ActionLogReplay::storeSnapshot(const FrameKey& key, const LevelData& level)
+{
+    if (cached_snapshots == 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        if (snapshots.find(key) != snapshots.end())
+            return;
+    }
+    // Copied outside the lock, other decoders only wait for the map
+    auto copy = std::make_shared<const LevelData>(level);
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    if (snapshots.find(key) != snapshots.end())
+        return;
+    if (snapshots.size() >= cached_snapshots)
+    {
+        snapshots.erase(snapshot_lru.back());
+        snapshot_lru.pop_back();
+    }
+    snapshot_lru.push_front(key);
+    snapshots.emplace(key, std::make_pair(copy, snapshot_lru.begin()));
+}
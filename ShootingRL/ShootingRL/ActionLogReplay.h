@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "EnviromentObjectsType.h"
+
+struct Tensor_step_return;
+struct ObservationSpec;
+class LevelData;
+namespace sf { class RenderTexture; }
+
+// Replay that keeps only what is needed to replay an episode: the level, the seed and one byte of
+// action plus the reward per step. LevelData is deterministic, so sampled transitions are rebuilt by
+// re-simulating their episode and rendering the requested frames, which costs CPU instead of memory.
+// Decoding runs on a pool of threads that keep their render targets, every level is parsed once and
+// copied, and snapshots of the simulation every snapshot_every frames let decoding start near the
+// requested steps instead of at the start of the episode.
+class ActionLogReplay
+{
+public:
+	struct Trajectory
+	{
+		uint16_t level;
+		uint32_t seed;
+		float dt;
+		std::vector<uint8_t> actions;
+		std::vector<float> rewards;
+		std::vector<uint8_t> flags;  // bit 0 terminated, bit 1 truncated
+	};
+
+	ActionLogReplay(size_t capacity, const ObservationSpec& observation, int decode_threads, size_t cached_frames);
+	~ActionLogReplay();
+	ActionLogReplay(const ActionLogReplay&) = delete;
+	ActionLogReplay& operator=(const ActionLogReplay&) = delete;
+	// Recording
+	void beginEpisode(const std::string& level, uint32_t seed, float dt);
+	void record(Action action, float reward, bool terminated, bool truncated);
+	// Sampling
+	Tensor_step_return sample(int batch_size);
+	size_t size() const;
+
+	uint32_t snapshot_every = 64;
+	size_t cached_snapshots = 128;
+
+private:
+	struct FrameKey
+	{
+		uint64_t trajectory;
+		uint32_t frame;  // Frame after this many steps of the trajectory
+		bool operator==(const FrameKey& other) const { return trajectory == other.trajectory && frame == other.frame; }
+	};
+	struct FrameKeyHash
+	{
+		size_t operator()(const FrameKey& key) const { return std::hash<uint64_t>()(key.trajectory * 1000003ull + key.frame); }
+	};
+
+	// One sampled transition waiting for its frames
+	struct Request
+	{
+		int row;
+		uint32_t step;
+		bool has_state;
+		bool has_next_state;
+	};
+
+	using Work = std::vector<std::pair<uint64_t, std::vector<Request>>>;
+
+	void workerLoop();
+	void decodeTrajectory(sf::RenderTexture& target, uint64_t id, std::vector<Request>& requests, uint8_t* states, uint8_t* next_states);
+	bool cachedFrame(const FrameKey& key, uint8_t* pixels);
+	void storeFrame(const FrameKey& key, const uint8_t* pixels);
+	// Latest snapshot of the trajectory at or before frame, frame is set to where it was taken
+	std::shared_ptr<const LevelData> findSnapshot(uint64_t id, uint32_t& frame);
+	void storeSnapshot(const FrameKey& key, const LevelData& level);
+
+	size_t capacity;
+	int channels, height, width;
+	size_t frame_bytes;
+	int decode_threads;
+	std::mt19937 rng;
+
+	std::vector<std::string> levels;
+	std::vector<std::shared_ptr<const LevelData>> parsed_levels;  // Parsed once, decoding copies them
+	// Oldest trajectories are dropped once more than capacity steps are stored, ids keep counting up
+	std::deque<Trajectory> trajectories;
+	uint64_t first_id = 0;
+	size_t stored_steps = 0;
+	bool recording = false;
+
+	// LRU of decoded frames
+	std::mutex cache_mutex;
+	size_t cached_frames;
+	std::list<FrameKey> lru;
+	std::unordered_map<FrameKey, std::pair<std::vector<uint8_t>, std::list<FrameKey>::iterator>, FrameKeyHash> cache;
+
+	// LRU of simulation states, keyed by the frame they were taken at
+	std::mutex snapshot_mutex;
+	std::list<FrameKey> snapshot_lru;
+	std::unordered_map<FrameKey, std::pair<std::shared_ptr<const LevelData>, std::list<FrameKey>::iterator>, FrameKeyHash> snapshots;
+
+	// Decode pool, sample() hands out one batch of work per generation
+	std::vector<std::thread> workers;
+	std::mutex work_mutex;
+	std::condition_variable work_ready, work_done;
+	uint64_t generation = 0;
+	int active_workers = 0;
+	bool stopping = false;
+	Work* work = nullptr;
+	std::atomic<size_t> next_item{ 0 };
+	uint8_t* work_states = nullptr;
+	uint8_t* work_next_states = nullptr;
+};
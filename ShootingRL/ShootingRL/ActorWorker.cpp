@@ -0,0 +1,284 @@
+#include "ActorWorker.h"
+#include "SharedReplay.h"
+#include "ThreadTopology.h"
+#include "TrajectoryRecorder.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+std::vector<std::string> ActorConfig::toArguments() const
+{
+    return {
+        "--actor",
+        std::to_string(index),
+        shared_name,
+        level_name,
+        std::to_string(environments),
+        std::to_string(dt),
+        std::to_string(max_steps),
+        std::to_string(static_cast<int>(inference_mode)),
+        std::to_string(seed),
+        cores,
+        std::to_string(time_limit),
+        std::to_string(no_progress_steps),
+        std::to_string(pinned_steps),
+        trajectory_file,
+        std::to_string(trajectory_steps_per_chunk),
+        std::to_string(trajectory_pending_chunks),
+    };
+}
+
+ActorConfig ActorConfig::fromArguments(int argc, char* argv[])
+{
+    ActorConfig config;
+    if (argc < 10)
+        throw std::runtime_error("Actor process started with missing arguments.");
+    config.index = std::stoi(argv[2]);
+    config.shared_name = argv[3];
+    config.level_name = argv[4];
+    config.environments = std::stoi(argv[5]);
+    config.dt = std::stof(argv[6]);
+    config.max_steps = std::stoi(argv[7]);
+    config.inference_mode = static_cast<ActorPrecision>(std::stoi(argv[8]));
+    config.seed = static_cast<unsigned>(std::stoul(argv[9]));
+    if (argc > 10)
+        config.cores = argv[10];
+    if (argc > 13)
+    {
+        config.time_limit = std::stof(argv[11]);
+        config.no_progress_steps = std::stoi(argv[12]);
+        config.pinned_steps = std::stoi(argv[13]);
+    }
+    if (argc > 16)
+    {
+        config.trajectory_file = argv[14];
+        config.trajectory_steps_per_chunk = std::stoi(argv[15]);
+        config.trajectory_pending_chunks = std::stoi(argv[16]);
+    }
+    return config;
+}
+
+namespace {
+    // Snapshots for the learner's spectator view, about the display rate
+    const std::chrono::milliseconds spectatorInterval(33);
+
+    struct ActorEnv
+    {
+        LevelData level;
+        sf::Image previous;
+        float score = 0.0f;
+        int steps = 0;
+        uint32_t episode = 0;
+        bool done = true;
+    };
+
+    sf::Image render(sf::RenderTexture& target, LevelData& level)
+    {
+        target.clear();
+        level.DrawScene(target);
+        target.display();
+        return target.getTexture().copyToImage();
+    }
+}
+
+int runActorProcess(const ActorConfig& config)
+{
+    SharedReplay replay;
+    if (!replay.Open(config.shared_name))
+    {
+        std::cout << "Actor " << config.index << " could not open the shared replay.\n";
+        return 1;
+    }
+
+    // Actors run many single sample forwards side by side, intra-op threads would only contend
+    ThreadTopology::ApplyActor(ThreadPlan::ParseCores(config.cores));
+
+    const ObservationSpec observation = replay.header->observation;
+    int actionCount = static_cast<int>(replay.header->action_count);
+    // Built from the learner's spec, the published weights only fit a network of the same layout
+    QNetwork network(replay.header->network.ToSpec(), actionCount, config.seed);
+    int64_t parameterCount = 0;
+    for (auto& parameter : network->parameters())
+        parameterCount += parameter.numel();
+    if (static_cast<uint64_t>(parameterCount) != replay.header->weight_count)
+    {
+        std::cout << "Actor " << config.index << " built " << parameterCount << " parameters, the learner publishes "
+            << replay.header->weight_count << ".\n";
+        return 1;
+    }
+    InferenceNetwork inference;
+    inference.mode = config.inference_mode;
+    uint64_t weightVersion = 0;
+
+    sf::RenderTexture target;
+    if (!target.create(observation.width, observation.height))
+        return 1;
+
+    // One stream per environment, the actors write separate files so no two processes append to the same one
+    TrajectoryRecorder recorder;
+    bool recording = config.trajectory_file != "-";
+    if (recording && !recorder.open(config.trajectory_file + "_actor" + std::to_string(config.index), observation,
+        config.environments, config.trajectory_steps_per_chunk, config.trajectory_pending_chunks))
+    {
+        std::cout << "Actor " << config.index << " could not open its trajectory file.\n";
+        return 1;
+    }
+
+    std::mt19937 rng(config.seed + config.index);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::uniform_int_distribution<int> randomAction(0, actionCount - 1);
+    std::vector<ActorEnv> envs(config.environments);
+    std::vector<ShapeSnapshot> shapes(SharedReplay::maxSpectatorShapes);
+    auto nextSnapshot = std::chrono::steady_clock::now();
+
+    try
+    {
+        while (!replay.ShutdownRequested())
+        {
+            if (replay.PullWeights(*network, weightVersion))
+                inference.refresh(*network);
+            if (!inference.isReady())
+            {
+                // Nothing to act with before the learner published the first weights
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+
+            if (replay.header->throttle.load(std::memory_order_relaxed) != 0)
+            {
+                // The learner asked for time to catch up with the replay ratio
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            float epsilon = replay.header->epsilon.load(std::memory_order_relaxed);
+            int spectated = replay.header->spectated_env.load(std::memory_order_relaxed) - config.index * config.environments;
+            for (auto& env : envs)
+            {
+                int index = static_cast<int>(&env - envs.data());
+                if (env.done)
+                {
+                    env.level.LoadData(config.level_name);
+                    env.level.SetTermination({ config.time_limit, config.max_steps, config.no_progress_steps, config.pinned_steps });
+                    env.level.StartSimulation(true);
+                    env.previous = render(target, env.level);
+                    env.score = 0.0f;
+                    env.steps = 0;
+                    env.done = false;
+                    if (recording)
+                        recorder.beginEpisode(index);
+                }
+
+                int action;
+                if (uniform(rng) > epsilon)
+                {
+                    torch::Tensor values = inference.forward(convertToTensor(env.previous));
+                    action = static_cast<int>(torch::argmax(values).item().toInt() % actionCount);
+                }
+                else
+                {
+                    action = randomAction(rng);
+                }
+
+                Simulation_Step_return step_return = env.level.Update(config.dt, static_cast<Action>(action));
+                sf::Image next = render(target, env.level);
+                env.steps++;
+                env.score += step_return.reward;
+                bool truncated = step_return.truncated || env.steps >= config.max_steps;
+
+                replay.Add(config.index, env.previous.getPixelsPtr(), next.getPixelsPtr(), step_return.action,
+                    step_return.reward, step_return.terminated, truncated);
+                if (recording)
+                    recorder.record(index, env.previous.getPixelsPtr(), next.getPixelsPtr(), step_return.action,
+                        step_return.reward, step_return.terminated, truncated);
+                env.previous = next;
+
+                // Only the watched environment pays for a clock read, and only a few times per second for the copy
+                if (index == spectated && std::chrono::steady_clock::now() >= nextSnapshot)
+                {
+                    size_t count = env.level.SnapshotShapes(shapes.data(), shapes.size());
+                    replay.PublishSpectator(config.index * config.environments + spectated, env.episode, env.steps, env.score, shapes.data(), count);
+                    nextSnapshot = std::chrono::steady_clock::now() + spectatorInterval;
+                }
+
+                if (step_return.terminated || truncated)
+                {
+                    replay.EndEpisode(config.index, env.score, env.steps);
+                    env.episode++;
+                    env.done = true;
+                }
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Actor " << config.index << " stopped: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+bool ActorProcess::spawn(const ActorConfig& config)
+{
+    std::vector<std::string> arguments = config.toArguments();
+#ifdef _WIN32
+    char executable[MAX_PATH];
+    GetModuleFileNameA(nullptr, executable, MAX_PATH);
+    std::string commandLine = "\"" + std::string(executable) + "\"";
+    for (auto& argument : arguments)
+        commandLine += " \"" + argument + "\"";
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    PROCESS_INFORMATION process = {};
+    if (!CreateProcessA(nullptr, commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+        return false;
+    CloseHandle(process.hThread);
+    handle = process.hProcess;
+    return true;
+#else
+    // fork + exec instead of a bare fork, the child must not inherit torch's thread pools
+    pid = fork();
+    if (pid == 0)
+    {
+        std::vector<char*> argv;
+        std::string executable = "/proc/self/exe";
+        argv.push_back(executable.data());
+        for (auto& argument : arguments)
+            argv.push_back(argument.data());
+        argv.push_back(nullptr);
+        execv(executable.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid > 0;
+#endif
+}
+
+void ActorProcess::join()
+{
+#ifdef _WIN32
+    if (handle != nullptr)
+    {
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+        handle = nullptr;
+    }
+#else
+    if (pid > 0)
+    {
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+#endif
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "InferenceNetwork.h"
+
+// Settings handed to an actor process on its command line
+struct ActorConfig
+{
+	int index = 0;
+	std::string shared_name;
+	std::string level_name;
+	int environments = 1;
+	float dt = 0.02f;
+	int max_steps = 10000;
+	// Episode cutoffs, see TerminationConfig
+	float time_limit = 60.0f;
+	int no_progress_steps = 0;
+	int pinned_steps = 0;
+	ActorPrecision inference_mode = ActorPrecision::FP32;
+	unsigned seed = 0;
+	std::string cores = "-";  // Logical processors to pin to, see ThreadPlan::FormatCores
+	// Every environment of the actor records into <trajectory_file>_actor<index>.traj, "-" disables recording
+	std::string trajectory_file = "-";
+	int trajectory_steps_per_chunk = 128;
+	int trajectory_pending_chunks = 8;
+
+	std::vector<std::string> toArguments() const;
+	static ActorConfig fromArguments(int argc, char* argv[]);
+};
+
+// Entry point of an actor process: steps its own headless environments with an inference copy of the
+// network and writes every transition into the shared replay ring until the learner asks it to stop
+int runActorProcess(const ActorConfig& config);
+
+// Handle to an actor process started by the learner
+class ActorProcess
+{
+public:
+	bool spawn(const ActorConfig& config);
+	void join();
+
+private:
+#ifdef _WIN32
+	void* handle = nullptr;
+#else
+	int pid = -1;
+#endif
+};
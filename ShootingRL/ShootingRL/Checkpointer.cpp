@@ -0,0 +1,201 @@
+#include "Checkpointer.h"
+#include "DQN.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+namespace {
+    const char* indexName = "checkpoints.csv";
+
+    // Appends whatever the archive serializes, the buffer keeps its capacity between checkpoints
+    std::function<size_t(const void*, size_t)> appendTo(std::vector<char>& buffer)
+    {
+        return [&buffer](const void* data, size_t size) {
+            const char* bytes = static_cast<const char*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+            return size;
+        };
+    }
+
+    // Readers never see a half written file, it only gets its name once it is complete and on disk,
+    // otherwise a crash right after the rename could leave the new name pointing at missing data
+    void writeFile(const std::string& path, const std::vector<char>& bytes)
+    {
+        std::string temporary = path + ".tmp";
+        std::FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (file == nullptr)
+            throw std::runtime_error("Could not create " + temporary);
+        bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() && std::fflush(file) == 0;
+#ifdef _WIN32
+        written = written && _commit(_fileno(file)) == 0;
+#else
+        written = written && fsync(fileno(file)) == 0;
+#endif
+        written = std::fclose(file) == 0 && written;
+        if (!written)
+            throw std::runtime_error("Could not write " + temporary);
+        std::filesystem::rename(temporary, path);
+    }
+
+    void removeCheckpoint(const std::string& prefix)
+    {
+        std::error_code error;
+        std::filesystem::remove(prefix + "_network.pt", error);
+        std::filesystem::remove(prefix + "_optimizer.pt", error);
+        std::filesystem::remove(prefix + "_spec.txt", error);
+    }
+}
+
+AsyncCheckpointer::~AsyncCheckpointer()
+{
+    close();
+}
+
+bool AsyncCheckpointer::open(const CheckpointConfig& config, std::function<void()> flush_replay)
+{
+    close();
+    this->config = config;
+    this->flush_replay = flush_replay;
+    std::error_code error;
+    std::filesystem::create_directories(config.directory, error);
+    if (error)
+        return false;
+
+    // Checkpoints of earlier runs take part in the rotation
+    kept.clear();
+    std::ifstream index((std::filesystem::path(config.directory) / indexName).string());
+    std::string line;
+    while (std::getline(index, line))
+    {
+        std::string prefix = line.substr(line.find_last_of(',') + 1);
+        if (prefix.empty() || !std::filesystem::exists(prefix + "_network.pt"))
+            continue;
+        kept.erase(std::remove(kept.begin(), kept.end(), prefix), kept.end());
+        kept.push_back(prefix);
+    }
+
+    next_due = std::chrono::steady_clock::now() + std::chrono::seconds(config.interval_seconds);
+    stopping = false;
+    writer = std::thread(&AsyncCheckpointer::writerLoop, this);
+    return true;
+}
+
+void AsyncCheckpointer::close()
+{
+    if (!writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    has_work.notify_all();
+    writer.join();
+}
+
+bool AsyncCheckpointer::due() const
+{
+    return writer.joinable() && std::chrono::steady_clock::now() >= next_due;
+}
+
+bool AsyncCheckpointer::save(torch::nn::Module& network, torch::optim::Optimizer& optimizer, const CheckpointSpec& spec, uint64_t step, int episode, double score)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!writer.joinable() || pending || busy)
+            return false;
+    }
+
+    // The only part the training thread pays for, serializing into memory
+    staging.network.clear();
+    staging.optimizer.clear();
+    torch::serialize::OutputArchive networkArchive;
+    network.save(networkArchive);
+    networkArchive.save_to(appendTo(staging.network));
+    torch::serialize::OutputArchive optimizerArchive;
+    optimizer.save(optimizerArchive);
+    optimizerArchive.save_to(appendTo(staging.optimizer));
+    std::string specText = spec.serialize();
+    staging.spec.assign(specText.begin(), specText.end());
+    staging.step = step;
+    staging.episode = episode;
+    staging.score = score;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(staging, writing);
+        pending = true;
+    }
+    has_work.notify_one();
+    next_due = std::chrono::steady_clock::now() + std::chrono::seconds(config.interval_seconds);
+    return true;
+}
+
+uint64_t AsyncCheckpointer::written() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return written_count;
+}
+
+void AsyncCheckpointer::writerLoop()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            has_work.wait(lock, [this]() { return pending || stopping; });
+            if (!pending)
+                return;
+            pending = false;
+            busy = true;
+        }
+        try
+        {
+            write(writing);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Checkpoint at step " << writing.step << " failed: " << e.what() << "\n";
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        busy = false;
+    }
+}
+
+void AsyncCheckpointer::write(const Staged& staged)
+{
+    std::filesystem::path directory(config.directory);
+    std::string prefix = (directory / std::to_string(staged.step)).string();
+    writeFile(prefix + "_network.pt", staged.network);
+    writeFile(prefix + "_optimizer.pt", staged.optimizer);
+    writeFile(prefix + "_spec.txt", staged.spec);
+    if (flush_replay)
+        flush_replay();
+
+    // Listed only once all files are in place
+    bool exists = std::filesystem::exists(directory / indexName);
+    std::ofstream index((directory / indexName).string(), std::ios::app);
+    if (!exists)
+        index << "step,episode,score,unix_time,path\n";
+    index << staged.step << "," << staged.episode << "," << staged.score << "," << static_cast<long long>(std::time(nullptr)) << "," << prefix << "\n";
+
+    kept.erase(std::remove(kept.begin(), kept.end(), prefix), kept.end());
+    kept.push_back(prefix);
+    while (config.keep > 0 && kept.size() > static_cast<size_t>(config.keep))
+    {
+        removeCheckpoint(kept.front());
+        kept.pop_front();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    written_count++;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <torch/torch.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CheckpointSpec;
+
+struct CheckpointConfig
+{
+	std::string directory = "Checkpoints";
+	int keep = 5;                 // Newest checkpoints kept on disk, older ones are deleted
+	int interval_seconds = 300;   // Between two checkpoints, 0 saves whenever asked
+};
+
+// Saves checkpoints without holding up training. save() serializes the network and the optimizer into
+// staging buffers in memory on the calling thread; a background thread writes them to temporary files,
+// renames those to <directory>/<step>_network.pt, <step>_optimizer.pt and <step>_spec.txt, appends the
+// step, episode and score to <directory>/checkpoints.csv and deletes the checkpoints beyond the newest keep.
+// The files are the same DQN::checkpoint writes, so DQN::loadCheckpoint and the evaluator read them as before.
+// Every file is flushed to disk before its rename, and the index row is only appended after flush_replay
+// has run, so a listed checkpoint never resumes with an older replay file than it was saved with.
+class AsyncCheckpointer
+{
+public:
+	AsyncCheckpointer() {};
+	~AsyncCheckpointer();
+	bool open(const CheckpointConfig& config, std::function<void()> flush_replay = nullptr);
+	// Waits for the checkpoint being written
+	void close();
+
+	bool due() const;
+	// Skipped, returning false, while the previous checkpoint is still being written
+	bool save(torch::nn::Module& network, torch::optim::Optimizer& optimizer, const CheckpointSpec& spec, uint64_t step, int episode, double score);
+	uint64_t written() const;
+
+private:
+	struct Staged
+	{
+		std::vector<char> network;
+		std::vector<char> optimizer;
+		std::vector<char> spec;
+		uint64_t step = 0;
+		int episode = 0;
+		double score = 0.0;
+	};
+
+	void writerLoop();
+	void write(const Staged& staged);
+
+	CheckpointConfig config;
+	std::function<void()> flush_replay;  // Called on the writer thread
+	std::chrono::steady_clock::time_point next_due;
+	// Two sets of buffers, one filled by save while the writer empties the other
+	Staged staging, writing;
+	std::deque<std::string> kept;  // Path prefixes, oldest first
+
+	std::thread writer;
+	mutable std::mutex mutex;
+	std::condition_variable has_work;
+	bool pending = false;
+	bool busy = false;
+	bool stopping = false;
+	uint64_t written_count = 0;
+};
@@ -0,0 +1,285 @@
+#include "ChunkedLevel.h"
+#include "algorithm"
+#include "fstream"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "EnviromentObjectsType.h"
+
+namespace {
+	const char chunkMagic[4] = { 'L', 'V', 'C', '2' };
+	const char motionlessMagic[4] = { 'L', 'V', 'C', '1' };  // Written before motions were stored
+	const size_t defaultCacheChunks = 4096;
+
+	struct Bounds
+	{
+		glm::vec2 center;
+		float reach;
+	};
+
+	// Same corners SFML computes for a rotated rectangle
+	Bounds BoundsOf(const ShapeSnapshot& shape)
+	{
+		float radians = glm::radians(shape.rotation);
+		float c = std::cos(radians), s = std::sin(radians);
+		glm::vec2 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+		const glm::vec2 local[4] = { { 0.0f, 0.0f }, { shape.width, 0.0f }, { shape.width, shape.height }, { 0.0f, shape.height } };
+		for (auto corner : local) {
+			corner -= glm::vec2(shape.origin_x, shape.origin_y);
+			glm::vec2 world(shape.x + c * corner.x - s * corner.y, shape.y + s * corner.x + c * corner.y);
+			low = glm::min(low, world);
+			high = glm::max(high, world);
+		}
+		return { (low + high) * 0.5f, glm::length(high - low) * 0.5f };
+	}
+
+	template<class T>
+	void Append(std::vector<char>& bytes, const T& value)
+	{
+		const char* data = reinterpret_cast<const char*>(&value);
+		bytes.insert(bytes.end(), data, data + sizeof(T));
+	}
+
+	// target, type, speed, direction, waypoint count, then the waypoints as x, y pairs
+	void AppendMotion(std::vector<char>& bytes, const TargetMotion& motion)
+	{
+		Append(bytes, static_cast<int32_t>(motion.target));
+		Append(bytes, static_cast<int32_t>(motion.type));
+		Append(bytes, motion.speed);
+		Append(bytes, motion.direction);
+		Append(bytes, static_cast<uint32_t>(motion.waypoints.size()));
+		for (auto& point : motion.waypoints) {
+			Append(bytes, point.x);
+			Append(bytes, point.y);
+		}
+	}
+
+	bool ReadMotion(std::istream& is, TargetMotion& motion)
+	{
+		int32_t target = 0, type = 0;
+		uint32_t count = 0;
+		is.read(reinterpret_cast<char*>(&target), sizeof(target));
+		is.read(reinterpret_cast<char*>(&type), sizeof(type));
+		is.read(reinterpret_cast<char*>(&motion.speed), sizeof(motion.speed));
+		is.read(reinterpret_cast<char*>(&motion.direction), sizeof(motion.direction));
+		is.read(reinterpret_cast<char*>(&count), sizeof(count));
+		if (!is.good() || type < 0 || type > static_cast<int32_t>(MotionType::Loop) || count > (1u << 20))
+			return false;
+		motion.target = target;
+		motion.type = static_cast<MotionType>(type);
+		motion.waypoints.resize(count);
+		for (auto& point : motion.waypoints) {
+			is.read(reinterpret_cast<char*>(&point.x), sizeof(point.x));
+			is.read(reinterpret_cast<char*>(&point.y), sizeof(point.y));
+		}
+		return is.good();
+	}
+}
+
+bool ChunkedLevel::Write(const std::string& filename, const std::vector<ShapeSnapshot>& shapes, const std::vector<TargetMotion>& motions, float chunkSize)
+{
+	std::vector<ShapeSnapshot> players;
+	std::vector<std::pair<glm::vec2, ShapeSnapshot>> placed;
+	std::vector<int> movingNumbers;  // Per placed shape, its MovingTarget number or -1
+	int movingCount = 0;
+	glm::vec2 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+	float maxExtent = 0.0f;
+	int32_t targetCount = 0;
+	for (auto& shape : shapes) {
+		if (shape.type == static_cast<int32_t>(ShapeType::Player)) {
+			players.push_back(shape);
+			continue;
+		}
+		if (shape.type < 0 || shape.type == static_cast<int32_t>(ShapeType::None))
+			continue;
+		Bounds bounds = BoundsOf(shape);
+		placed.push_back({ bounds.center, shape });
+		movingNumbers.push_back(shape.type == static_cast<int32_t>(ShapeType::MovingTarget) ? movingCount++ : -1);
+		low = glm::min(low, bounds.center);
+		high = glm::max(high, bounds.center);
+		maxExtent = std::max(maxExtent, bounds.reach);
+		if (shape.type == static_cast<int32_t>(ShapeType::StaticTarget) || shape.type == static_cast<int32_t>(ShapeType::MovingTarget))
+			targetCount++;
+	}
+	if (placed.empty())
+		low = high = glm::vec2(0.0f);
+
+	int32_t columns = static_cast<int32_t>(std::floor((high.x - low.x) / chunkSize)) + 1;
+	int32_t rows = static_cast<int32_t>(std::floor((high.y - low.y) / chunkSize)) + 1;
+	std::vector<Chunk> chunks(static_cast<size_t>(columns) * rows);
+	for (size_t i = 0; i < placed.size(); i++) {
+		int cx = std::min(columns - 1, static_cast<int>((placed[i].first.x - low.x) / chunkSize));
+		int cy = std::min(rows - 1, static_cast<int>((placed[i].first.y - low.y) / chunkSize));
+		Chunk& chunk = chunks[static_cast<size_t>(cy) * columns + cx];
+		if (movingNumbers[i] >= 0) {
+			int number = movingNumbers[i];
+			auto motion = std::find_if(motions.begin(), motions.end(), [&](const TargetMotion& m) { return m.target == number; });
+			chunk.motions.push_back(motion != motions.end() ? *motion : TargetKinematics::DefaultMotion(static_cast<uint64_t>(number)));
+			chunk.motions.back().target = static_cast<int>(chunk.shapes.size());
+		}
+		chunk.shapes.push_back(placed[i].second);
+	}
+	std::vector<std::vector<char>> motionBytes(chunks.size());
+	for (size_t c = 0; c < chunks.size(); c++)
+		for (auto& motion : chunks[c].motions)
+			AppendMotion(motionBytes[c], motion);
+
+	std::ofstream os(filename, std::ios::binary);
+	if (!os.is_open())
+		return false;
+	int32_t playerCount = static_cast<int32_t>(players.size());
+	os.write(chunkMagic, sizeof(chunkMagic));
+	os.write(reinterpret_cast<const char*>(&chunkSize), sizeof(chunkSize));
+	os.write(reinterpret_cast<const char*>(&low), sizeof(low));
+	os.write(reinterpret_cast<const char*>(&columns), sizeof(columns));
+	os.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+	os.write(reinterpret_cast<const char*>(&maxExtent), sizeof(maxExtent));
+	os.write(reinterpret_cast<const char*>(&targetCount), sizeof(targetCount));
+	os.write(reinterpret_cast<const char*>(&playerCount), sizeof(playerCount));
+	os.write(reinterpret_cast<const char*>(players.data()), players.size() * sizeof(ShapeSnapshot));
+
+	// The directory goes before the shapes, so its offsets are known up front
+	uint64_t offset = static_cast<uint64_t>(os.tellp()) + chunks.size() * (sizeof(uint64_t) + 2 * sizeof(uint32_t));
+	for (size_t c = 0; c < chunks.size(); c++) {
+		uint32_t count = static_cast<uint32_t>(chunks[c].shapes.size());
+		uint32_t motionCount = static_cast<uint32_t>(chunks[c].motions.size());
+		os.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+		os.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		os.write(reinterpret_cast<const char*>(&motionCount), sizeof(motionCount));
+		offset += chunks[c].shapes.size() * sizeof(ShapeSnapshot) + motionBytes[c].size();
+	}
+	for (size_t c = 0; c < chunks.size(); c++) {
+		os.write(reinterpret_cast<const char*>(chunks[c].shapes.data()), chunks[c].shapes.size() * sizeof(ShapeSnapshot));
+		os.write(motionBytes[c].data(), motionBytes[c].size());
+	}
+	return os.good();
+}
+
+bool ChunkedLevel::Open(const std::string& filename)
+{
+	std::ifstream is(filename, std::ios::binary);
+	if (!is.is_open())
+		return false;
+
+	char magic[4];
+	int32_t playerCount = 0;
+	is.read(magic, sizeof(magic));
+	is.read(reinterpret_cast<char*>(&chunkSize), sizeof(chunkSize));
+	is.read(reinterpret_cast<char*>(&origin), sizeof(origin));
+	is.read(reinterpret_cast<char*>(&columns), sizeof(columns));
+	is.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+	is.read(reinterpret_cast<char*>(&maxExtent), sizeof(maxExtent));
+	is.read(reinterpret_cast<char*>(&targetCount), sizeof(targetCount));
+	is.read(reinterpret_cast<char*>(&playerCount), sizeof(playerCount));
+	bool hasMotions = std::memcmp(magic, chunkMagic, sizeof(chunkMagic)) == 0;
+	if (!is.good() || (!hasMotions && std::memcmp(magic, motionlessMagic, sizeof(motionlessMagic)) != 0) || columns <= 0 || rows <= 0 || playerCount < 0 || chunkSize <= 0.0f)
+		return false;
+
+	players.resize(playerCount);
+	is.read(reinterpret_cast<char*>(players.data()), players.size() * sizeof(ShapeSnapshot));
+	directory.resize(static_cast<size_t>(columns) * rows);
+	for (auto& entry : directory) {
+		is.read(reinterpret_cast<char*>(&entry.offset), sizeof(entry.offset));
+		is.read(reinterpret_cast<char*>(&entry.count), sizeof(entry.count));
+		entry.motions = 0;
+		if (hasMotions)
+			is.read(reinterpret_cast<char*>(&entry.motions), sizeof(entry.motions));
+	}
+	path = filename;
+	return is.good();
+}
+
+Chunk ChunkedLevel::ReadChunk(int chunk) const
+{
+	Chunk loaded;
+	loaded.shapes.resize(directory[chunk].count);
+	loaded.motions.resize(directory[chunk].motions);
+	if (loaded.shapes.empty())
+		return loaded;
+	std::ifstream is(path, std::ios::binary);
+	is.seekg(static_cast<std::streamoff>(directory[chunk].offset));
+	is.read(reinterpret_cast<char*>(loaded.shapes.data()), loaded.shapes.size() * sizeof(ShapeSnapshot));
+	bool good = is.good();
+	for (auto& motion : loaded.motions)
+		good = good && ReadMotion(is, motion) && motion.target >= 0 && motion.target < static_cast<int>(loaded.shapes.size());
+	if (!good)
+		throw std::runtime_error("Failed to read chunk " + std::to_string(chunk) + " of " + path);
+	return loaded;
+}
+
+void ChunkedLevel::ChunksAround(glm::vec2 min, glm::vec2 max, std::vector<int>& out) const
+{
+	min -= glm::vec2(maxExtent) + origin;
+	max += glm::vec2(maxExtent) - origin;
+	int x0 = std::max(0, static_cast<int>(std::floor(min.x / chunkSize)));
+	int y0 = std::max(0, static_cast<int>(std::floor(min.y / chunkSize)));
+	int x1 = std::min(columns - 1, static_cast<int>(std::floor(max.x / chunkSize)));
+	int y1 = std::min(rows - 1, static_cast<int>(std::floor(max.y / chunkSize)));
+	for (int y = y0; y <= y1; y++)
+		for (int x = x0; x <= x1; x++)
+			out.push_back(y * columns + x);
+}
+
+glm::vec2 ChunkedLevel::ChunkMin(int chunk) const
+{
+	return origin + glm::vec2(chunk % columns, chunk / columns) * chunkSize;
+}
+
+glm::vec2 ChunkedLevel::ChunkMax(int chunk) const
+{
+	return ChunkMin(chunk) + glm::vec2(chunkSize);
+}
+
+ChunkCache::ChunkCache(size_t capacity)
+	: capacity(std::max<size_t>(1, capacity))
+{
+}
+
+std::shared_ptr<ChunkCache> ChunkCache::Shared()
+{
+	static std::shared_ptr<ChunkCache> cache = std::make_shared<ChunkCache>(defaultCacheChunks);
+	return cache;
+}
+
+std::shared_ptr<const Chunk> ChunkCache::Get(const ChunkedLevel& level, int chunk)
+{
+	Key key(level.path, chunk);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(key);
+		if (it != entries.end()) {
+			recent.splice(recent.begin(), recent, it->second.recent);
+			return it->second.chunk;
+		}
+		misses++;
+	}
+
+	// Read outside the lock, two environments missing the same chunk at once just read it twice
+	auto loaded = std::make_shared<const Chunk>(level.ReadChunk(chunk));
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = entries.find(key);
+	if (it != entries.end())
+		return it->second.chunk;
+	recent.push_front(key);
+	entries[key] = { loaded, recent.begin() };
+	// Environments still holding an evicted chunk keep their copy alive through the shared pointer
+	while (entries.size() > capacity) {
+		entries.erase(recent.back());
+		recent.pop_back();
+	}
+	return loaded;
+}
+
+size_t ChunkCache::Size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+uint64_t ChunkCache::Misses()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return misses;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TargetKinematics.h"
+
+// Plain copy of one drawn shape, small enough to pass to another process
+struct ShapeSnapshot
+{
+	float x, y;
+	float width, height;
+	float origin_x, origin_y;
+	float rotation;
+	uint32_t color;
+	int32_t type;  // ShapeType, or -1 for the player's direction marker
+};
+
+// Shapes of one chunk and the motions of its moving targets, TargetMotion::target is the index in shapes
+struct Chunk
+{
+	std::vector<ShapeSnapshot> shapes;
+	std::vector<TargetMotion> motions;
+};
+
+// A level split into square chunks on disk, for arenas far larger than the window. Every shape is
+// stored in the chunk holding its center, players are kept apart since they move between chunks.
+// Only the small directory is read when opening, chunks are read when an environment needs them.
+// Every moving target's motion is stored in its chunk, targets without one in the flat level get the
+// bounce they would have had there, so both formats move their targets the same way.
+class ChunkedLevel
+{
+public:
+	// motions refer to the MovingTarget shapes by their number in shapes, as in a flat level file
+	static bool Write(const std::string& filename, const std::vector<ShapeSnapshot>& shapes, const std::vector<TargetMotion>& motions, float chunkSize);
+	bool Open(const std::string& filename);
+	Chunk ReadChunk(int chunk) const;
+
+	// Chunks overlapping the box, widened by the largest shape so shapes reaching into it are included
+	void ChunksAround(glm::vec2 min, glm::vec2 max, std::vector<int>& out) const;
+	glm::vec2 ChunkMin(int chunk) const;
+	glm::vec2 ChunkMax(int chunk) const;
+
+	std::string path;
+	float chunkSize = 400.0f;
+	glm::vec2 origin = glm::vec2(0.0f);
+	int columns = 0;
+	int rows = 0;
+	float maxExtent = 0.0f;  // Farthest any shape reaches from its center
+	int targetCount = 0;
+	std::vector<ShapeSnapshot> players;
+
+private:
+	struct Entry
+	{
+		uint64_t offset;
+		uint32_t count;
+		uint32_t motions;  // Stored after the chunk's shapes
+	};
+	std::vector<Entry> directory;
+};
+
+// Chunks read from disk, shared by every environment of the process and evicted least recently used
+class ChunkCache
+{
+public:
+	explicit ChunkCache(size_t capacity);
+	static std::shared_ptr<ChunkCache> Shared();
+
+	std::shared_ptr<const Chunk> Get(const ChunkedLevel& level, int chunk);
+	size_t Size();
+	uint64_t Misses();
+
+private:
+	using Key = std::pair<std::string, int>;
+	struct Entry
+	{
+		std::shared_ptr<const Chunk> chunk;
+		std::list<Key>::iterator recent;
+	};
+
+	std::mutex mutex;
+	size_t capacity;
+	std::list<Key> recent;  // Most recently used first
+	std::map<Key, Entry> entries;
+	uint64_t misses = 0;
+};
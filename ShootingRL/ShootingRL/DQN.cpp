@@ -1,48 +1,111 @@
 #include "DQN.h"
 
 #include <torch/serialize/output-archive.h>
+#include <torch/version.h>
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <iterator>
 #include <random>
+#include <sstream>
 #include <vector>
 
 unsigned seed;
-const int BUFFER_SIZE = int(2e5);  // 1e5
-const int BATCH_SIZE = /*128*/ 64;
-const float GAMMA = 0.99f;
-float TAU = 1e-3;
-float LR = 5e-4;
-int UPDATE_EVERY = 108; /*16;*/
 
-DQN::DQN(int state_size, int action_size, int seed)
+float Hyperparameters::epsilon(uint64_t step) const
+{
+    return eps_min + (eps_start - eps_min) * static_cast<float>(std::exp(-1. * step / eps_decay));
+}
+
+void Hyperparameters::set(const std::string& name, const std::string& value)
+{
+    // Sizes go through stod as well so 2e5 is accepted
+    double number = std::stod(value);
+    if (name == "buffer_size") buffer_size = static_cast<int>(number);
+    else if (name == "batch_size") batch_size = static_cast<int>(number);
+    else if (name == "gamma") gamma = static_cast<float>(number);
+    else if (name == "tau") tau = static_cast<float>(number);
+    else if (name == "learning_rate") learning_rate = static_cast<float>(number);
+    else if (name == "update_every") update_every = static_cast<int>(number);
+    else if (name == "eps_start") eps_start = static_cast<float>(number);
+    else if (name == "eps_min") eps_min = static_cast<float>(number);
+    else if (name == "eps_decay") eps_decay = static_cast<float>(number);
+    else throw std::runtime_error("Unknown hyperparameter " + name + ".");
+}
+
+Hyperparameters Hyperparameters::load(const std::string& path)
+{
+    std::ifstream is(path);
+    if (!is.is_open())
+        throw std::runtime_error("Could not open the hyperparameter file " + path + ".");
+    auto trim = [](const std::string& text) {
+        size_t begin = text.find_first_not_of(" \t\r");
+        size_t end = text.find_last_not_of(" \t\r");
+        return begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+    };
+    Hyperparameters hyperparameters;
+    for (std::string line; std::getline(is, line);)
+    {
+        line = line.substr(0, line.find('#'));
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            continue;
+        hyperparameters.set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+    }
+    return hyperparameters;
+}
+
+DQN::DQN(int state_size, int action_size, int seed, const NetworkSpec& network_spec, const Hyperparameters& hyperparameters)
 {
     this->state_size = state_size;
     this->action_size = action_size;
     this->seed = seed;
+    this->network_spec = network_spec;
+    this->hyperparameters = hyperparameters;
 
-    q_network = QNetwork(4, action_size, seed);
-    fixed_network = QNetwork(4, action_size, seed);
-    auto adamOptions = torch::optim::AdamOptions(0.0001);
+    q_network = QNetwork(network_spec, action_size, seed);
+    fixed_network = QNetwork(network_spec, action_size, seed);
+    auto adamOptions = torch::optim::AdamOptions(hyperparameters.learning_rate);
     optimizer = new torch::optim::Adam(q_network->parameters(), adamOptions);
-    buffer = ReplayBuffer(state_size, action_size, BUFFER_SIZE, BATCH_SIZE, seed);
+    cacheParameters();
+    buffer = ReplayBuffer(state_size, action_size, hyperparameters.buffer_size, hyperparameters.batch_size, seed);
+    replay_ratio.target_ratio = static_cast<double>(hyperparameters.batch_size) / hyperparameters.update_every;
+}
+
+DQN::DQN(int state_size, int action_size, int seed)
+    : DQN(state_size, action_size, seed, NetworkSpec::compact(ObservationSpec{ state_size, 800, 800 }))
+{
 }
 
-DQN::DQN(int state_size, int action_size) { DQN(state_size, action_size, 0); }
+DQN::DQN(int state_size, int action_size) : DQN(state_size, action_size, 0) {}
+
+DQN::~DQN()
+{
+    delete optimizer;
+}
 
 void DQN::step()
 {
-    if (timestep >= UPDATE_EVERY)
+    if (replay_ratio.mode != ReplayRatioMode::Fixed)
     {
-        if (buffer.experiences.size() > BATCH_SIZE)
+        if (buffer.size() <= static_cast<size_t>(buffer.batch_size))
+            return;
+        for (int i = replay_ratio.updatesDue(buffer.batch_size); i > 0; i--)
+            learn(buffer.sample());
+        return;
+    }
+
+    if (timestep >= hyperparameters.update_every)
+    {
+        if (buffer.size() > static_cast<size_t>(buffer.batch_size))
         {
             Tensor_step_return sampled_experiences = buffer.sample();
             // printf("%i\n",buffer.experiences.size());
             learn(sampled_experiences);
         }
-        timestep = timestep % UPDATE_EVERY;
+        timestep = timestep % hyperparameters.update_every;
     }
 }
 
@@ -50,14 +113,28 @@ void DQN::addToExperienceBuffer(Optimize_Step_return value)
 {
     buffer.add(value);  //(state, action, reward, next_state, done);
     timestep++;
+    replay_ratio.recordTransitions(1);
 }
 
 void DQN::addToExperienceBufferInBulk(std::vector<Optimize_Step_return>& values)
 {
     timestep += values.size();
+    replay_ratio.recordTransitions(values.size());
     buffer.addBulk(values);
 }
 
+void DQN::beginActionLogEpisode(const std::string& level, float dt)
+{
+    buffer.action_log->beginEpisode(level, static_cast<uint32_t>(seed), dt);
+}
+
+void DQN::addToActionLog(const Optimize_Step_return& value)
+{
+    buffer.action_log->record(value.action, value.reward, value.terminated, value.truncated);
+    timestep++;
+    replay_ratio.recordTransitions(1);
+}
+
 torch::Tensor convertToTensor(const sf::Image& image) {
     const sf::Uint8* pixels = image.getPixelsPtr();
     unsigned int width = image.getSize().x;
@@ -85,7 +162,10 @@ int DQN::act(const sf::Image& image, float epsilon)
         torch::Tensor t_state = convertToTensor(image);
         torch::Tensor action_values;
 
-        action_values = q_network->forward(t_state);
+        if (use_actor_network && actor_network.isReady())
+            action_values = actor_network.forward(t_state);
+        else
+            action_values = q_network->forward(t_state);
         action = static_cast<int>(torch::argmax(action_values).item().toInt() % action_size);
         currentStep++;
         // std::cout << t_state << "\n" << action_values << "\n" << action << "\n\n";
@@ -103,52 +183,130 @@ void DQN::learn(Tensor_step_return experiences)
 {
     // this->q_network->train();
 
-    torch::Tensor action_values;
-    torch::Tensor max_action_values;
-
+    if (data_parallel)
     {
-        torch::NoGradGuard no_grad;
-
-        action_values = fixed_network->forward(experiences.next_states).detach();
-        auto [ttt, stuff] = action_values.max(1);
-        max_action_values = ttt.unsqueeze(1);
+        // The replicas leave the gradient of the whole batch on q_network
+        last_loss = data_parallel->computeGradients(experiences, hyperparameters.gamma);
+        optimizer->step();
     }
+    else
+    {
+        torch::Tensor action_values;
+        torch::Tensor max_action_values;
+
+        {
+            torch::NoGradGuard no_grad;
+
+            action_values = fixed_network->forward(experiences.next_states).detach();
+            auto [ttt, stuff] = action_values.max(1);
+            max_action_values = ttt.unsqueeze(1);
+        }
 
-    torch::Tensor Q_target = experiences.rewards + (GAMMA * max_action_values * (1 - experiences.dones));
-    torch::Tensor Q_expected = q_network->forward(experiences.states).gather(1, experiences.actions.to(torch::kLong).view({ -1, 1 }));
-    torch::Tensor loss = torch::nn::functional::mse_loss(Q_expected, Q_target);
-    // std::cout << Q_target << "\n" << Q_expected << "\n" << loss << "\n";
-    optimizer->zero_grad();
+        torch::Tensor Q_target = experiences.rewards + (hyperparameters.gamma * max_action_values * (1 - experiences.dones));
+        torch::Tensor Q_expected = q_network->forward(experiences.states).gather(1, experiences.actions.to(torch::kLong).view({ -1, 1 }));
+        torch::Tensor loss = torch::nn::functional::mse_loss(Q_expected, Q_target);
+        // std::cout << Q_target << "\n" << Q_expected << "\n" << loss << "\n";
+        optimizer->zero_grad();
 
-    loss.backward();
-    optimizer->step();
+        loss.backward();
+        optimizer->step();
+        last_loss = loss.item<float>();
+    }
 
+    learn_steps++;
+    replay_ratio.recordUpdate();
     update_fixed_network(q_network, fixed_network);
 
+    if (use_actor_network && learn_steps % actor_refresh_every == 0)
+        refreshActorNetwork(experiences.states);
+
     // this->q_network->eval();
 }
 
+void DQN::setActorPrecision(ActorPrecision mode)
+{
+    use_actor_network = true;
+    actor_network.mode = mode;
+    actor_network.refresh(*q_network);
+}
+
+void DQN::refreshActorNetwork(torch::Tensor check_states)
+{
+    actor_network.refresh(*q_network);
+    // FP32 copies always agree. Reduced precision ones are checked against the full precision argmax
+    // on the first few states of the batch just learned from.
+    if (actor_network.mode == ActorPrecision::FP32)
+        return;
+    int64_t samples = std::min<int64_t>(agreement_samples, check_states.size(0));
+    actor_agreement = actor_network.argmaxAgreement(*q_network, check_states.narrow(0, 0, samples));
+}
+
 void DQN::update_fixed_network(QNetwork& local_model, QNetwork& target_model)
 {
+    if (learn_steps % target_update_every != 0)
+        return;
+
     torch::NoGradGuard no_grad;
 
-    for (int i = 0; i < q_network->parameters().size(); i++)
+    if (target_update_mode == TargetUpdateMode::Hard)
     {
-        fixed_network->parameters()[i].data().copy_(TAU * q_network->parameters()[i].data() +
-            (1.0f - TAU) * fixed_network->parameters()[i].data());
+        for (size_t i = 0; i < fixed_parameters.size(); i++)
+            fixed_parameters[i].copy_(q_parameters[i]);
+        return;
     }
+
+    // Polyak averaging target = target + tau * (local - target), in place over every tensor at once
+#if TORCH_VERSION_MAJOR >= 2
+    torch::_foreach_lerp_(fixed_parameters, q_parameters, hyperparameters.tau);
+#else
+    for (size_t i = 0; i < fixed_parameters.size(); i++)
+        fixed_parameters[i].lerp_(q_parameters[i], hyperparameters.tau);
+#endif
+}
+
+void DQN::cacheParameters()
+{
+    q_parameters = q_network->parameters();
+    fixed_parameters = fixed_network->parameters();
+    // Replicas hold on to the parameter lists as well
+    if (data_parallel)
+        enableDataParallel(data_parallel_cores);
+}
+
+void DQN::enableDataParallel(const std::vector<std::vector<int>>& core_sets)
+{
+    data_parallel.reset();
+    data_parallel_cores = core_sets;
+    if (core_sets.size() > 1)
+        data_parallel = std::make_shared<DataParallelLearner>(network_spec, action_size, q_network.ptr(), fixed_network.ptr(), core_sets);
 }
 
 void DQN::checkpoint(std::string filepath)
 {
+    buffer.sync();
     torch::save(q_network, (filepath + "_network.pt").c_str());
     torch::save(*optimizer, (filepath + "_optimizer.pt").c_str());
+    checkpointSpec().save(filepath);
 }
 
 void DQN::loadCheckpoint(std::string filepath)
 {
+    CheckpointSpec saved = CheckpointSpec::load(filepath);
+    if (saved.serialize() != checkpointSpec().serialize())
+        throw std::runtime_error(filepath + " was trained with a different network than this agent uses.");
     torch::load(q_network, (filepath + "_network.pt").c_str());
     torch::load(*optimizer, (filepath + "_optimizer.pt").c_str());
+    cacheParameters();
+    if (use_actor_network)
+        actor_network.refresh(*q_network);
+}
+
+CheckpointSpec DQN::checkpointSpec() const
+{
+    CheckpointSpec spec;
+    spec.network = network_spec;
+    spec.action_count = action_size;
+    return spec;
 }
 
 void DQN::resetLearning()
@@ -156,27 +314,177 @@ void DQN::resetLearning()
     q_network->resetNetwork();
     fixed_network->resetNetwork();
     delete optimizer;
-    auto adamOptions = torch::optim::AdamOptions(0.0001);
+    auto adamOptions = torch::optim::AdamOptions(hyperparameters.learning_rate);
     optimizer = new torch::optim::Adam(q_network->parameters(), adamOptions);
+    cacheParameters();
 }
 
-QNetworkImpl::QNetworkImpl(int input_channels, int action_size, int seed)
+NetworkSpec NetworkSpec::compact(const ObservationSpec& observation)
 {
+    NetworkSpec spec;
+    spec.input_channels = observation.channels;
+    spec.input_height = observation.height;
+    spec.input_width = observation.width;
+    spec.conv_layers = {
+        { 16, 8, 4 },
+        { 32, 4, 2 },
+        { 32, 3, 2 },
+        { 32, 3, 2 },
+        { 32, 3, 2 },
+    };
+    spec.hidden_layers = { 256 };
+    spec.softmax_output = false;
+    return spec;
+}
 
+NetworkSpec NetworkSpec::legacy(const ObservationSpec& observation)
+{
+    NetworkSpec spec;
+    spec.input_channels = observation.channels;
+    spec.input_height = observation.height;
+    spec.input_width = observation.width;
+    spec.conv_layers = {
+        { 6, 3, 1, 0, true },
+        { 16, 3, 1, 0, true },
+    };
+    spec.hidden_layers = { 120, 84 };
+    spec.softmax_output = true;
+    return spec;
+}
 
+int NetworkSpec::flattenedSize() const
+{
+    int channels = input_channels;
+    int height = input_height;
+    int width = input_width;
+    for (auto& layer : conv_layers)
+    {
+        channels = layer.out_channels;
+        height = (height + 2 * layer.padding - layer.kernel_size) / layer.stride + 1;
+        width = (width + 2 * layer.padding - layer.kernel_size) / layer.stride + 1;
+        if (layer.max_pool)
+        {
+            height /= 2;
+            width /= 2;
+        }
+    }
+    if (height <= 0 || width <= 0)
+        throw std::runtime_error("Network layers shrink the observation below one pixel.");
+    return channels * height * width;
+}
+
+ObservationSpec CheckpointSpec::observation() const
+{
+    return ObservationSpec{ network.input_channels, network.input_height, network.input_width };
+}
+
+std::string CheckpointSpec::serialize() const
+{
+    std::ostringstream out;
+    out << "action_count " << action_count << "\n";
+    out << "input " << network.input_channels << " " << network.input_height << " " << network.input_width << "\n";
+    for (auto& layer : network.conv_layers)
+        out << "conv " << layer.out_channels << " " << layer.kernel_size << " " << layer.stride << " "
+            << layer.padding << " " << (layer.max_pool ? 1 : 0) << "\n";
+    for (int width : network.hidden_layers)
+        out << "hidden " << width << "\n";
+    out << "softmax " << (network.softmax_output ? 1 : 0) << "\n";
+    return out.str();
+}
+
+bool CheckpointSpec::save(const std::string& prefix) const
+{
+    std::ofstream file(prefix + "_spec.txt", std::ios::trunc);
+    file << serialize();
+    return static_cast<bool>(file);
+}
+
+CheckpointSpec CheckpointSpec::load(const std::string& prefix)
+{
+    CheckpointSpec spec;
+    std::ifstream file(prefix + "_spec.txt");
+    if (!file)
+        return spec;
+
+    spec.network.conv_layers.clear();
+    spec.network.hidden_layers.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key))
+            continue;
+        bool parsed = true;
+        if (key == "action_count")
+            parsed = static_cast<bool>(fields >> spec.action_count);
+        else if (key == "input")
+            parsed = static_cast<bool>(fields >> spec.network.input_channels >> spec.network.input_height >> spec.network.input_width);
+        else if (key == "conv")
+        {
+            ConvLayerSpec layer{};
+            int maxPool = 0;
+            parsed = static_cast<bool>(fields >> layer.out_channels >> layer.kernel_size >> layer.stride >> layer.padding >> maxPool);
+            layer.max_pool = maxPool != 0;
+            spec.network.conv_layers.push_back(layer);
+        }
+        else if (key == "hidden")
+        {
+            int width = 0;
+            parsed = static_cast<bool>(fields >> width);
+            spec.network.hidden_layers.push_back(width);
+        }
+        else if (key == "softmax")
+        {
+            int softmax = 0;
+            parsed = static_cast<bool>(fields >> softmax);
+            spec.network.softmax_output = softmax != 0;
+        }
+        else
+            parsed = false;
+        if (!parsed)
+            throw std::runtime_error(prefix + "_spec.txt: can't read \"" + line + "\"");
+    }
+    if (spec.action_count <= 0 || spec.network.conv_layers.empty())
+        throw std::runtime_error(prefix + "_spec.txt doesn't describe a network.");
+    return spec;
+}
+
+QNetworkImpl::QNetworkImpl(const NetworkSpec& spec, int action_size, int seed)
+{
     torch::manual_seed(seed);
+    this->spec = spec;
 
-    conv1 = register_module("conv1", torch::nn::Conv2d(torch::nn::Conv2dOptions(4, 6, 3))); // 32 filters, kernel size 8x8, stride 4
-    conv2 = register_module("conv2", torch::nn::Conv2d(torch::nn::Conv2dOptions(6, 16, 3)));            // 64 filters, kernel size 4x4, stride 2
+    // Module names follow conv1.., fc1.. so checkpoints of the legacy layout still load
+    int in_channels = spec.input_channels;
+    for (size_t i = 0; i < spec.conv_layers.size(); i++)
+    {
+        const ConvLayerSpec& layer = spec.conv_layers[i];
+        convs.push_back(register_module("conv" + std::to_string(i + 1),
+            torch::nn::Conv2d(torch::nn::Conv2dOptions(in_channels, layer.out_channels, layer.kernel_size)
+                .stride(layer.stride)
+                .padding(layer.padding))));
+        in_channels = layer.out_channels;
+    }
 
-    // Fully connected layers
-    fc1 = register_module("fc1", torch::nn::Linear(torch::nn::LinearOptions(16 * 198 * 198, 120)));  // Adjust the size based on input image dimensions
-    fc2 = register_module("fc2", torch::nn::Linear(torch::nn::LinearOptions(120, 84)));
-    fc3 = register_module("fc3", torch::nn::Linear(torch::nn::LinearOptions(84, 7)));
+    int in_features = spec.flattenedSize();
+    for (size_t i = 0; i < spec.hidden_layers.size(); i++)
+    {
+        fcs.push_back(register_module("fc" + std::to_string(i + 1),
+            torch::nn::Linear(torch::nn::LinearOptions(in_features, spec.hidden_layers[i]))));
+        in_features = spec.hidden_layers[i];
+    }
+    // Output layer, one value per action
+    fcs.push_back(register_module("fc" + std::to_string(spec.hidden_layers.size() + 1),
+        torch::nn::Linear(torch::nn::LinearOptions(in_features, action_size))));
+}
 
+QNetworkImpl::QNetworkImpl(int input_channels, int action_size, int seed)
+    : QNetworkImpl(NetworkSpec::compact(ObservationSpec{ input_channels, 800, 800 }), action_size, seed)
+{
 }
 
-QNetworkImpl::QNetworkImpl(int input_channels, int action_size) { QNetwork(input_channels, action_size, 0); }
+QNetworkImpl::QNetworkImpl(int input_channels, int action_size) : QNetworkImpl(input_channels, action_size, 0) {}
 
 int QNetworkImpl::num_flat_features(torch::Tensor x)
 {
@@ -190,25 +498,29 @@ int QNetworkImpl::num_flat_features(torch::Tensor x)
 
 torch::Tensor QNetworkImpl::forward(torch::Tensor x)
 {
-
-    // Pass through conv1, relu, and max pooling
-    x = torch::nn::MaxPool2d(torch::nn::MaxPool2dOptions({ 2, 2 }))->forward(torch::relu(conv1->forward(x)));
-
-    // Pass through conv2, relu, and max pooling
-    x = torch::nn::MaxPool2d(torch::nn::MaxPool2dOptions({ 2, 2 }))->forward(torch::relu(conv2->forward(x)));
+    // Pass through the conv layers with ReLU and the optional max pooling
+    for (size_t i = 0; i < convs.size(); i++)
+    {
+        x = torch::relu(convs[i]->forward(x));
+        if (spec.conv_layers[i].max_pool)
+            x = torch::max_pool2d(x, { 2, 2 });
+    }
 
     // Flatten the tensor for the fully connected layers
     x = x.view({ -1, num_flat_features(x) });
 
-    // Pass through the fully connected layers with ReLU activations
-    x = torch::relu(fc1->forward(x));
-    x = torch::relu(fc2->forward(x));
+    // Pass through the hidden layers with ReLU activations
+    for (size_t i = 0; i + 1 < fcs.size(); i++)
+    {
+        x = torch::relu(fcs[i]->forward(x));
+    }
 
-    // Output layer (no activation here, softmax will be applied later)
-    x = fc3->forward(x);
+    // Output layer (no activation here)
+    x = fcs.back()->forward(x);
 
-    // Apply softmax to the output (convert logits to probabilities)
-    x = torch::softmax(x, /*dim=*/1);  // Apply softmax along the second dimension (action dimension)
+    // The legacy layout squashed the values with a softmax along the action dimension
+    if (spec.softmax_output)
+        x = torch::softmax(x, /*dim=*/1);
 
     return x;
 }
@@ -239,12 +551,22 @@ ReplayBuffer::ReplayBuffer(int action_size, int buffer_size, int batch_size)
 
 void ReplayBuffer::add(Optimize_Step_return experience)
 {
+    if (mapped)
+    {
+        mapped->add(experience);
+        return;
+    }
     experiences.push_back(experience);
     if (experiences.size() > buffer_size) experiences.erase(experiences.begin());
 }
 
 void ReplayBuffer::addBulk(std::vector<Optimize_Step_return>& experiences)
 {
+    if (mapped)
+    {
+        for (auto& experience : experiences) mapped->add(experience);
+        return;
+    }
     this->experiences.insert(this->experiences.end(), std::make_move_iterator(experiences.begin()),
         std::make_move_iterator(experiences.end()));
     if (this->experiences.size() > buffer_size)
@@ -254,8 +576,48 @@ void ReplayBuffer::addBulk(std::vector<Optimize_Step_return>& experiences)
     }
 }
 
+bool ReplayBuffer::openMapped(const std::string& path, const ObservationSpec& observation, uint64_t max_bytes)
+{
+    auto store = std::make_shared<MappedReplay>();
+    if (!store->open(path, buffer_size, observation, max_bytes))
+        return false;
+    mapped = store;
+    experiences.clear();
+    return true;
+}
+
+size_t ReplayBuffer::size()
+{
+    if (action_log)
+        return action_log->size();
+    return mapped ? static_cast<size_t>(mapped->size()) : experiences.size();
+}
+
+void ReplayBuffer::sync()
+{
+    if (mapped)
+        mapped->sync();
+}
+
+void ReplayBuffer::storeSamplerState()
+{
+    if (mapped)
+        mapped->storeRngState();
+}
+
+void ReplayBuffer::flush()
+{
+    if (mapped)
+        mapped->flush();
+}
+
 Tensor_step_return ReplayBuffer::sample()
 {
+    if (action_log)
+        return action_log->sample(batch_size);
+    if (mapped)
+        return mapped->sample(batch_size);
+
     Tensor_step_return tensor;
     std::vector<Optimize_Step_return> batch;
     std::sample(experiences.begin(), experiences.end(), std::back_inserter(batch), batch_size,
@@ -286,7 +648,7 @@ Tensor_step_return ReplayBuffer::sample()
         rewards.push_back(experience.reward);
         actions.push_back(static_cast<float>(experience.action));
         dones.push_back(static_cast<float>(experience.terminated));
-        if (i == BATCH_SIZE) break;
+        if (i == batch_size) break;
     }
 
     tensor.states = torch::stack(currentStates, 0);
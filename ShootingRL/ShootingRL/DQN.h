@@ -11,6 +11,11 @@
 #include "EnviromentObjectsType.h"
 #include "SFML/Graphics.hpp"
 #include "LevelData.h"
+#include "InferenceNetwork.h"
+#include "MappedReplay.h"
+#include "ActionLogReplay.h"
+#include "DataParallelLearner.h"
+#include "ReplayRatioController.h"
 
 
 struct Tensor_step_return
@@ -22,9 +27,58 @@ struct Tensor_step_return
 	torch::Tensor dones;
 };
 
+// Shape of the observation the network is fed, one RGBA screenshot of the window by default
+struct ObservationSpec
+{
+	int channels = 4;
+	int height = 800;
+	int width = 800;
+};
+
+struct ConvLayerSpec
+{
+	int out_channels;
+	int kernel_size;
+	int stride = 1;
+	int padding = 0;
+	bool max_pool = false;  // 2x2 max pooling after the activation
+};
+
+// Layer list of a QNetwork, the flattened size between the conv and linear layers is derived from the input
+struct NetworkSpec
+{
+	int input_channels = 4;
+	int input_height = 800;
+	int input_width = 800;
+	std::vector<ConvLayerSpec> conv_layers;
+	std::vector<int> hidden_layers;
+	bool softmax_output = false;
+
+	// Strided convolutions that shrink the 800x800 screenshot quickly, about 1M parameters in total
+	static NetworkSpec compact(const ObservationSpec& observation);
+	// The original two 3x3 convolutions with max pooling into a 16*198*198 wide linear layer
+	static NetworkSpec legacy(const ObservationSpec& observation);
+	int flattenedSize() const;
+};
+
+// What a checkpoint was trained with, written as <prefix>_spec.txt next to its weights so every loader
+// builds the matching network. Checkpoints saved before the file existed read as the compact 800x800 network.
+struct CheckpointSpec
+{
+	NetworkSpec network = NetworkSpec::compact(ObservationSpec());
+	int action_count = actionCount;
+
+	ObservationSpec observation() const;
+	std::string serialize() const;
+	bool save(const std::string& prefix) const;
+	// Throws when the file exists but can't be parsed
+	static CheckpointSpec load(const std::string& prefix);
+};
+
 class QNetworkImpl : public torch::nn::Module
 {
 public:
+	QNetworkImpl(const NetworkSpec& spec, int action_size, int seed);
 	QNetworkImpl(int input_channels, int action_size, int seed);
 
 	QNetworkImpl(int input_channels, int action_size);
@@ -33,8 +87,9 @@ public:
 	torch::Tensor forward(torch::Tensor x);
 	void resetNetwork();
 
-	torch::nn::Linear fc1{ nullptr }, fc2{ nullptr }, fc3{ nullptr };
-	torch::nn::Conv2d conv1{ nullptr }, conv2{ nullptr }/*, conv3{ nullptr }*/;
+	NetworkSpec spec;
+	std::vector<torch::nn::Conv2d> convs;
+	std::vector<torch::nn::Linear> fcs;
 };
 
 TORCH_MODULE(QNetwork);
@@ -49,6 +104,15 @@ public:
 	void add(Optimize_Step_return experience);  //(State state, Action action, float reward, State next_state, bool done);
 	void addBulk(std::vector<Optimize_Step_return>& experiences);
 	Tensor_step_return sample();
+	// Keep the experiences in a memory-mapped file instead of memory, reopening it resumes the buffer.
+	// The file holds at most buffer_size transitions and never grows past max_bytes.
+	bool openMapped(const std::string& path, const ObservationSpec& observation, uint64_t max_bytes);
+	size_t size();
+	void sync();
+	// sync split for AsyncCheckpointer: the sampler state is stored on the training thread when the
+	// checkpoint is staged, flush runs on the writer thread before the checkpoint is listed
+	void storeSamplerState();
+	void flush();
 
 	int state_size;
 	int action_size;
@@ -56,35 +120,97 @@ public:
 	int batch_size;
 
 	std::vector<Optimize_Step_return> experiences;
+	std::shared_ptr<MappedReplay> mapped;
+	// When set only actions and rewards are recorded, observations are re-simulated when sampled
+	std::shared_ptr<ActionLogReplay> action_log;
 	int seed;
 
 	std::vector<float> actions;
 	std::vector<float> rewards;
 	std::vector<float> dones;
 };
+// Learner and exploration settings. The defaults are the values training was tuned with, a file of
+// name = value lines overrides any of them without a rebuild.
+struct Hyperparameters
+{
+	int buffer_size = 200000;
+	int batch_size = 64;
+	float gamma = 0.99f;
+	float tau = 1e-3f;             // Soft target update rate
+	float learning_rate = 1e-4f;
+	int update_every = 108;        // Transitions between two learn steps with the Fixed replay ratio
+	float eps_start = 0.9f;
+	float eps_min = 0.01f;
+	float eps_decay = 500000.0f;   // Steps for epsilon to get e times closer to eps_min
+
+	float epsilon(uint64_t step) const;
+	// Throws on unknown names, a typo must not silently train with the default
+	void set(const std::string& name, const std::string& value);
+	static Hyperparameters load(const std::string& path);
+};
+
+enum class TargetUpdateMode
+{
+	Soft,  // Polyak average with Hyperparameters::tau
+	Hard   // Full copy of q_network
+};
+
 class DQN
 {
 public:
+	DQN(int state_size, int action_size, int seed, const NetworkSpec& network_spec, const Hyperparameters& hyperparameters = Hyperparameters());
 	DQN(int state_size, int action_size, int seed);
 	DQN(int state_size, int action_size);
 	DQN() {};
+	~DQN();
+	DQN(const DQN&) = delete;
+	DQN& operator=(const DQN&) = delete;
 	void step();  //(State state, Action action, float reward, State next_state, bool done);
 	void addToExperienceBuffer(Optimize_Step_return value);
 	void addToExperienceBufferInBulk(std::vector<Optimize_Step_return>& values);
+	void beginActionLogEpisode(const std::string& level, float dt);
+	void addToActionLog(const Optimize_Step_return& value);
 	int act(const sf::Image& image, float epsilon);
 	void learn(Tensor_step_return experiences);
 	void update_fixed_network(QNetwork& local_model, QNetwork& target_model);
+	void cacheParameters();
 	void checkpoint(std::string filepath);
+	// Throws when the checkpoint's spec file describes a different network than this agent's
 	void loadCheckpoint(std::string filepath);
+	CheckpointSpec checkpointSpec() const;
 	void resetLearning();
+	void setActorPrecision(ActorPrecision mode);
+	void refreshActorNetwork(torch::Tensor check_states);
+	// Splits learn batches over one network replica per core set, an empty list goes back to a single network
+	void enableDataParallel(const std::vector<std::vector<int>>& core_sets);
 
 	int state_size, action_size, seed;
+	NetworkSpec network_spec;
+	Hyperparameters hyperparameters;
 
 	QNetwork q_network, fixed_network;
-	torch::optim::Adam* optimizer;
+	torch::optim::Adam* optimizer = nullptr;
+	// Parameter lists of both networks, built once instead of on every target update
+	std::vector<torch::Tensor> q_parameters, fixed_parameters;
+	TargetUpdateMode target_update_mode = TargetUpdateMode::Soft;
+	int target_update_every = 1;  // In learn steps
+
+	// Actor side copy used by act, refreshed from q_network every actor_refresh_every learn steps
+	InferenceNetwork actor_network;
+	bool use_actor_network = false;
+	int actor_refresh_every = 10;
+	float actor_agreement = 1.0f;  // Reported as Metric::ActorAgreement, only measured for BF16 and INT8
+	int agreement_samples = 16;
+
+	std::shared_ptr<DataParallelLearner> data_parallel;
+	std::vector<std::vector<int>> data_parallel_cores;
 
 	ReplayBuffer buffer;
+	// Decides how many learn steps step() runs, Fixed keeps the update_every cadence
+	ReplayRatioController replay_ratio;
 	int timestep = 0;
+	int learn_steps = 0;
+	float last_loss = 0.0f;  // Of the latest learn step
 
 	int whenToPrint = 1000;
 	int currentStep = 0;
@@ -0,0 +1,177 @@
+#include "DataParallelLearner.h"
+#include "DQN.h"
+#include "ThreadTopology.h"
+
+#include <algorithm>
+
+DataParallelLearner::DataParallelLearner(const NetworkSpec& spec, int action_size, std::shared_ptr<QNetworkImpl> q_network,
+    std::shared_ptr<QNetworkImpl> fixed_network, const std::vector<std::vector<int>>& core_sets)
+{
+    master_q = q_network->parameters();
+    master_fixed = fixed_network->parameters();
+
+    size_t count = std::max<size_t>(1, core_sets.size());
+    replicas.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Replica& replica = replicas[i];
+        if (i == 0)
+        {
+            replica.q_network = q_network;
+            replica.fixed_network = fixed_network;
+        }
+        else
+        {
+            replica.q_network = std::make_shared<QNetworkImpl>(spec, action_size, 0);
+            replica.fixed_network = std::make_shared<QNetworkImpl>(spec, action_size, 0);
+        }
+        replica.q_parameters = replica.q_network->parameters();
+        replica.fixed_parameters = replica.fixed_network->parameters();
+        if (i < core_sets.size())
+            replica.cores = core_sets[i];
+    }
+    for (size_t i = 0; i < count; i++)
+        replicas[i].thread = std::thread(&DataParallelLearner::workerLoop, this, static_cast<int>(i));
+}
+
+DataParallelLearner::~DataParallelLearner()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (auto& replica : replicas)
+        replica.thread.join();
+}
+
+int DataParallelLearner::replicaCount() const
+{
+    return static_cast<int>(replicas.size());
+}
+
+float DataParallelLearner::computeGradients(const Tensor_step_return& experiences, float gamma)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    batch = &experiences;
+    this->gamma = gamma;
+    running = static_cast<int>(replicas.size());
+    generation++;
+    start.notify_all();
+    finished.wait(lock, [this]() { return running == 0; });
+    batch = nullptr;
+
+    float loss = 0.0f;
+    for (auto& replica : replicas)
+        loss += replica.loss;
+    return loss;
+}
+
+void DataParallelLearner::workerLoop(int index)
+{
+    // Threads of torch's OpenMP pool are started by this thread and inherit its cores
+    Replica& replica = replicas[index];
+    if (!replica.cores.empty())
+    {
+        ThreadTopology::PinCurrentThread(replica.cores);
+        torch::set_num_threads(static_cast<int>(replica.cores.size()));
+    }
+
+    uint64_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&]() { return generation != seen || stopping; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        runShard(index);
+        barrier();
+        reduceGradients(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running--;
+        }
+        finished.notify_one();
+    }
+}
+
+void DataParallelLearner::runShard(int index)
+{
+    Replica& replica = replicas[index];
+    replica.loss = 0.0f;
+    for (auto& parameter : replica.q_parameters)
+        parameter.mutable_grad() = torch::Tensor();
+
+    if (index > 0)
+    {
+        torch::NoGradGuard no_grad;
+        for (size_t i = 0; i < master_q.size(); i++)
+            replica.q_parameters[i].copy_(master_q[i]);
+        for (size_t i = 0; i < master_fixed.size(); i++)
+            replica.fixed_parameters[i].copy_(master_fixed[i]);
+    }
+
+    int64_t total = batch->states.size(0);
+    int64_t count = static_cast<int64_t>(replicas.size());
+    int64_t begin = total * index / count;
+    int64_t end = total * (index + 1) / count;
+    if (end <= begin)
+        return;
+
+    torch::Tensor states = batch->states.narrow(0, begin, end - begin);
+    torch::Tensor next_states = batch->next_states.narrow(0, begin, end - begin);
+    torch::Tensor actions = batch->actions.narrow(0, begin, end - begin);
+    torch::Tensor rewards = batch->rewards.narrow(0, begin, end - begin);
+    torch::Tensor dones = batch->dones.narrow(0, begin, end - begin);
+
+    torch::Tensor max_action_values;
+    {
+        torch::NoGradGuard no_grad;
+        max_action_values = std::get<0>(replica.fixed_network->forward(next_states).max(1)).unsqueeze(1);
+    }
+    torch::Tensor Q_target = rewards + (gamma * max_action_values * (1 - dones));
+    torch::Tensor Q_expected = replica.q_network->forward(states).gather(1, actions.to(torch::kLong).view({ -1, 1 }));
+    // Summed and divided by the whole batch, so adding the shards' gradients gives the gradient of the batch mean
+    torch::Tensor loss = torch::nn::functional::mse_loss(Q_expected, Q_target,
+        torch::nn::functional::MSELossFuncOptions().reduction(torch::kSum)) / static_cast<double>(total);
+    loss.backward();
+    replica.loss = loss.item<float>();
+}
+
+void DataParallelLearner::reduceGradients(int index)
+{
+    // Every replica sums a disjoint slice of the parameters into the master, all of them in parallel
+    torch::NoGradGuard no_grad;
+    size_t stride = replicas.size();
+    for (size_t p = static_cast<size_t>(index); p < master_q.size(); p += stride)
+    {
+        torch::Tensor& gradient = master_q[p].mutable_grad();
+        if (!gradient.defined())
+            gradient = torch::zeros_like(master_q[p]);
+        for (size_t r = 1; r < replicas.size(); r++)
+        {
+            const torch::Tensor& other = replicas[r].q_parameters[p].grad();
+            if (other.defined())
+                gradient.add_(other);
+        }
+    }
+}
+
+void DataParallelLearner::barrier()
+{
+    std::unique_lock<std::mutex> lock(barrier_mutex);
+    uint64_t arrival = barrier_generation;
+    if (++barrier_waiting == static_cast<int>(replicas.size()))
+    {
+        barrier_waiting = 0;
+        barrier_generation++;
+        barrier_released.notify_all();
+        return;
+    }
+    barrier_released.wait(lock, [&]() { return barrier_generation != arrival; });
+}
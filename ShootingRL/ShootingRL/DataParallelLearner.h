@@ -0,0 +1,62 @@
+#pragma once
+#include <torch/torch.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Tensor_step_return;
+class QNetworkImpl;
+struct NetworkSpec;
+
+// Splits every learn batch over replicas of the Q network that run on disjoint core sets.
+// Each replica computes the loss gradient of its shard, the gradients are summed in place
+// into the master network and the caller runs a single optimizer step on it afterwards.
+// Replica 0 is the master network itself, the others copy its weights at the start of a step.
+class DataParallelLearner
+{
+public:
+	DataParallelLearner(const NetworkSpec& spec, int action_size, std::shared_ptr<QNetworkImpl> q_network,
+		std::shared_ptr<QNetworkImpl> fixed_network, const std::vector<std::vector<int>>& core_sets);
+	~DataParallelLearner();
+
+	// Leaves the summed gradient of the whole batch in the master network, returns the loss
+	float computeGradients(const Tensor_step_return& experiences, float gamma);
+	int replicaCount() const;
+
+private:
+	struct Replica
+	{
+		std::shared_ptr<QNetworkImpl> q_network, fixed_network;
+		std::vector<torch::Tensor> q_parameters, fixed_parameters;
+		std::vector<int> cores;
+		std::thread thread;
+		float loss = 0.0f;
+	};
+
+	void workerLoop(int index);
+	void runShard(int index);
+	void reduceGradients(int index);
+	void barrier();
+
+	std::vector<Replica> replicas;
+	std::vector<torch::Tensor> master_q, master_fixed;
+
+	// Work handed to the workers for the current step
+	const Tensor_step_return* batch = nullptr;
+	float gamma = 0.99f;
+
+	std::mutex mutex;
+	std::condition_variable start, finished;
+	uint64_t generation = 0;
+	int running = 0;
+	bool stopping = false;
+
+	// Between the backward passes and the reduction
+	std::mutex barrier_mutex;
+	std::condition_variable barrier_released;
+	int barrier_waiting = 0;
+	uint64_t barrier_generation = 0;
+};
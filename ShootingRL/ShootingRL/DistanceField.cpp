@@ -0,0 +1,298 @@
+#include "DistanceField.h"
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/gtx/norm.hpp"
+#include "algorithm"
+#include "fstream"
+#include <cstring>
+#include <limits>
+
+#include "Utilities.h"
+
+namespace {
+	const char cacheMagic[4] = { 'S', 'D', 'F', '1' };
+
+	void HashBytes(uint64_t& hash, const void* data, size_t size)
+	{
+		// FNV-1a
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	}
+}
+
+void DistanceField::Bake(const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, float cellSize)
+{
+	hash = GeometryHash(lines, cellSize);
+	grid.reset();
+
+	std::shared_ptr<Grid> baking = std::make_shared<Grid>();
+	baking->cellSize = cellSize;
+	CollectWalls(lines, *baking);
+	if (baking->walls.empty())
+		return;
+
+	glm::vec2 minCorner(std::numeric_limits<float>::max());
+	glm::vec2 maxCorner(-std::numeric_limits<float>::max());
+	for (const auto& wall : baking->walls) {
+		for (int i = 0; i < 4; i++) {
+			minCorner = glm::min(minCorner, wall[i]);
+			maxCorner = glm::max(maxCorner, wall[i]);
+		}
+	}
+
+	baking->origin = minCorner - glm::vec2(margin);
+	glm::vec2 extent = maxCorner + glm::vec2(margin) - baking->origin;
+	baking->width = static_cast<int>(std::ceil(extent.x / cellSize)) + 1;
+	baking->height = static_cast<int>(std::ceil(extent.y / cellSize)) + 1;
+	baking->distances.resize(static_cast<size_t>(baking->width) * baking->height);
+	baking->nearest.resize(static_cast<size_t>(baking->width) * baking->height);
+
+	for (int y = 0; y < baking->height; y++) {
+		for (int x = 0; x < baking->width; x++) {
+			glm::vec2 point = baking->origin + glm::vec2(x, y) * cellSize;
+			float best = std::numeric_limits<float>::max();
+			int bestWall = -1;
+			for (int wall = 0; wall < static_cast<int>(baking->walls.size()); wall++) {
+				float distance = WallDistance(baking->walls[wall], point);
+				if (distance < best) {
+					best = distance;
+					bestWall = wall;
+				}
+			}
+			baking->distances[baking->CellIndex(x, y)] = best;
+			baking->nearest[baking->CellIndex(x, y)] = bestWall;
+		}
+	}
+	grid = std::move(baking);
+}
+
+bool DistanceField::SaveCache(const std::string& filename)
+{
+	if (!grid)
+		return false;
+	std::ofstream os(filename, std::ios::binary);
+	if (!os.is_open())
+		return false;
+
+	os.write(cacheMagic, sizeof(cacheMagic));
+	os.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+	os.write(reinterpret_cast<const char*>(&grid->cellSize), sizeof(grid->cellSize));
+	os.write(reinterpret_cast<const char*>(&grid->origin), sizeof(grid->origin));
+	os.write(reinterpret_cast<const char*>(&grid->width), sizeof(grid->width));
+	os.write(reinterpret_cast<const char*>(&grid->height), sizeof(grid->height));
+	os.write(reinterpret_cast<const char*>(grid->distances.data()), grid->distances.size() * sizeof(float));
+	os.write(reinterpret_cast<const char*>(grid->nearest.data()), grid->nearest.size() * sizeof(int32_t));
+	return os.good();
+}
+
+bool DistanceField::LoadCache(const std::string& filename, const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, float cellSize)
+{
+	std::ifstream is(filename, std::ios::binary);
+	if (!is.is_open())
+		return false;
+
+	char magic[4];
+	uint64_t fileHash = 0;
+	is.read(magic, sizeof(magic));
+	is.read(reinterpret_cast<char*>(&fileHash), sizeof(fileHash));
+	// A stale cache (level edited or different resolution) is simply rebaked
+	if (!is.good() || std::memcmp(magic, cacheMagic, sizeof(cacheMagic)) != 0 || fileHash != GeometryHash(lines, cellSize))
+		return false;
+
+	std::shared_ptr<Grid> loading = std::make_shared<Grid>();
+	is.read(reinterpret_cast<char*>(&loading->cellSize), sizeof(loading->cellSize));
+	is.read(reinterpret_cast<char*>(&loading->origin), sizeof(loading->origin));
+	is.read(reinterpret_cast<char*>(&loading->width), sizeof(loading->width));
+	is.read(reinterpret_cast<char*>(&loading->height), sizeof(loading->height));
+	if (!is.good() || loading->width <= 0 || loading->height <= 0)
+		return false;
+
+	loading->distances.resize(static_cast<size_t>(loading->width) * loading->height);
+	loading->nearest.resize(static_cast<size_t>(loading->width) * loading->height);
+	is.read(reinterpret_cast<char*>(loading->distances.data()), loading->distances.size() * sizeof(float));
+	is.read(reinterpret_cast<char*>(loading->nearest.data()), loading->nearest.size() * sizeof(int32_t));
+	if (!is.good())
+		return false;
+
+	// Exact queries near the walls still need the geometry itself
+	CollectWalls(lines, *loading);
+	hash = fileHash;
+	grid = std::move(loading);
+	return true;
+}
+
+uint64_t DistanceField::GeometryHash(const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, float cellSize)
+{
+	uint64_t hash = 14695981039346656037ull;
+	HashBytes(hash, &cellSize, sizeof(cellSize));
+	for (const auto& line : lines) {
+		if (line.second != ShapeType::EnvironmentLine)
+			continue;
+		sf::Vector2f position = line.first.getPosition();
+		sf::Vector2f size = line.first.getSize();
+		sf::Vector2f shapeOrigin = line.first.getOrigin();
+		float rotation = line.first.getRotation();
+		HashBytes(hash, &position, sizeof(position));
+		HashBytes(hash, &size, sizeof(size));
+		HashBytes(hash, &shapeOrigin, sizeof(shapeOrigin));
+		HashBytes(hash, &rotation, sizeof(rotation));
+	}
+	return hash;
+}
+
+bool DistanceField::IsBaked() const
+{
+	return grid != nullptr;
+}
+
+float DistanceField::Distance(glm::vec2 point) const
+{
+	if (!grid)
+		return std::numeric_limits<float>::max();
+
+	glm::vec2 cell = (point - grid->origin) / grid->cellSize;
+	int x = static_cast<int>(std::floor(cell.x));
+	int y = static_cast<int>(std::floor(cell.y));
+	if (x < 0 || y < 0 || x >= grid->width - 1 || y >= grid->height - 1) {
+		// Outside the baked area, far away from every wall
+		return ExactDistance(point);
+	}
+
+	// Bilinear interpolation of the four surrounding samples
+	const std::vector<float>& distances = grid->distances;
+	float fx = cell.x - x;
+	float fy = cell.y - y;
+	float top = glm::mix(distances[grid->CellIndex(x, y)], distances[grid->CellIndex(x + 1, y)], fx);
+	float bottom = glm::mix(distances[grid->CellIndex(x, y + 1)], distances[grid->CellIndex(x + 1, y + 1)], fx);
+	return glm::mix(top, bottom, fy);
+}
+
+float DistanceField::Clearance(glm::vec2 point) const
+{
+	if (!grid)
+		return std::numeric_limits<float>::max();
+	// Every sample is within a cell diagonal of the point and the distance is 1-Lipschitz,
+	// so this never overestimates the true distance to the closest wall
+	return Distance(point) - 1.5f * grid->cellSize;
+}
+
+float DistanceField::ExactDistance(glm::vec2 point) const
+{
+	float best = std::numeric_limits<float>::max();
+	if (!grid)
+		return best;
+	for (const auto& wall : grid->walls) {
+		best = std::min(best, WallDistance(wall, point));
+	}
+	return best;
+}
+
+int DistanceField::NearestWall(glm::vec2 point) const
+{
+	if (!grid)
+		return -1;
+
+	glm::vec2 cell = (point - grid->origin) / grid->cellSize;
+	int x = static_cast<int>(std::round(cell.x));
+	int y = static_cast<int>(std::round(cell.y));
+	if (x < 0 || y < 0 || x >= grid->width || y >= grid->height) {
+		float best = std::numeric_limits<float>::max();
+		int bestWall = -1;
+		for (int wall = 0; wall < static_cast<int>(grid->walls.size()); wall++) {
+			float distance = WallDistance(grid->walls[wall], point);
+			if (distance < best) {
+				best = distance;
+				bestWall = wall;
+			}
+		}
+		return bestWall;
+	}
+	return grid->nearest[grid->CellIndex(x, y)];
+}
+
+bool DistanceField::Raycast(glm::vec2 start, glm::vec2 end, glm::vec2& hit) const
+{
+	if (!grid)
+		return false;
+
+	float length = glm::length(end - start);
+	if (length <= 0.0f)
+		return false;
+	glm::vec2 direction = (end - start) / length;
+	float error = 1.5f * grid->cellSize;
+
+	// Sphere tracing: far from walls jump by the guaranteed clearance, close to a wall test the
+	// nearest walls of the surrounding samples exactly
+	// A wall tested early can be hit further along than one found later, so keep tracing up to the best hit
+	std::vector<int> tested;
+	float bestHit = std::numeric_limits<float>::max();
+	float t = 0.0f;
+	for (int step = 0; step < maxTraceSteps && t <= std::min(length, bestHit); step++) {
+		glm::vec2 point = start + direction * t;
+		float distance = Distance(point);
+		if (distance <= error) {
+			for (int corner = 0; corner < 4; corner++) {
+				glm::vec2 sample = point + glm::vec2(corner % 2 == 0 ? -0.5f : 0.5f, corner < 2 ? -0.5f : 0.5f) * grid->cellSize;
+				int wall = NearestWall(sample);
+				if (wall == -1 || std::find(tested.begin(), tested.end(), wall) != tested.end())
+					continue;
+				tested.push_back(wall);
+				const std::array<glm::vec2, 4>& corners = grid->walls[wall];
+				glm::vec2 wallHit;
+				if (Physics::LineRect(start, end, corners[0], corners[1], corners[2], corners[3], wallHit)) {
+					float hitDistance = glm::length(wallHit - start);
+					if (hitDistance < bestHit) {
+						bestHit = hitDistance;
+						hit = wallHit;
+					}
+				}
+			}
+		}
+		t += std::max(distance - error, minTraceStep);
+	}
+	return bestHit != std::numeric_limits<float>::max();
+}
+
+float DistanceField::RayLength(glm::vec2 start, glm::vec2 direction, float maxLength) const
+{
+	glm::vec2 hit;
+	if (Raycast(start, start + glm::normalize(direction) * maxLength, hit))
+		return glm::length(hit - start);
+	return maxLength;
+}
+
+float DistanceField::WallDistance(const std::array<glm::vec2, 4>& corners, glm::vec2 point)
+{
+	// Signed distance to an oriented box, negative inside
+	glm::vec2 center = (corners[0] + corners[2]) * 0.5f;
+	glm::vec2 axisX = corners[1] - corners[0];
+	glm::vec2 axisY = corners[3] - corners[0];
+	glm::vec2 halfSize(glm::length(axisX) * 0.5f, glm::length(axisY) * 0.5f);
+	if (halfSize.x > 0.0f) axisX /= halfSize.x * 2.0f;
+	if (halfSize.y > 0.0f) axisY /= halfSize.y * 2.0f;
+
+	glm::vec2 local(glm::dot(point - center, axisX), glm::dot(point - center, axisY));
+	glm::vec2 q = glm::abs(local) - halfSize;
+	float outside = glm::length(glm::max(q, glm::vec2(0.0f)));
+	float inside = std::min(std::max(q.x, q.y), 0.0f);
+	return outside + inside;
+}
+
+void DistanceField::CollectWalls(const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, Grid& grid)
+{
+	grid.walls.clear();
+	for (const auto& line : lines) {
+		if (line.second != ShapeType::EnvironmentLine)
+			continue;
+		std::vector<sf::Vector2f> corners = sf::GetRectangleCorners(line.first);
+		grid.walls.push_back({ glm::vec2(corners[0].x, corners[0].y), glm::vec2(corners[1].x, corners[1].y),
+			glm::vec2(corners[2].x, corners[2].y), glm::vec2(corners[3].x, corners[3].y) });
+	}
+}
+
+int DistanceField::Grid::CellIndex(int x, int y) const
+{
+	return y * width + x;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "SFML/Graphics.hpp"
+#include "glm/glm.hpp"
+#include "vector"
+#include "array"
+#include "utility"
+#include "memory"
+#include "string"
+#include <cstdint>
+
+#include "EnviromentObjectsType.h"
+
+// Signed distance field of the static level geometry (EnvironmentLine shapes only).
+// Walls never change after loading so the field is baked once and cached next to the level file.
+class DistanceField
+{
+public:
+	DistanceField() {};
+	// Baking and caching
+	void Bake(const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, float cellSize);
+	bool SaveCache(const std::string& filename);
+	bool LoadCache(const std::string& filename, const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, float cellSize);
+	static uint64_t GeometryHash(const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, float cellSize);
+	bool IsBaked() const;
+	// Queries
+	float Distance(glm::vec2 point) const;
+	float Clearance(glm::vec2 point) const;
+	float ExactDistance(glm::vec2 point) const;
+	int NearestWall(glm::vec2 point) const;
+	bool Raycast(glm::vec2 start, glm::vec2 end, glm::vec2& hit) const;
+	// Distance to the first wall along the ray, maxLength when none is that close
+	float RayLength(glm::vec2 start, glm::vec2 direction, float maxLength) const;
+
+	uint64_t hash = 0;
+private:
+	// Baked data, never modified once published so copies of a level share it instead of copying the grid
+	struct Grid
+	{
+		// Wall corners in world space, in the same order as GetRectangleCorners
+		std::vector<std::array<glm::vec2, 4>> walls;
+		std::vector<float> distances;
+		std::vector<int32_t> nearest;
+		glm::vec2 origin = glm::vec2(0.0f);
+		float cellSize = 4.0f;
+		int width = 0;
+		int height = 0;
+
+		int CellIndex(int x, int y) const;
+	};
+	static float WallDistance(const std::array<glm::vec2, 4>& corners, glm::vec2 point);
+	static void CollectWalls(const std::vector<std::pair<sf::RectangleShape, ShapeType>>& lines, Grid& grid);
+
+	std::shared_ptr<const Grid> grid;
+	// How far outside the walls the grid extends
+	static constexpr float margin = 64.0f;
+	// Smallest step taken while sphere tracing so thin walls are never skipped
+	static constexpr float minTraceStep = 1.0f;
+	static constexpr int maxTraceSteps = 512;
+};
@@ -1,5 +1,4 @@
 #pragma once
-#include <torch/torch.h>
 
 enum class ShapeType {
 	EnvironmentLine,
@@ -20,10 +19,12 @@ enum class Action
 	Shoot
 };
 
-struct Optimize_Step_return
+// Number of Action values, the output width of every network trained on this environment
+const int actionCount = 7;
+
+// Outcome of one LevelData::Update, free of torch so the simulation builds without it
+struct Simulation_Step_return
 {
-	torch::Tensor state;
-	torch::Tensor next_state;
 	Action action;
 	float reward;
 	bool terminated;
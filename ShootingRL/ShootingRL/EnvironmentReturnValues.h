@@ -1,7 +1,25 @@
 #pragma once
+#include <torch/torch.h>
 #include <vector>
 #include "SFML/Graphics.hpp"
 
+#include "EnviromentObjectsType.h"
+
+// A simulation step with the observations before and after it, as the replay buffers store it
+struct Optimize_Step_return
+{
+	torch::Tensor state;
+	torch::Tensor next_state;
+	Action action;
+	float reward;
+	bool terminated;
+	bool truncated;
+
+	Optimize_Step_return() = default;
+	Optimize_Step_return(const Simulation_Step_return& step)
+		: action(step.action), reward(step.reward), terminated(step.terminated), truncated(step.truncated) {}
+};
+
 struct Float_State
 {
     std::vector<float> state;
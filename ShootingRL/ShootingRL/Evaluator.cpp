@@ -0,0 +1,465 @@
+#include "Evaluator.h"
+#include "DQN.h"
+#include "ThreadTopology.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    std::string trim(const std::string& text)
+    {
+        size_t begin = text.find_first_not_of(" \t\r\n");
+        size_t end = text.find_last_not_of(" \t\r\n");
+        return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+    }
+
+    std::vector<std::string> parseList(const std::string& text)
+    {
+        std::vector<std::string> entries;
+        std::stringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            item = trim(item);
+            if (item.empty())
+                continue;
+            if (item[0] != '@')
+            {
+                entries.push_back(item);
+                continue;
+            }
+            std::ifstream is(item.substr(1));
+            if (!is.is_open())
+                throw std::runtime_error("Could not open the list file " + item.substr(1) + ".");
+            for (std::string line; std::getline(is, line);)
+            {
+                line = trim(line);
+                if (!line.empty() && line[0] != '#')
+                    entries.push_back(line);
+            }
+        }
+        return entries;
+    }
+
+    // Checkpoints are loaded by the first worker that needs them and dropped after their last level.
+    // The network is built from the spec saved next to the weights.
+    class NetworkCache
+    {
+    public:
+        NetworkCache(ActorPrecision mode, int uses) : mode(mode), uses(uses) {}
+
+        std::shared_ptr<InferenceNetwork> acquire(const std::string& checkpoint, CheckpointSpec& spec)
+        {
+            std::shared_ptr<Entry> entry;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto& slot = entries[checkpoint];
+                if (!slot)
+                {
+                    slot = std::make_shared<Entry>();
+                    slot->remaining = uses;
+                }
+                entry = slot;
+            }
+
+            // Only workers waiting for the same checkpoint block on its load
+            std::lock_guard<std::mutex> lock(entry->mutex);
+            if (!entry->loaded)
+            {
+                entry->loaded = true;
+                try
+                {
+                    entry->spec = CheckpointSpec::load(checkpoint);
+                    QNetwork q_network(entry->spec.network, entry->spec.action_count, 0);
+                    torch::load(q_network, (checkpoint + "_network.pt").c_str());
+                    q_network->eval();
+                    entry->network = std::make_shared<InferenceNetwork>();
+                    entry->network->mode = mode;
+                    entry->network->refresh(*q_network);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cout << "Failed to load " << checkpoint << "_network.pt: " << e.what() << "\n";
+                }
+            }
+            spec = entry->spec;
+            return entry->network;
+        }
+
+        void release(const std::string& checkpoint)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(checkpoint);
+            if (it != entries.end() && --it->second->remaining <= 0)
+                entries.erase(it);
+        }
+
+    private:
+        struct Entry
+        {
+            std::mutex mutex;
+            std::shared_ptr<InferenceNetwork> network;
+            CheckpointSpec spec;
+            bool loaded = false;
+            int remaining = 0;
+        };
+
+        ActorPrecision mode;
+        int uses;
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<Entry>> entries;
+    };
+
+    struct Episode
+    {
+        std::unique_ptr<LevelData> level;
+        sf::Image observation;
+        double score = 0.0;
+        int steps = 0;
+        bool done = false;
+        bool won = false;
+        int targets_hit = 0;
+        std::mt19937 rng;
+        int random_steps = 0;  // Leading steps that ignore the network
+    };
+
+    sf::Image render(sf::RenderTexture& target, LevelData& level)
+    {
+        target.clear();
+        level.DrawScene(target);
+        target.display();
+        return target.getTexture().copyToImage();
+    }
+
+    // One logical processor per physical core first, hyperthread siblings only after all of those
+    std::vector<int> workerCores()
+    {
+        std::vector<CoreInfo> cores = ThreadTopology::DetectCores();
+        std::vector<int> primary, siblings;
+        std::set<int> seen;
+        for (auto& core : cores)
+        {
+            if (seen.insert(core.physical).second)
+                primary.push_back(core.logical);
+            else
+                siblings.push_back(core.logical);
+        }
+        primary.insert(primary.end(), siblings.begin(), siblings.end());
+        return primary;
+    }
+
+    int physicalCoreCount()
+    {
+        std::set<int> physical;
+        for (auto& core : ThreadTopology::DetectCores())
+            physical.insert(core.physical);
+        return std::max<int>(1, static_cast<int>(physical.size()));
+    }
+
+    void summarize(const std::vector<Episode>& episodes, EvaluationResult& result)
+    {
+        result.episodes = static_cast<int>(episodes.size());
+        if (episodes.empty())
+            return;
+        double returns = 0.0, squares = 0.0, winSteps = 0.0, targets = 0.0, steps = 0.0;
+        int wins = 0;
+        for (auto& episode : episodes)
+        {
+            returns += episode.score;
+            squares += episode.score * episode.score;
+            targets += episode.targets_hit;
+            steps += episode.steps;
+            if (episode.won)
+            {
+                wins++;
+                winSteps += episode.steps;
+            }
+        }
+        double count = static_cast<double>(episodes.size());
+        result.mean_return = returns / count;
+        result.return_stddev = std::sqrt(std::max(0.0, squares / count - result.mean_return * result.mean_return));
+        result.win_rate = wins / count;
+        result.mean_steps_to_win = wins > 0 ? winSteps / wins : 0.0;
+        result.mean_targets_hit = targets / count;
+        result.mean_steps = steps / count;
+    }
+}
+
+EvaluationConfig EvaluationConfig::fromArguments(int argc, char* argv[])
+{
+    EvaluationConfig config;
+    if (argc < 4)
+        throw std::runtime_error("Usage: --evaluate <checkpoints> <levels> [episodes] [workers] [csv] [seed]");
+    config.checkpoints = parseList(argv[2]);
+    config.levels = parseList(argv[3]);
+    if (argc > 4) config.episodes = std::max(1, std::stoi(argv[4]));
+    if (argc > 5) config.workers = std::max(0, std::stoi(argv[5]));
+    if (argc > 6) config.csv_path = argv[6];
+    if (argc > 7) config.seed = static_cast<unsigned>(std::stoul(argv[7]));
+    return config;
+}
+
+std::vector<EvaluationResult> evaluateCheckpoints(const EvaluationConfig& config)
+{
+    size_t levelCount = config.levels.size();
+    size_t total = config.checkpoints.size() * levelCount;
+    std::vector<EvaluationResult> results(total);
+    if (total == 0)
+        return results;
+
+    // Levels are parsed once, every episode starts from a copy
+    std::vector<std::unique_ptr<LevelData>> pristine(levelCount);
+    std::vector<int> targetCounts(levelCount, 0);
+    for (size_t i = 0; i < levelCount; i++)
+    {
+        try
+        {
+            auto level = std::make_unique<LevelData>();
+            level->LoadData(config.levels[i]);
+            targetCounts[i] = level->CountTargets();
+            pristine[i] = std::move(level);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Failed to load the level " << config.levels[i] << ": " << e.what() << "\n";
+        }
+    }
+
+    // Parallelism comes from the workers, each forward pass runs on its own thread only
+    torch::set_num_threads(1);
+    std::vector<int> cores = workerCores();
+    int workers = config.workers > 0 ? config.workers : physicalCoreCount();
+    workers = std::max(1, std::min(workers, static_cast<int>(total)));
+    int batchEnvs = std::max(1, std::min(config.batch_envs, config.episodes));
+
+    NetworkCache cache(config.inference_mode, static_cast<int>(levelCount));
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> finished{ 0 };
+    std::mutex print_mutex;
+
+    auto work = [&](int worker) {
+        if (!cores.empty())
+            ThreadTopology::PinCurrentThread({ cores[worker % cores.size()] });
+
+        // Sized for the observation of the checkpoint being evaluated, rebuilt only when that changes
+        ObservationSpec observation{ 0, 0, 0 };
+        sf::RenderTexture target;
+        size_t frameBytes = 0;
+        // Reused for every batch, only the rows of running episodes are filled
+        torch::Tensor pixels;
+        std::vector<size_t> running;
+        running.reserve(batchEnvs);
+
+        // Checkpoint-major order keeps the few networks in use shared between the workers
+        for (size_t item = next++; item < total; item = next++)
+        {
+            size_t checkpointIndex = item / levelCount;
+            size_t levelIndex = item % levelCount;
+            const std::string& checkpoint = config.checkpoints[checkpointIndex];
+            EvaluationResult& result = results[item];
+            result.checkpoint = checkpoint;
+            result.level = config.levels[levelIndex];
+            result.targets = targetCounts[levelIndex];
+
+            CheckpointSpec spec;
+            std::shared_ptr<InferenceNetwork> network = cache.acquire(checkpoint, spec);
+            if (network)
+            {
+                ObservationSpec wanted = spec.observation();
+                if (wanted.channels != observation.channels || wanted.height != observation.height || wanted.width != observation.width)
+                {
+                    if (!target.create(wanted.width, wanted.height))
+                    {
+                        std::lock_guard<std::mutex> lock(print_mutex);
+                        std::cout << "Evaluation worker " << worker << " could not create a " << wanted.width << "x" << wanted.height << " render texture.\n";
+                        network.reset();
+                        observation = ObservationSpec{ 0, 0, 0 };
+                    }
+                    else
+                    {
+                        observation = wanted;
+                        frameBytes = static_cast<size_t>(observation.channels) * observation.height * observation.width;
+                        pixels = torch::empty({ batchEnvs, observation.channels, observation.height, observation.width }, torch::kByte);
+                    }
+                }
+            }
+            if (!network || !pristine[levelIndex])
+            {
+                result.failed = true;
+                cache.release(checkpoint);
+                finished++;
+                continue;
+            }
+
+            std::vector<Episode> episodes(config.episodes);
+            for (int first = 0; first < config.episodes; first += batchEnvs)
+            {
+                int last = std::min(config.episodes, first + batchEnvs);
+                for (int i = first; i < last; i++)
+                {
+                    Episode& episode = episodes[i];
+                    std::seed_seq sequence{ config.seed, static_cast<unsigned>(levelIndex), static_cast<unsigned>(i) };
+                    episode.rng.seed(sequence);
+                    episode.random_steps = std::uniform_int_distribution<int>(0, std::max(0, config.random_start_steps))(episode.rng);
+                    episode.level = std::make_unique<LevelData>(*pristine[levelIndex]);
+                    episode.level->StartSimulation(true);
+                    episode.observation = render(target, *episode.level);
+                }
+
+                for (;;)
+                {
+                    running.clear();
+                    for (int i = first; i < last; i++)
+                        if (!episodes[i].done)
+                            running.push_back(i);
+                    if (running.empty())
+                        break;
+
+                    uint8_t* batch = pixels.data_ptr<uint8_t>();
+                    for (size_t row = 0; row < running.size(); row++)
+                        std::memcpy(batch + row * frameBytes, episodes[running[row]].observation.getPixelsPtr(), frameBytes);
+                    torch::Tensor states = pixels.narrow(0, 0, static_cast<int64_t>(running.size())).to(torch::kFloat).div_(255);
+                    torch::Tensor actions = network->forward(states).argmax(1).to(torch::kInt).contiguous();
+                    const int32_t* chosen = actions.data_ptr<int32_t>();
+
+                    for (size_t row = 0; row < running.size(); row++)
+                    {
+                        Episode& episode = episodes[running[row]];
+                        int action = chosen[row] % spec.action_count;
+                        if (episode.steps < episode.random_steps || std::uniform_real_distribution<float>(0.0f, 1.0f)(episode.rng) < config.epsilon)
+                            action = std::uniform_int_distribution<int>(0, spec.action_count - 1)(episode.rng);
+                        Simulation_Step_return step_return = episode.level->Update(config.dt, static_cast<Action>(action));
+                        episode.score += step_return.reward;
+                        episode.steps++;
+                        if (step_return.terminated || step_return.truncated || episode.steps >= config.max_steps)
+                        {
+                            int remaining = episode.level->CountTargets();
+                            episode.done = true;
+                            episode.won = step_return.terminated && remaining == 0;
+                            episode.targets_hit = result.targets - remaining;
+                            episode.level.reset();
+                        }
+                        else
+                            episode.observation = render(target, *episode.level);
+                    }
+                }
+            }
+            network.reset();
+            cache.release(checkpoint);
+            summarize(episodes, result);
+
+            size_t done = ++finished;
+            std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << "[" << done << "/" << total << "] " << checkpoint << " on " << result.level
+                << ": win rate " << std::fixed << std::setprecision(2) << result.win_rate
+                << ", return " << std::setprecision(1) << result.mean_return << "\n";
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+        threads.emplace_back(work, i);
+    for (auto& thread : threads)
+        thread.join();
+    return results;
+}
+
+int runEvaluation(const EvaluationConfig& config)
+{
+    if (config.checkpoints.empty() || config.levels.empty())
+    {
+        std::cout << "Nothing to evaluate.\n";
+        return 1;
+    }
+    Clock::time_point start = Clock::now();
+    std::vector<EvaluationResult> results = evaluateCheckpoints(config);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << "\n" << std::left << std::setw(32) << "checkpoint" << std::setw(20) << "level"
+        << std::right << std::setw(10) << "return" << std::setw(10) << "stddev" << std::setw(8) << "win"
+        << std::setw(12) << "to win" << std::setw(10) << "targets" << "\n";
+    for (auto& result : results)
+    {
+        std::cout << std::left << std::setw(32) << result.checkpoint << std::setw(20) << result.level << std::right;
+        if (result.failed)
+        {
+            std::cout << std::setw(10) << "failed" << "\n";
+            continue;
+        }
+        std::cout << std::fixed << std::setprecision(1) << std::setw(10) << result.mean_return << std::setw(10) << result.return_stddev
+            << std::setprecision(2) << std::setw(8) << result.win_rate
+            << std::setprecision(1) << std::setw(12) << result.mean_steps_to_win
+            << std::setw(6) << result.mean_targets_hit << "/" << std::left << std::setw(3) << result.targets << std::right << "\n";
+    }
+
+    // Checkpoints ranked by their win rate over all levels, the mean return breaks ties
+    struct Ranking
+    {
+        std::string checkpoint;
+        double win_rate = 0.0;
+        double mean_return = 0.0;
+        int levels = 0;
+    };
+    std::vector<Ranking> ranking;
+    uint64_t episodes = 0;
+    for (size_t i = 0; i < results.size(); i += config.levels.size())
+    {
+        Ranking entry;
+        entry.checkpoint = results[i].checkpoint;
+        for (size_t j = i; j < i + config.levels.size(); j++)
+        {
+            if (results[j].failed)
+                continue;
+            entry.win_rate += results[j].win_rate;
+            entry.mean_return += results[j].mean_return;
+            entry.levels++;
+            episodes += results[j].episodes;
+        }
+        if (entry.levels == 0)
+            continue;
+        entry.win_rate /= entry.levels;
+        entry.mean_return /= entry.levels;
+        ranking.push_back(entry);
+    }
+    std::sort(ranking.begin(), ranking.end(), [](const Ranking& a, const Ranking& b) {
+        return a.win_rate != b.win_rate ? a.win_rate > b.win_rate : a.mean_return > b.mean_return;
+    });
+
+    std::cout << "\nRanking\n";
+    for (size_t i = 0; i < ranking.size(); i++)
+        std::cout << std::setw(4) << i + 1 << "  " << std::left << std::setw(32) << ranking[i].checkpoint << std::right
+            << std::fixed << std::setprecision(2) << " win rate " << ranking[i].win_rate
+            << std::setprecision(1) << ", return " << ranking[i].mean_return << " over " << ranking[i].levels << " level(s)\n";
+    std::cout << episodes << " episodes in " << std::setprecision(1) << seconds << "s\n";
+
+    if (!config.csv_path.empty())
+    {
+        std::ofstream os(config.csv_path);
+        if (!os.is_open())
+        {
+            std::cout << "Failed to write " << config.csv_path << "\n";
+            return 1;
+        }
+        os << "checkpoint,level,episodes,mean_return,return_stddev,win_rate,mean_steps_to_win,mean_targets_hit,targets,mean_steps,failed\n";
+        for (auto& result : results)
+            os << result.checkpoint << "," << result.level << "," << result.episodes << "," << result.mean_return << ","
+                << result.return_stddev << "," << result.win_rate << "," << result.mean_steps_to_win << ","
+                << result.mean_targets_hit << "," << result.targets << "," << result.mean_steps << "," << (result.failed ? 1 : 0) << "\n";
+    }
+    return ranking.empty() ? 1 : 0;
+}
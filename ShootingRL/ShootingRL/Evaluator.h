@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "InferenceNetwork.h"
+
+struct EvaluationConfig
+{
+	std::vector<std::string> checkpoints;  // Prefixes passed to DQN::checkpoint
+	std::vector<std::string> levels;
+	int episodes = 16;         // Episodes per checkpoint and level
+	int workers = 0;           // 0 uses one per physical core
+	int batch_envs = 16;       // Episodes a worker steps side by side and feeds through one forward pass
+	int max_steps = 3000;      // Episodes still running after this many steps count as truncated
+	float dt = 0.02f;
+	// Levels are deterministic and the policy greedy, so episodes only differ through these. Every episode
+	// starts with up to random_start_steps random actions and then acts randomly with probability epsilon.
+	// Episode i of a level draws from the same seeded stream for every checkpoint, keeping the comparison fair.
+	int random_start_steps = 30;
+	float epsilon = 0.05f;
+	unsigned seed = 0;
+	ActorPrecision inference_mode = ActorPrecision::FP32;
+	std::string csv_path;      // Per checkpoint and level results, empty only prints them
+
+	// --evaluate <checkpoints> <levels> [episodes] [workers] [csv] [seed]
+	// Both lists are comma separated, an entry starting with @ names a file with one entry per line
+	static EvaluationConfig fromArguments(int argc, char* argv[]);
+};
+
+// Aggregate over all episodes of one checkpoint on one level
+struct EvaluationResult
+{
+	std::string checkpoint;
+	std::string level;
+	int episodes = 0;
+	double mean_return = 0.0;
+	double return_stddev = 0.0;
+	double win_rate = 0.0;
+	double mean_steps_to_win = 0.0;  // Over won episodes only, 0 without any
+	double mean_targets_hit = 0.0;
+	int targets = 0;                 // Targets the level starts with
+	double mean_steps = 0.0;
+	bool failed = false;             // The checkpoint or the level could not be loaded
+};
+
+// Runs every checkpoint x level pair near greedily on a pool of worker threads. Each worker takes the
+// next pair, steps its episodes in lockstep and picks the actions of all of them with one batched
+// forward pass without autograd. Checkpoints are loaded once and shared by the workers.
+std::vector<EvaluationResult> evaluateCheckpoints(const EvaluationConfig& config);
+// Prints the results and a ranking of the checkpoints, writes the csv when configured
+int runEvaluation(const EvaluationConfig& config);
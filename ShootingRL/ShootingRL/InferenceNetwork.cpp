@@ -0,0 +1,106 @@
+#include "InferenceNetwork.h"
+#include "DQN.h"
+
+void InferenceNetwork::refresh(QNetworkImpl& source)
+{
+    torch::NoGradGuard no_grad;
+
+    torch::ScalarType type = mode == ActorPrecision::BF16 ? torch::kBFloat16 : torch::kFloat;
+    // Dynamic int8 linear layers need a CPU with fbgemm support, otherwise stay in FP32
+    quantized = mode == ActorPrecision::INT8 && at::fbgemm_is_cpu_supported();
+
+    convs.clear();
+    for (size_t i = 0; i < source.convs.size(); i++)
+    {
+        const ConvLayerSpec& spec = source.spec.conv_layers[i];
+        ConvLayer layer;
+        layer.weight = source.convs[i]->weight.detach().to(type).contiguous().clone();
+        layer.bias = source.convs[i]->bias.detach().to(type).contiguous().clone();
+        layer.stride = { spec.stride, spec.stride };
+        layer.padding = { spec.padding, spec.padding };
+        layer.max_pool = spec.max_pool;
+        convs.push_back(layer);
+    }
+
+    fcs.clear();
+    for (auto& fc : source.fcs)
+    {
+        LinearLayer layer;
+        if (quantized)
+        {
+            torch::Tensor weight = fc->weight.detach().contiguous();
+            auto [q_weight, col_offsets, scale, zero_point] = at::fbgemm_linear_quantize_weight(weight);
+            layer.weight = q_weight;
+            layer.packed_weight = at::fbgemm_pack_quantized_matrix(q_weight);
+            layer.col_offsets = col_offsets;
+            layer.scale = scale;
+            layer.zero_point = zero_point;
+            layer.bias = fc->bias.detach().contiguous().clone();
+        }
+        else
+        {
+            layer.weight = fc->weight.detach().to(type).contiguous().clone();
+            layer.bias = fc->bias.detach().to(type).contiguous().clone();
+        }
+        fcs.push_back(layer);
+    }
+
+    softmax_output = source.spec.softmax_output;
+    ready = true;
+}
+
+torch::Tensor InferenceNetwork::forward(torch::Tensor x)
+{
+    c10::InferenceMode inference_guard;
+
+    // The int8 layers quantize float activations themselves, only bf16 converts the input
+    if (mode == ActorPrecision::BF16)
+        x = x.to(torch::kBFloat16);
+
+    // The activation runs in place on the conv output instead of allocating another tensor
+    for (auto& layer : convs)
+    {
+        x = torch::conv2d(x, layer.weight, layer.bias, layer.stride, layer.padding);
+        x.relu_();
+        if (layer.max_pool)
+            x = torch::max_pool2d(x, { 2, 2 });
+    }
+
+    x = x.flatten(1);
+
+    for (size_t i = 0; i < fcs.size(); i++)
+    {
+        x = linear(fcs[i], x);
+        if (i + 1 < fcs.size())
+            x.relu_();
+    }
+
+    x = x.to(torch::kFloat);
+    if (softmax_output)
+        x = torch::softmax(x, /*dim=*/1);
+    return x;
+}
+
+float InferenceNetwork::argmaxAgreement(QNetworkImpl& reference, torch::Tensor states)
+{
+    torch::NoGradGuard no_grad;
+
+    torch::Tensor expected = reference.forward(states).argmax(1);
+    torch::Tensor actual = forward(states).argmax(1);
+    return expected.eq(actual).to(torch::kFloat).mean().item<float>();
+}
+
+bool InferenceNetwork::isReady() const
+{
+    return ready;
+}
+
+torch::Tensor InferenceNetwork::linear(const LinearLayer& layer, torch::Tensor x)
+{
+    if (quantized)
+    {
+        return at::fbgemm_linear_int8_weight_fp32_activation(x.contiguous(), layer.weight, layer.packed_weight,
+            layer.col_offsets, layer.scale, layer.zero_point, layer.bias);
+    }
+    return torch::linear(x, layer.weight, layer.bias);
+}
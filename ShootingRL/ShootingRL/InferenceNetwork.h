@@ -0,0 +1,52 @@
+#pragma once
+#include <torch/torch.h>
+
+#include <vector>
+
+class QNetworkImpl;
+
+enum class ActorPrecision
+{
+	FP32,  // Frozen copy of the weights, no autograd state
+	BF16,  // Weights and activations in bfloat16
+	INT8   // Linear layers with int8 weights and dynamically quantized activations
+};
+
+// Actor side copy of a QNetwork used only to pick actions.
+// It holds plain tensors refreshed from the learner so forward passes never touch autograd.
+class InferenceNetwork
+{
+public:
+	InferenceNetwork() {};
+	void refresh(QNetworkImpl& source);
+	torch::Tensor forward(torch::Tensor x);
+	// Fraction of states where this copy and the full precision network pick the same action
+	float argmaxAgreement(QNetworkImpl& reference, torch::Tensor states);
+	bool isReady() const;
+
+	ActorPrecision mode = ActorPrecision::FP32;
+
+private:
+	struct ConvLayer
+	{
+		torch::Tensor weight, bias;
+		std::vector<int64_t> stride, padding;
+		bool max_pool;
+	};
+	struct LinearLayer
+	{
+		torch::Tensor weight, bias;
+		// INT8 only
+		torch::Tensor packed_weight, col_offsets;
+		double scale = 1.0;
+		int64_t zero_point = 0;
+	};
+
+	torch::Tensor linear(const LinearLayer& layer, torch::Tensor x);
+
+	std::vector<ConvLayer> convs;
+	std::vector<LinearLayer> fcs;
+	bool softmax_output = false;
+	bool quantized = false;
+	bool ready = false;
+};
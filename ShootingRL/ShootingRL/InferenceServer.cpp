@@ -0,0 +1,452 @@
+#include "InferenceServer.h"
+#include "DQN.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace {
+    const uint32_t helloMagic = 0x53525049;  // "IPRS"
+    const size_t linearBuckets = 64;
+    const size_t subBuckets = 16;
+    const int largestExponent = 40;
+
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t microsBetween(Clock::time_point from, Clock::time_point to)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+    }
+
+    // Set by Ctrl+C or a termination request, runInferenceServer polls it and stops the server
+    volatile std::sig_atomic_t interrupted = 0;
+
+    void onInterrupt(int)
+    {
+        interrupted = 1;
+    }
+
+    int floorLog2(uint64_t value)
+    {
+        int exponent = 0;
+        while (value >>= 1)
+            exponent++;
+        return exponent;
+    }
+
+    void printLatencies(const char* name, const LatencyHistogram& histogram)
+    {
+        std::cout << "  " << std::setw(8) << name << " us  p50 " << histogram.percentile(0.5) << "  p90 " << histogram.percentile(0.9)
+            << "  p99 " << histogram.percentile(0.99) << "  p99.9 " << histogram.percentile(0.999) << "  max " << histogram.max() << "\n";
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    buckets.assign(linearBuckets + (largestExponent - 6 + 1) * subBuckets, 0);
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t micros)
+{
+    micros = std::min<uint64_t>(micros, (1ull << (largestExponent + 1)) - 1);
+    if (micros < linearBuckets)
+        return static_cast<size_t>(micros);
+    int exponent = floorLog2(micros);
+    size_t sub = static_cast<size_t>(micros >> (exponent - 4)) & (subBuckets - 1);
+    return linearBuckets + (exponent - 6) * subBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket)
+{
+    if (bucket < linearBuckets)
+        return bucket;
+    int exponent = 6 + static_cast<int>((bucket - linearBuckets) / subBuckets);
+    uint64_t sub = (bucket - linearBuckets) % subBuckets;
+    uint64_t lower = (subBuckets + sub) << (exponent - 4);
+    return lower + (1ull << (exponent - 4)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros)
+{
+    buckets[bucketOf(micros)]++;
+    samples++;
+    total += micros;
+    largest = std::max(largest, micros);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < buckets.size(); i++)
+        buckets[i] += other.buckets[i];
+    samples += other.samples;
+    total += other.total;
+    largest = std::max(largest, other.largest);
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(buckets.begin(), buckets.end(), 0);
+    samples = 0;
+    total = 0;
+    largest = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    if (samples == 0)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(fraction * (samples - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(bucketUpperBound(i), largest);
+    }
+    return largest;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return samples;
+}
+
+uint64_t LatencyHistogram::max() const
+{
+    return largest;
+}
+
+double LatencyHistogram::mean() const
+{
+    return samples == 0 ? 0.0 : static_cast<double>(total) / samples;
+}
+
+InferenceServerConfig InferenceServerConfig::fromArguments(int argc, char* argv[])
+{
+    InferenceServerConfig config;
+    if (argc < 3)
+        throw std::runtime_error("Usage: --serve <checkpoint> [socket] [max batch] [max delay us] [inference mode]");
+    config.checkpoint = argv[2];
+    if (argc > 3) config.socket_path = argv[3];
+    if (argc > 4) config.max_batch = std::max(1, std::stoi(argv[4]));
+    if (argc > 5) config.max_delay_us = std::max(0, std::stoi(argv[5]));
+    if (argc > 6) config.inference_mode = static_cast<ActorPrecision>(std::stoi(argv[6]));
+    return config;
+}
+
+LoadGeneratorConfig LoadGeneratorConfig::fromArguments(int argc, char* argv[])
+{
+    LoadGeneratorConfig config;
+    if (argc > 2) config.socket_path = argv[2];
+    if (argc > 3) config.clients = std::max(1, std::stoi(argv[3]));
+    if (argc > 4) config.requests_per_client = std::max(1, std::stoi(argv[4]));
+    return config;
+}
+
+InferenceServer::~InferenceServer()
+{
+    stop();
+}
+
+bool InferenceServer::start(const InferenceServerConfig& config)
+{
+    this->config = config;
+    if (config.intra_op_threads > 0)
+        torch::set_num_threads(config.intra_op_threads);
+
+    // The shape comes from the spec saved next to the weights
+    CheckpointSpec spec;
+    QNetwork q_network;
+    try
+    {
+        spec = CheckpointSpec::load(config.checkpoint);
+        q_network = QNetwork(spec.network, spec.action_count, 0);
+        torch::load(q_network, (config.checkpoint + "_network.pt").c_str());
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to load " << config.checkpoint << "_network.pt: " << e.what() << "\n";
+        return false;
+    }
+    q_network->eval();
+    network.mode = config.inference_mode;
+    network.refresh(*q_network);
+
+    ObservationSpec observation = spec.observation();
+    hello.magic = helloMagic;
+    hello.channels = observation.channels;
+    hello.height = observation.height;
+    hello.width = observation.width;
+    hello.action_count = spec.action_count;
+    observation_bytes = static_cast<size_t>(observation.channels) * observation.height * observation.width;
+
+    if (!listener.Listen(config.socket_path))
+    {
+        std::cout << "Failed to listen on " << config.socket_path << "\n";
+        return false;
+    }
+    stopping = false;
+    interval_start = Clock::now();
+    acceptor = std::thread(&InferenceServer::acceptLoop, this);
+    std::cout << "Serving " << config.checkpoint << " on " << config.socket_path << ", max batch " << config.max_batch
+        << ", max delay " << config.max_delay_us << "us\n";
+    return true;
+}
+
+void InferenceServer::stop()
+{
+    if (!acceptor.joinable())
+        return;
+    stopping = true;
+    { std::lock_guard<std::mutex> lock(queue_mutex); }
+    queue_changed.notify_all();
+
+    // A throwaway connection wakes the blocking accept
+    LocalSocket wake;
+    wake.Connect(config.socket_path);
+    acceptor.join();
+    wake.Close();
+    listener.Close();
+
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for (auto& connection : connections)
+            connection->socket.Shutdown();
+        for (auto& connection : connections)
+            connection->reader.join();
+        connections.clear();
+    }
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue.clear();
+}
+
+void InferenceServer::acceptLoop()
+{
+    while (!stopping)
+    {
+        LocalSocket socket = listener.Accept();
+        if (stopping)
+            break;
+        if (!socket.IsOpen())
+            continue;
+
+        auto connection = std::make_shared<Connection>();
+        connection->socket = std::move(socket);
+        if (!connection->socket.SendAll(&hello, sizeof(hello)))
+            continue;
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        // Clients that disconnected are cleaned up whenever a new one arrives
+        for (auto& old : connections)
+        {
+            if (old->finished)
+                old->reader.join();
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+            [](const std::shared_ptr<Connection>& old) { return !old->reader.joinable(); }), connections.end());
+        connections.push_back(connection);
+        connection->reader = std::thread(&InferenceServer::readLoop, this, connection);
+    }
+}
+
+void InferenceServer::readLoop(std::shared_ptr<Connection> connection)
+{
+    InferenceRequestHeader header;
+    while (!stopping && connection->socket.ReceiveAll(&header, sizeof(header)))
+    {
+        // A request of the wrong size means the client runs another observation shape
+        if (header.bytes != observation_bytes)
+            break;
+        Request request;
+        request.connection = connection;
+        request.id = header.id;
+        request.pixels.resize(observation_bytes);
+        if (!connection->socket.ReceiveAll(request.pixels.data(), observation_bytes))
+            break;
+        request.arrival = Clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(std::move(request));
+        }
+        queue_changed.notify_one();
+    }
+    connection->socket.Shutdown();
+    connection->finished = true;
+}
+
+void InferenceServer::run()
+{
+    std::vector<Request> batch;
+    size_t max_batch = static_cast<size_t>(std::max(1, config.max_batch));
+    while (!stopping)
+    {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            auto report_deadline = interval_start + std::chrono::seconds(config.report_every_seconds);
+            if (!queue_changed.wait_until(lock, report_deadline, [this]() { return !queue.empty() || stopping; }))
+            {
+                lock.unlock();
+                report();
+                continue;
+            }
+            if (stopping)
+                break;
+
+            // Hold the batch open until it is full or its oldest request reaches the deadline
+            auto deadline = queue.front().arrival + std::chrono::microseconds(config.max_delay_us);
+            queue_changed.wait_until(lock, deadline, [&]() { return queue.size() >= max_batch || stopping; });
+            size_t count = std::min(queue.size(), max_batch);
+            for (size_t i = 0; i < count; i++)
+            {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        }
+        runBatch(batch);
+        if (Clock::now() - interval_start >= std::chrono::seconds(config.report_every_seconds))
+            report();
+    }
+}
+
+void InferenceServer::runBatch(std::vector<Request>& batch)
+{
+    if (batch.empty())
+        return;
+    auto started = Clock::now();
+    int64_t count = static_cast<int64_t>(batch.size());
+    torch::Tensor pixels = torch::empty({ count, static_cast<int64_t>(hello.channels), static_cast<int64_t>(hello.height), static_cast<int64_t>(hello.width) }, torch::kByte);
+    for (int64_t i = 0; i < count; i++)
+        std::memcpy(pixels.data_ptr<uint8_t>() + i * observation_bytes, batch[i].pixels.data(), observation_bytes);
+
+    torch::Tensor values;
+    {
+        torch::NoGradGuard no_grad;
+        values = network.forward(pixels.to(torch::kFloat).div_(255)).to(torch::kFloat).contiguous();
+    }
+    torch::Tensor actions = values.argmax(1).to(torch::kInt).contiguous();
+    const float* value_data = values.data_ptr<float>();
+    const int32_t* action_data = actions.data_ptr<int32_t>();
+    uint32_t value_count = static_cast<uint32_t>(values.size(1));
+
+    for (int64_t i = 0; i < count; i++)
+    {
+        Request& request = batch[i];
+        InferenceResponseHeader response{ request.id, action_data[i], value_count };
+        {
+            std::lock_guard<std::mutex> lock(request.connection->send_mutex);
+            if (request.connection->socket.SendAll(&response, sizeof(response)))
+                request.connection->socket.SendAll(value_data + i * value_count, value_count * sizeof(float));
+        }
+        latency.record(microsBetween(request.arrival, Clock::now()));
+        queue_wait.record(microsBetween(request.arrival, started));
+    }
+    batches++;
+    batched_requests += count;
+}
+
+void InferenceServer::report()
+{
+    auto now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - interval_start).count();
+    if (latency.count() > 0)
+    {
+        std::cout << std::fixed << std::setprecision(1) << latency.count() / seconds << " requests/s, mean batch "
+            << static_cast<double>(batched_requests) / std::max<uint64_t>(batches, 1) << "\n";
+        printLatencies("total", latency);
+        printLatencies("queue", queue_wait);
+    }
+    latency.reset();
+    queue_wait.reset();
+    batches = 0;
+    batched_requests = 0;
+    interval_start = now;
+}
+
+int runInferenceServer(const InferenceServerConfig& config)
+{
+    InferenceServer server;
+    if (!server.start(config))
+        return 1;
+
+    interrupted = 0;
+    std::signal(SIGINT, onInterrupt);
+    std::signal(SIGTERM, onInterrupt);
+    std::atomic<bool> finished{ false };
+    std::thread watcher([&]() {
+        while (!interrupted && !finished)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (interrupted)
+        {
+            std::cout << "Stopping the server\n";
+            server.stop();
+        }
+    });
+    server.run();
+    finished = true;
+    watcher.join();
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    return 0;
+}
+
+int runLoadGenerator(const LoadGeneratorConfig& config)
+{
+    std::vector<LatencyHistogram> histograms(config.clients);
+    std::atomic<int> failed(0);
+    auto started = Clock::now();
+
+    std::vector<std::thread> clients;
+    for (int c = 0; c < config.clients; c++)
+    {
+        clients.emplace_back([&, c]()
+        {
+            LocalSocket socket;
+            InferenceHello hello;
+            if (!socket.Connect(config.socket_path) || !socket.ReceiveAll(&hello, sizeof(hello)) || hello.magic != helloMagic)
+            {
+                failed++;
+                return;
+            }
+
+            // Random frames of the served shape, a few of them so requests are not all identical
+            std::mt19937 rng(c);
+            std::uniform_int_distribution<int> byte(0, 255);
+            uint32_t bytes = hello.channels * hello.height * hello.width;
+            std::vector<std::vector<uint8_t>> frames(4, std::vector<uint8_t>(bytes));
+            for (auto& frame : frames)
+                for (auto& value : frame)
+                    value = static_cast<uint8_t>(byte(rng));
+
+            std::vector<float> values(hello.action_count);
+            for (int i = 0; i < config.requests_per_client; i++)
+            {
+                InferenceRequestHeader request{ static_cast<uint32_t>(i), bytes };
+                InferenceResponseHeader response;
+                auto sent = Clock::now();
+                if (!socket.SendAll(&request, sizeof(request)) || !socket.SendAll(frames[i % frames.size()].data(), bytes) ||
+                    !socket.ReceiveAll(&response, sizeof(response)) || response.id != request.id ||
+                    response.value_count > values.size() || !socket.ReceiveAll(values.data(), response.value_count * sizeof(float)))
+                {
+                    failed++;
+                    return;
+                }
+                histograms[c].record(microsBetween(sent, Clock::now()));
+            }
+        });
+    }
+    for (auto& client : clients)
+        client.join();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+    LatencyHistogram total;
+    for (auto& histogram : histograms)
+        total.merge(histogram);
+    std::cout << config.clients << " clients, " << total.count() << " requests in " << std::fixed << std::setprecision(2) << seconds
+        << "s, " << std::setprecision(1) << total.count() / seconds << " requests/s, " << failed.load() << " clients failed\n";
+    printLatencies("client", total);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "InferenceNetwork.h"
+#include "LocalSocket.h"
+
+// Wire format, all fields in host byte order since both ends run on the same machine.
+// The server greets every connection with InferenceHello, after that each request is a
+// header followed by one raw RGBA observation and is answered with a response header
+// followed by value_count Q values.
+struct InferenceHello
+{
+	uint32_t magic;
+	uint32_t channels;
+	uint32_t height;
+	uint32_t width;
+	uint32_t action_count;
+};
+
+struct InferenceRequestHeader
+{
+	uint32_t id;
+	uint32_t bytes;
+};
+
+struct InferenceResponseHeader
+{
+	uint32_t id;
+	int32_t action;
+	uint32_t value_count;
+};
+
+// Log-linear latency histogram in microseconds, exact below 64us and within 1/16 above
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+	void record(uint64_t micros);
+	void merge(const LatencyHistogram& other);
+	void reset();
+	uint64_t percentile(double fraction) const;
+	uint64_t count() const;
+	uint64_t max() const;
+	double mean() const;
+
+private:
+	static size_t bucketOf(uint64_t micros);
+	static uint64_t bucketUpperBound(size_t bucket);
+
+	std::vector<uint64_t> buckets;
+	uint64_t samples = 0;
+	uint64_t total = 0;
+	uint64_t largest = 0;
+};
+
+struct InferenceServerConfig
+{
+	std::string checkpoint;  // Prefix passed to DQN::checkpoint, its _spec.txt gives the network shape
+	std::string socket_path = "shootingrl_policy.sock";
+	int max_batch = 32;
+	int max_delay_us = 2000;  // A batch is run at the latest this long after its oldest request arrived
+	ActorPrecision inference_mode = ActorPrecision::FP32;
+	int intra_op_threads = 0;  // 0 keeps the torch default
+	int report_every_seconds = 5;
+
+	// --serve <checkpoint> [socket] [max batch] [max delay us] [inference mode]
+	static InferenceServerConfig fromArguments(int argc, char* argv[]);
+};
+
+struct LoadGeneratorConfig
+{
+	std::string socket_path = "shootingrl_policy.sock";
+	int clients = 8;
+	int requests_per_client = 1000;
+
+	// --loadgen [socket] [clients] [requests per client]
+	static LoadGeneratorConfig fromArguments(int argc, char* argv[]);
+};
+
+// Serves greedy actions of a checkpointed Q network to local clients. Requests of all connections
+// are collected into one queue and run as a single batched forward pass once max_batch requests
+// are waiting or the oldest one has waited max_delay_us.
+class InferenceServer
+{
+public:
+	~InferenceServer();
+	bool start(const InferenceServerConfig& config);
+	// Blocks running batches until stop() is called from another thread
+	void run();
+	void stop();
+
+private:
+	struct Connection
+	{
+		LocalSocket socket;
+		std::mutex send_mutex;
+		std::thread reader;
+		std::atomic<bool> finished{ false };
+	};
+	struct Request
+	{
+		std::shared_ptr<Connection> connection;
+		uint32_t id;
+		std::vector<uint8_t> pixels;
+		std::chrono::steady_clock::time_point arrival;
+	};
+
+	void acceptLoop();
+	void readLoop(std::shared_ptr<Connection> connection);
+	void runBatch(std::vector<Request>& batch);
+	void report();
+
+	InferenceServerConfig config;
+	InferenceHello hello;
+	size_t observation_bytes = 0;
+	InferenceNetwork network;
+
+	LocalSocket listener;
+	std::thread acceptor;
+	std::mutex connections_mutex;
+	std::vector<std::shared_ptr<Connection>> connections;
+
+	std::mutex queue_mutex;
+	std::condition_variable queue_changed;
+	std::deque<Request> queue;
+	std::atomic<bool> stopping{ false };
+
+	// Per reporting interval
+	LatencyHistogram latency, queue_wait;
+	uint64_t batches = 0;
+	uint64_t batched_requests = 0;
+	std::chrono::steady_clock::time_point interval_start;
+};
+
+// Serves until Ctrl+C or a termination request, which stops the server and closes its connections
+int runInferenceServer(const InferenceServerConfig& config);
+// Closed loop clients sending random observations, prints throughput and latency percentiles
+int runLoadGenerator(const LoadGeneratorConfig& config);
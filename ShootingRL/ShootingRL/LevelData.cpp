@@ -3,6 +3,7 @@
 #include "algorithm"
 #include "fstream"
 #include <iostream>
+#include <limits>
 
 #include "Utilities.h"
 
@@ -16,12 +17,17 @@ void LevelData::SaveData(const std::string& filename)
 	{
 		std::ofstream os(std::string("../assets/levels/") + filename + std::string(".json"));
 		cereal::JSONOutputArchive archive(os);
-		archive(lines);
+		archive(cereal::make_nvp("value0", lines), cereal::make_nvp("motions", motions));
 	}
 }
 void LevelData::LoadData(const std::string& filename)
 {
 	lastLoadedFile = filename;
+	if (filename.size() > 7 && filename.compare(filename.size() - 7, 7, ".chunks") == 0) {
+		LoadChunked(filename);
+		return;
+	}
+	chunked.reset();
 	std::ifstream is(std::string("../assets/levels/") + filename + std::string(".json"));
 	if (!is.is_open())
 	{
@@ -30,26 +36,137 @@ void LevelData::LoadData(const std::string& filename)
 
 	cereal::JSONInputArchive archive(is);
 	archive(lines);  // Load the `lines` member variable
+	// Levels saved before moving targets had motions let all of them bounce
+	try {
+		archive(cereal::make_nvp("motions", motions));
+	}
+	catch (const cereal::Exception&) {
+		motions.clear();
+	}
 
 	int playerIndex = FindPlayerIndex();
 	if (playerIndex != -1) {
 		lines[playerIndex].first.setOrigin(lines[playerIndex].first.getSize() / 2.0f);
 	}
+
+	if (useDistanceField) {
+		BakeDistanceField(filename);
+	}
+	BuildKinematics();
+	CollectAgents();
+	// A reloaded level starts a new episode with fresh budgets
+	terminationMonitor.Reset();
+	episodeEnd = EpisodeEnd::None;
 }
-Optimize_Step_return LevelData::Update(float dt, Action action)
+void LevelData::BakeDistanceField(const std::string& filename)
 {
-	Optimize_Step_return step_return = {};
+	// Streamed levels change their lines all the time, a field of the resident chunks would be stale
+	if (chunked) {
+		return;
+	}
+	// Reloading the same level every episode keeps the already baked field
+	if (distanceField.IsBaked() && distanceField.hash == DistanceField::GeometryHash(lines, distanceFieldCellSize)) {
+		return;
+	}
+
+	std::string cachePath = std::string("../assets/levels/") + filename + std::string(".sdf");
+	if (!distanceField.LoadCache(cachePath, lines, distanceFieldCellSize)) {
+		distanceField.Bake(lines, distanceFieldCellSize);
+		distanceField.SaveCache(cachePath);
+	}
+}
+void LevelData::ResetFrom(const LevelData& other)
+{
+	prevStep = other.prevStep;
+	lastLoadedFile = other.lastLoadedFile;
+	lines = other.lines;
+	previewLine = other.previewLine;
+	previewLineEnabled = other.previewLineEnabled;
+	mousePrevEvent = other.mousePrevEvent;
+	currentMode = other.currentMode;
+	leftMouseButtonClicked = other.leftMouseButtonClicked;
+	rightMouseButtonClicked = other.rightMouseButtonClicked;
+	isImGuiHovered = other.isImGuiHovered;
+	shoot = other.shoot;
+	up = other.up;
+	down = other.down;
+	left = other.left;
+	right = other.right;
+	rotateLeft = other.rotateLeft;
+	rotateRight = other.rotateRight;
+	runSimulation = other.runSimulation;
+	lastTargetIndex = other.lastTargetIndex;
+	rayHitWall = other.rayHitWall;
+	playerIndex = other.playerIndex;
+	playerDirection = other.playerDirection;
+	debugLine = other.debugLine;
+	timer = other.timer;
+	termination = other.termination;
+	terminationMonitor = other.terminationMonitor;
+	episodeEnd = other.episodeEnd;
+	stepProgress = other.stepProgress;
+	playerCollided = other.playerCollided;
+	stepActors = other.stepActors;
+	stepPinned = other.stepPinned;
+	winReward = other.winReward;
+	loseReward = other.loseReward;
+	timeMultiplier = other.timeMultiplier;
+	moveReward = other.moveReward;
+	rotateReward = other.rotateReward;
+	collideReward = other.collideReward;
+	hitStaticTargetReward = other.hitStaticTargetReward;
+	hitMovingTargetReward = other.hitMovingTargetReward;
+	missTargetReward = other.missTargetReward;
+	hitAgentReward = other.hitAgentReward;
+	shotByAgentReward = other.shotByAgentReward;
+	useAI = other.useAI;
+	agentLines = other.agentLines;
+	agentPenalties = other.agentPenalties;
+	distanceField = other.distanceField;
+	useDistanceField = other.useDistanceField;
+	distanceFieldCellSize = other.distanceFieldCellSize;
+	kinematics = other.kinematics;
+	motions = other.motions;
+	movingCandidates = other.movingCandidates;
+	levelSize = other.levelSize;
+	chunked = other.chunked;
+	chunkCache = other.chunkCache;
+	residentChunks = other.residentChunks;
+	wantedChunks = other.wantedChunks;
+	lineIds = other.lineIds;
+	removedShapes = other.removedShapes;
+	parkedTargets = other.parkedTargets;
+	droppedTargets = other.droppedTargets;
+	residentMin = other.residentMin;
+	residentMax = other.residentMax;
+	streamRadius = other.streamRadius;
+}
+Simulation_Step_return LevelData::Update(float dt, Action action)
+{
+	Simulation_Step_return step_return = {};
+	// The shot ray of this step is cast fresh, a hit left over from an earlier step would point at a line
+	// that may have been erased since
+	lastTargetIndex = -1;
+	rayHitWall = false;
+	StreamChunks();
+	if (runSimulation && kinematics.IsActive()) {
+		kinematics.Step(dt);
+		kinematics.Apply(lines);
+	}
 	playerIndex = FindPlayerIndex();
 	if (playerIndex != -1) {
+		playerCollided = false;
 		if (!useAI)
 			PlayerMovement(dt);
 		else
 		step_return.reward+=AIMovement(dt, action);
+		stepActors = 1;
+		stepPinned = playerCollided ? 1 : 0;
 		PlayerDirection();
 		step_return.reward += CheckForWinLose(dt);
 		step_return.action = action;
-		step_return.truncated = false;
-		step_return.terminated = !runSimulation;
+		step_return.truncated = !runSimulation && IsTruncation(episodeEnd);
+		step_return.terminated = !runSimulation && !step_return.truncated;
 	}
 	return step_return;
 }
@@ -60,14 +177,192 @@ void LevelData::Draw(sf::RenderWindow& window)
 
 	PreviewMod(window);
 
-	window.draw(previewLine);
-	for (auto line : lines) {
-		window.draw(line.first);
+	DrawScene(window);
+}
+
+void LevelData::DrawScene(sf::RenderTarget& target)
+{
+	if (chunked && FindPlayerIndex() != -1) {
+		playerIndex = FindPlayerIndex();
+		FollowPlayer(target);
+	}
+	target.draw(previewLine);
+	for (auto& line : lines) {
+		target.draw(line.first);
 	}
 	if (runSimulation) {
-		window.draw(playerDirection);
+		target.draw(playerDirection);
+	}
+}
+
+namespace {
+	ShapeSnapshot snapshotOf(const sf::RectangleShape& shape, int32_t type)
+	{
+		return { shape.getPosition().x, shape.getPosition().y, shape.getSize().x, shape.getSize().y,
+			shape.getOrigin().x, shape.getOrigin().y, shape.getRotation(), shape.getFillColor().toInteger(), type };
+	}
+
+	void applySnapshot(sf::RectangleShape& shape, const ShapeSnapshot& snapshot)
+	{
+		shape.setSize(sf::Vector2f(snapshot.width, snapshot.height));
+		shape.setOrigin(snapshot.origin_x, snapshot.origin_y);
+		shape.setPosition(snapshot.x, snapshot.y);
+		shape.setRotation(snapshot.rotation);
+		shape.setFillColor(sf::Color(snapshot.color));
 	}
+}
 
+size_t LevelData::SnapshotShapes(ShapeSnapshot* shapes, size_t capacity) const
+{
+	size_t count = 0;
+	for (auto& line : lines) {
+		if (count == capacity)
+			return count;
+		shapes[count++] = snapshotOf(line.first, static_cast<int32_t>(line.second));
+	}
+	if (runSimulation && count < capacity)
+		shapes[count++] = snapshotOf(playerDirection, -1);
+	return count;
+}
+
+void LevelData::ApplySnapshot(const ShapeSnapshot* shapes, size_t count)
+{
+	// Resized in place so watching a level does not allocate every frame
+	size_t lineCount = 0;
+	for (size_t i = 0; i < count; i++)
+		if (shapes[i].type >= 0) lineCount++;
+	lines.resize(lineCount);
+	runSimulation = false;
+	size_t line = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (shapes[i].type < 0) {
+			applySnapshot(playerDirection, shapes[i]);
+			runSimulation = true;
+			continue;
+		}
+		applySnapshot(lines[line].first, shapes[i]);
+		lines[line].second = static_cast<ShapeType>(shapes[i].type);
+		line++;
+	}
+}
+
+namespace {
+	// Players move between chunks, they are kept in lines for the whole episode
+	const uint64_t persistentShape = ~0ull;
+}
+
+void LevelData::SaveChunked(const std::string& filename)
+{
+	std::vector<ShapeSnapshot> shapes(lines.size());
+	SnapshotShapes(shapes.data(), shapes.size());
+	if (!ChunkedLevel::Write(std::string("../assets/levels/") + filename + std::string(".chunks"), shapes, motions, chunkSize)) {
+		throw std::runtime_error("Failed to save the chunked level.");
+	}
+}
+
+void LevelData::LoadChunked(const std::string& filename)
+{
+	auto level = std::make_shared<ChunkedLevel>();
+	if (!level->Open(std::string("../assets/levels/") + filename)) {
+		throw std::runtime_error("Failed to open chunked level.");
+	}
+	chunked = level;
+	if (!chunkCache) {
+		chunkCache = ChunkCache::Shared();
+	}
+	// Streamed levels keep the motions in their chunks, StreamedMotion looks them up
+	motions.clear();
+	lines.clear();
+	lineIds.clear();
+	removedShapes.clear();
+	residentChunks.clear();
+	kinematics = TargetKinematics();
+	parkedTargets.clear();
+	for (auto& player : chunked->players) {
+		lines.emplace_back();
+		applySnapshot(lines.back().first, player);
+		lines.back().second = ShapeType::Player;
+		lineIds.push_back(persistentShape);
+	}
+	CollectAgents();
+	StreamChunks();
+	BuildKinematics();
+	terminationMonitor.Reset();
+	episodeEnd = EpisodeEnd::None;
+}
+
+bool LevelData::IsStreaming()
+{
+	return chunked != nullptr;
+}
+
+void LevelData::StreamChunks()
+{
+	if (!chunked) {
+		return;
+	}
+	wantedChunks.clear();
+	for (auto& line : lines) {
+		if (line.second == ShapeType::Player) {
+			glm::vec2 position(line.first.getPosition().x, line.first.getPosition().y);
+			chunked->ChunksAround(position - glm::vec2(streamRadius), position + glm::vec2(streamRadius), wantedChunks);
+		}
+	}
+	std::sort(wantedChunks.begin(), wantedChunks.end());
+	wantedChunks.erase(std::unique(wantedChunks.begin(), wantedChunks.end()), wantedChunks.end());
+	if (wantedChunks == residentChunks) {
+		return;
+	}
+
+	// Players stay in front in the same order, so agent indices only have to close the gaps of shot agents.
+	// Shapes of chunks that stay resident are kept as they are, moving targets keep their positions.
+	std::vector<std::pair<sf::RectangleShape, ShapeType>> next;
+	std::vector<uint64_t> nextIds;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lineIds[i] == persistentShape) {
+			next.push_back(lines[i]);
+			nextIds.push_back(persistentShape);
+		}
+	}
+	int rank = 0;
+	for (auto& agentLine : agentLines) {
+		if (agentLine != -1)
+			agentLine = rank++;
+	}
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lineIds[i] != persistentShape && std::binary_search(wantedChunks.begin(), wantedChunks.end(), static_cast<int>(lineIds[i] >> 32))) {
+			next.push_back(lines[i]);
+			nextIds.push_back(lineIds[i]);
+		}
+	}
+	size_t firstNewLine = next.size();
+	for (int chunk : wantedChunks) {
+		if (std::binary_search(residentChunks.begin(), residentChunks.end(), chunk))
+			continue;
+		std::shared_ptr<const Chunk> loaded = chunkCache->Get(*chunked, chunk);
+		const std::vector<ShapeSnapshot>& shapes = loaded->shapes;
+		for (size_t k = 0; k < shapes.size(); k++) {
+			uint64_t id = (static_cast<uint64_t>(chunk) << 32) | k;
+			if (removedShapes.count(id))
+				continue;
+			next.emplace_back();
+			applySnapshot(next.back().first, shapes[k]);
+			next.back().second = static_cast<ShapeType>(shapes[k].type);
+			nextIds.push_back(id);
+		}
+	}
+	lines.swap(next);
+	lineIds.swap(nextIds);
+	residentChunks.swap(wantedChunks);
+
+	residentMin = glm::vec2(std::numeric_limits<float>::max());
+	residentMax = glm::vec2(-std::numeric_limits<float>::max());
+	for (int chunk : residentChunks) {
+		residentMin = glm::min(residentMin, chunked->ChunkMin(chunk));
+		residentMax = glm::max(residentMax, chunked->ChunkMax(chunk));
+	}
+	playerIndex = FindPlayerIndex();
+	UpdateStreamedKinematics(firstNewLine);
 }
 
 bool LevelData::IsSimulationRunning()
@@ -75,6 +370,109 @@ bool LevelData::IsSimulationRunning()
 	return runSimulation;
 }
 
+void LevelData::StartSimulation(bool ai)
+{
+	// Same as the Run button, for environments driven without the UI
+	runSimulation = true;
+	timer = 0.0f;
+	currentMode = ShapeType::None;
+	useAI = ai;
+	BuildKinematics();
+	CollectAgents();
+	terminationMonitor.Reset();
+	episodeEnd = EpisodeEnd::None;
+}
+
+void LevelData::SetTermination(const TerminationConfig& config)
+{
+	termination = config;
+}
+
+EpisodeEnd LevelData::GetEpisodeEnd()
+{
+	return episodeEnd;
+}
+
+int LevelData::CountAgents()
+{
+	return static_cast<int>(agentLines.size());
+}
+
+void LevelData::CollectAgents()
+{
+	agentLines.clear();
+	for (int i = 0; i < static_cast<int>(lines.size()); i++) {
+		if (lines[i].second == ShapeType::Player) {
+			lines[i].first.setOrigin(lines[i].first.getSize() / 2.0f);
+			agentLines.push_back(i);
+		}
+	}
+	agentPenalties.assign(agentLines.size(), 0.0f);
+}
+
+void LevelData::UpdateAgents(float dt, const Action* actions, float* rewards, bool* terminated)
+{
+	// The moving targets, the win check and the static geometry are shared by all agents
+	StreamChunks();
+	if (runSimulation && kinematics.IsActive()) {
+		kinematics.Step(dt);
+		kinematics.Apply(lines);
+	}
+	std::fill(agentPenalties.begin(), agentPenalties.end(), 0.0f);
+
+	// Agents act one after another, each one sees the moves and shots of the agents before it
+	stepActors = stepPinned = 0;
+	for (size_t agent = 0; agent < agentLines.size(); agent++) {
+		rewards[agent] = 0.0f;
+		playerIndex = agentLines[agent];
+		if (playerIndex == -1)
+			continue;
+		lastTargetIndex = -1;
+		rayHitWall = false;
+		playerCollided = false;
+		rewards[agent] += AIMovement(dt, actions[agent]);
+		stepActors++;
+		stepPinned += playerCollided ? 1 : 0;
+	}
+
+	float shared = CheckForWinLose(dt);
+	bool anyLeft = false;
+	for (size_t agent = 0; agent < agentLines.size(); agent++) {
+		rewards[agent] += agentPenalties[agent];
+		if (agentLines[agent] != -1) {
+			rewards[agent] += shared;
+			anyLeft = true;
+		}
+	}
+	if (!anyLeft && runSimulation) {
+		runSimulation = false;
+		episodeEnd = EpisodeEnd::Eliminated;
+		for (size_t agent = 0; agent < agentLines.size(); agent++) {
+			rewards[agent] += loseReward;
+		}
+	}
+	// Agents still in the world when the episode is cut short are truncated, not terminated
+	bool truncated = !runSimulation && IsTruncation(episodeEnd);
+	for (size_t agent = 0; agent < agentLines.size(); agent++) {
+		terminated[agent] = (!runSimulation && !truncated) || agentLines[agent] == -1;
+	}
+}
+
+void LevelData::DrawAgentScene(sf::RenderTarget& target, int agent)
+{
+	playerIndex = agentLines[agent];
+	if (chunked && playerIndex != -1) {
+		FollowPlayer(target);
+	}
+	for (auto& line : lines) {
+		target.draw(line.first);
+	}
+	if (playerIndex != -1) {
+		PlayerDirection();
+		target.draw(playerDirection);
+	}
+}
+
 void LevelData::PreviewMod(sf::RenderWindow& window)
 {
 	if (rightMouseButtonClicked)
@@ -293,6 +691,11 @@ void LevelData::SaveLoadWindow()
 		// Use the file name from the input field to load
 		LoadData(std::string(fileName));  // Pass the file name to the Load function
 	}
+
+	if (ImGui::Button("Save Chunked")) {
+		// Loaded again as "<name>.chunks"
+		SaveChunked(std::string(fileName));
+	}
 }
 
 void LevelData::RunSimulation()
@@ -302,6 +705,10 @@ void LevelData::RunSimulation()
 		runSimulation = true;
 		timer = 0.0f;
 		currentMode = ShapeType::None;
+		BuildKinematics();
+		CollectAgents();
+		terminationMonitor.Reset();
+		episodeEnd = EpisodeEnd::None;
 	}
 	if (ImGui::Button("Stop")) {
 		// Use the file name from the input field to save
@@ -312,6 +719,9 @@ void LevelData::RunSimulation()
 		LoadData(std::string(lastLoadedFile));  // Pass the file name to the Save function
 	}
 	ImGui::Checkbox("Start Training", &useAI);
+	if (ImGui::Checkbox("Use Distance Field", &useDistanceField) && useDistanceField && !lastLoadedFile.empty()) {
+		BakeDistanceField(lastLoadedFile);
+	}
 }
 
 void LevelData::ResetInput()
@@ -324,6 +734,7 @@ void LevelData::ResetInput()
 	isImGuiHovered = runSimulation ? false : isImGuiHovered;
 	rotateLeft = rotateRight = false;
 	lastTargetIndex = -1;
+	rayHitWall = false;
 }
 
 void LevelData::PlayerRaycast()
@@ -368,10 +779,23 @@ void LevelData::PlayerRaycast()
 	previewLine.setRotation(angleDegrees);
 
 
+	// The baked field finds the first wall by sphere tracing, only targets are tested one by one
+	bool traceWalls = useDistanceField && distanceField.IsBaked() && !chunked;
+	if (traceWalls) {
+		float range = glm::length(rotatedVec);
+		float wallDistance = distanceField.RayLength(start, rotatedVec, range);
+		if (wallDistance < range) {
+			end = start + rotatedVec * (wallDistance / range);
+			rayHitWall = true;
+		}
+	}
+
+	// Moving targets are only tested when the broad-phase puts them near the ray
+	bool queryTargets = kinematics.IsActive();
 	std::vector<sf::Vector2f> corners, prevLine = GetRectangleCorners(previewLine);
-	int index = 0;
-	for (auto line : lines) {
-		if (line.second != ShapeType::Player) {
+	auto testLine = [&](int index) {
+		const auto& line = lines[index];
+		if (index != playerIndex && !(traceWalls && line.second == ShapeType::EnvironmentLine)) {
 			corners = GetRectangleCorners(line.first);
 			if (Physics::LineRect(start,
 				end,
@@ -384,6 +808,7 @@ void LevelData::PlayerRaycast()
 				glm::vec2 v2Normalized = glm::normalize(end - start);
 
 				lastTargetIndex = index;
+				rayHitWall = false;
 
 				// Calculate the angle in radians
 
@@ -395,7 +820,16 @@ void LevelData::PlayerRaycast()
 				previewLine.setRotation(angleDegrees);
 			}
 		}
-		index++;
+	};
+	for (int index = 0; index < static_cast<int>(lines.size()); index++) {
+		if (!(queryTargets && lines[index].second == ShapeType::MovingTarget))
+			testLine(index);
+	}
+	if (queryTargets) {
+		// The segment already ends at the closest hit so far
+		kinematics.QuerySegment(start, end, movingCandidates);
+		for (int index : movingCandidates)
+			testLine(index);
 	}
 }
 
@@ -408,21 +842,21 @@ float LevelData::PlayerMovement(float dt)
 
 	float score = 0.0f;
 	float originalOrientation = lines[playerIndex].first.getRotation();
-	sf::Vector2f originalPosition = lines[playerIndex].first.getPosition();
+	sf::Vector2f displacement(0.0f, 0.0f);
 	if (up) {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(0.0, -1.0f) * movementValue * dt);
+		displacement += sf::Vector2f(0.0, -1.0f) * movementValue * dt;
 		score += moveReward;
 	}
 	if (down) {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(0.0, 1.0f) * movementValue * dt);
+		displacement += sf::Vector2f(0.0, 1.0f) * movementValue * dt;
 		score += moveReward;
 	}
 	if (left) {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(-1.0, 0.0f) * movementValue * dt);
+		displacement += sf::Vector2f(-1.0, 0.0f) * movementValue * dt;
 		score += moveReward;
 	}
 	if (right) {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(1.0, 0.0f) * movementValue * dt);
+		displacement += sf::Vector2f(1.0, 0.0f) * movementValue * dt;
 		score += moveReward;
 	}
 	if (rotateLeft) {
@@ -434,15 +868,12 @@ float LevelData::PlayerMovement(float dt)
 		score += rotateReward;
 	}
 
-	for (auto line : lines) {
-		if (line.second != ShapeType::Player) {
-			if (Physics::RectanglesIntersect(lines[playerIndex].first, line.first)) {
-				score += collideReward;
-				lines[playerIndex].first.setPosition(originalPosition);
-				lines[playerIndex].first.setRotation(originalOrientation);
-				break;
-			}
-		}
+	if (PlayerRotationCollides()) {
+		score += collideReward;
+		lines[playerIndex].first.setRotation(originalOrientation);
+	}
+	if (MovePlayer(displacement)) {
+		score += collideReward;
 	}
 	return score;
 }
@@ -451,26 +882,26 @@ float LevelData::AIMovement(float dt, Action action)
 {
 	float score = 0.0f;
 	float originalOrientation = lines[playerIndex].first.getRotation();
-	sf::Vector2f originalPosition = lines[playerIndex].first.getPosition();
+	sf::Vector2f displacement(0.0f, 0.0f);
 
 	switch (action) {
 	case Action::Up: {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(0.0, -1.0f) * movementValue * dt);
+		displacement = sf::Vector2f(0.0, -1.0f) * movementValue * dt;
 		score += moveReward;
 		break;
 	}
 	case Action::Down: {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(0.0, 1.0f) * movementValue * dt);
+		displacement = sf::Vector2f(0.0, 1.0f) * movementValue * dt;
 		score += moveReward;
 		break;
 	}
 	case Action::Left: {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(-1.0, 0.0f) * movementValue * dt);
+		displacement = sf::Vector2f(-1.0, 0.0f) * movementValue * dt;
 		score += moveReward;
 		break;
 	}
 	case Action::Right: {
-		lines[playerIndex].first.setPosition(lines[playerIndex].first.getPosition() + sf::Vector2f(1.0, 0.0f) * movementValue * dt);
+		displacement = sf::Vector2f(1.0, 0.0f) * movementValue * dt;
 		score += moveReward;
 		break;
 	}
@@ -491,17 +922,158 @@ float LevelData::AIMovement(float dt, Action action)
 	}
 	}
 
-	for (auto line : lines) {
-		if (line.second != ShapeType::Player) {
+	if (PlayerRotationCollides()) {
+		score += collideReward;
+		lines[playerIndex].first.setRotation(originalOrientation);
+	}
+	if (MovePlayer(displacement)) {
+		score += collideReward;
+	}
+	return score;
+}
+
+bool LevelData::MovePlayer(sf::Vector2f displacement)
+{
+	sf::RectangleShape& player = lines[playerIndex].first;
+	glm::vec2 remaining(displacement.x, displacement.y);
+	bool collided = false;
+	bool checkWalls = !PlayerClearOfWalls(glm::length(remaining));
+	CollectMovingTargets(player, displacement);
+
+	// Sweep the player along the displacement, stop at the first contact and slide the rest along the wall
+	for (int iteration = 0; iteration < maxSlideIterations; iteration++) {
+		float distance = glm::length(remaining);
+		if (distance <= 0.0f)
+			break;
+
+		Physics::SweepResult closest;
+		for (const auto& line : lines) {
+			if (&line != &lines[playerIndex] && (checkWalls || line.second != ShapeType::EnvironmentLine) &&
+				!(kinematics.IsActive() && line.second == ShapeType::MovingTarget)) {
+				Physics::SweepResult sweep = Physics::SweepRectangles(player, line.first, remaining);
+				if (sweep.hit && sweep.time <= closest.time) {
+					closest = sweep;
+				}
+			}
+		}
+		for (int index : movingCandidates) {
+			Physics::SweepResult sweep = Physics::SweepRectangles(player, lines[index].first, remaining);
+			if (sweep.hit && sweep.time <= closest.time) {
+				closest = sweep;
+			}
+		}
+
+		if (!closest.hit) {
+			player.move(remaining.x, remaining.y);
+			break;
+		}
+
+		collided = true;
+		// Stay a hair away from the contact so the next sweep does not start overlapping
+		float travel = std::max(0.0f, closest.time - collisionSkin / distance);
+		player.move(remaining.x * travel, remaining.y * travel);
+
+		remaining *= 1.0f - closest.time;
+		remaining -= glm::dot(remaining, closest.normal) * closest.normal;
+	}
+	playerCollided = playerCollided || collided;
+	return collided;
+}
+
+bool LevelData::PlayerRotationCollides()
+{
+	bool checkWalls = !PlayerClearOfWalls(0.0f);
+	for (const auto& line : lines) {
+		if (&line != &lines[playerIndex] && (checkWalls || line.second != ShapeType::EnvironmentLine) &&
+			!(kinematics.IsActive() && line.second == ShapeType::MovingTarget)) {
 			if (Physics::RectanglesIntersect(lines[playerIndex].first, line.first)) {
-				score += collideReward;
-				lines[playerIndex].first.setPosition(originalPosition);
-				lines[playerIndex].first.setRotation(originalOrientation);
-				break;
+				playerCollided = true;
+				return true;
 			}
 		}
 	}
-	return score;
+	CollectMovingTargets(lines[playerIndex].first, sf::Vector2f(0.0f, 0.0f));
+	for (int index : movingCandidates) {
+		if (Physics::RectanglesIntersect(lines[playerIndex].first, lines[index].first)) {
+			playerCollided = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void LevelData::BuildKinematics()
+{
+	// Streamed targets only move inside the chunks that are loaded, a new episode starts all of them afresh
+	if (chunked && !residentChunks.empty()) {
+		parkedTargets.clear();
+		kinematics = TargetKinematics();
+		for (size_t i = 0; i < lines.size(); i++) {
+			if (lines[i].second == ShapeType::MovingTarget)
+				kinematics.AddTarget(lines, static_cast<int>(i), lineIds[i], StreamedMotion(lineIds[i]), nullptr);
+		}
+		kinematics.FinishUpdate(lines, residentMin, residentMax);
+	}
+	else
+		kinematics.Build(lines, motions, glm::vec2(0.0f, 0.0f), levelSize);
+}
+
+void LevelData::UpdateStreamedKinematics(size_t firstNewLine)
+{
+	// Targets of chunks that stay resident keep their velocity and path progress, the grid is rebuilt
+	// for the new bounds and only the targets of the chunks that came or went are added or removed
+	droppedTargets.clear();
+	kinematics.BeginUpdate(lines, lineIds, droppedTargets);
+	for (auto& dropped : droppedTargets)
+		parkedTargets[dropped.first] = dropped.second;
+	for (size_t i = firstNewLine; i < lines.size(); i++) {
+		if (lines[i].second != ShapeType::MovingTarget)
+			continue;
+		auto parked = parkedTargets.find(lineIds[i]);
+		kinematics.AddTarget(lines, static_cast<int>(i), lineIds[i], StreamedMotion(lineIds[i]), parked != parkedTargets.end() ? &parked->second : nullptr);
+		if (parked != parkedTargets.end())
+			parkedTargets.erase(parked);
+	}
+	kinematics.FinishUpdate(lines, residentMin, residentMax);
+	// Targets coming back are put where they were when their chunk was dropped
+	kinematics.Apply(lines);
+}
+
+TargetMotion LevelData::StreamedMotion(uint64_t id) const
+{
+	// Chunks store a motion for every moving target, files written before that let all of them bounce
+	std::shared_ptr<const Chunk> chunk = chunkCache->Get(*chunked, static_cast<int>(id >> 32));
+	int index = static_cast<int>(id & 0xffffffffull);
+	for (auto& motion : chunk->motions) {
+		if (motion.target == index)
+			return motion;
+	}
+	return TargetKinematics::DefaultMotion(id);
+}
+
+void LevelData::CollectMovingTargets(const sf::RectangleShape& shape, sf::Vector2f displacement)
+{
+	movingCandidates.clear();
+	if (!kinematics.IsActive()) {
+		return;
+	}
+	// Box around the shape and everywhere the displacement can take it
+	sf::FloatRect bounds = shape.getGlobalBounds();
+	glm::vec2 low(bounds.left + std::min(0.0f, displacement.x), bounds.top + std::min(0.0f, displacement.y));
+	glm::vec2 high(bounds.left + bounds.width + std::max(0.0f, displacement.x), bounds.top + bounds.height + std::max(0.0f, displacement.y));
+	kinematics.QueryBox(low, high, movingCandidates);
+}
+
+bool LevelData::PlayerClearOfWalls(float distance)
+{
+	if (!useDistanceField || !distanceField.IsBaked() || chunked) {
+		return false;
+	}
+	// O(1) lookup: the player cannot reach any wall if its bounding circle plus the move fits in the clearance
+	const sf::RectangleShape& player = lines[playerIndex].first;
+	glm::vec2 center(player.getPosition().x, player.getPosition().y);
+	float radius = glm::length(glm::vec2(player.getSize().x, player.getSize().y)) * 0.5f;
+	return distanceField.Clearance(center) > radius + distance + collisionSkin;
 }
 
 void LevelData::PlayerDirection()
@@ -540,16 +1112,33 @@ void LevelData::PlayerDirection()
 	playerDirection.setRotation(angleDegrees);
 }
 
+int LevelData::CountTargets()
+{
+	// Most targets of a streamed level are not loaded
+	if (chunked) {
+		return chunked->targetCount - static_cast<int>(removedShapes.size());
+	}
+	return static_cast<int>(std::count_if(lines.begin(), lines.end(), [](const auto& pair) {
+		return pair.second == ShapeType::StaticTarget || pair.second == ShapeType::MovingTarget;
+		}));
+}
+
 float LevelData::CheckForWinLose(float dt)
 {
-	if (FindFirstEnemyIntex() == -1) {
+	bool progress = stepProgress;
+	bool pinned = stepActors > 0 && stepPinned == stepActors;
+	stepProgress = false;
+	if (CountTargets() == 0) {
 		runSimulation = false;
+		episodeEnd = EpisodeEnd::Won;
 		return winReward;
 	}
 	timer += dt;
-	if (timer == simulationDeadline) {
+	// Running out of budget is not a state of the level, the step keeps its usual reward
+	EpisodeEnd end = runSimulation ? terminationMonitor.Step(termination, dt, progress, pinned) : EpisodeEnd::None;
+	if (end != EpisodeEnd::None) {
 		runSimulation = false;
-		return loseReward;
+		episodeEnd = end;
 	}
 	return -timer*timeMultiplier;
 }
@@ -563,26 +1152,68 @@ float LevelData::CheckTarget()
 			break;
 		}
 		case ShapeType::StaticTarget: {
+			stepProgress = true;
 			lines.erase(lines.begin() + lastTargetIndex);
-			playerIndex = FindPlayerIndex();
+			LineErased(lastTargetIndex);
 			return hitStaticTargetReward;
 			break;
 		}
 		case ShapeType::MovingTarget: {
+			stepProgress = true;
 			lines.erase(lines.begin() + lastTargetIndex);
-			playerIndex = FindPlayerIndex();
+			LineErased(lastTargetIndex);
 			return hitMovingTargetReward;
 			break;
 		}
+		case ShapeType::Player: {
+			// Another agent, it leaves the world and gets its penalty with this step's rewards
+			stepProgress = true;
+			auto shot = std::find(agentLines.begin(), agentLines.end(), lastTargetIndex);
+			if (shot != agentLines.end()) {
+				agentPenalties[std::distance(agentLines.begin(), shot)] += shotByAgentReward;
+			}
+			lines.erase(lines.begin() + lastTargetIndex);
+			LineErased(lastTargetIndex);
+			return hitAgentReward;
+			break;
+		}
 		default: {
 			return missTargetReward;
 			break;
 		}
 		}
 	}
+	// The distance field reports wall hits without an index into lines
+	return rayHitWall ? missTargetReward : 0.0f;
 }
 
 bool LevelData::IsTraining()
 {
 	return useAI;
 }
+
+void LevelData::LineErased(int line)
+{
+	if (chunked) {
+		if (lineIds[line] != persistentShape)
+			removedShapes.insert(lineIds[line]);
+		lineIds.erase(lineIds.begin() + line);
+	}
+	kinematics.LineErased(line);
+	for (auto& agentLine : agentLines) {
+		if (agentLine == line)
+			agentLine = -1;
+		else if (agentLine > line)
+			agentLine--;
+	}
+	if (playerIndex > line) {
+		playerIndex--;
+	}
+}
+
+void LevelData::FollowPlayer(sf::RenderTarget& target)
+{
+	sf::View view = target.getView();
+	view.setCenter(lines[playerIndex].first.getPosition());
+	target.setView(view);
+}
@@ -4,6 +4,9 @@
 #include "vector"
 #include "utility"
 #include "string"
+#include "memory"
+#include "unordered_map"
+#include "unordered_set"
 #include "ImGui/imgui-SFML.h"
 #include "ImGui/imgui.h"
 #define GLM_ENABLE_EXPERIMENTAL
@@ -13,6 +16,10 @@
 #include "cereal/types/utility.hpp"
 
 #include "EnviromentObjectsType.h"
+#include "DistanceField.h"
+#include "ChunkedLevel.h"
+#include "TargetKinematics.h"
+#include "Termination.h"
 
 
 
@@ -33,10 +40,32 @@ public:
 	// Serialization
 	void SaveData(const std::string& filename);
 	void LoadData(const std::string& filename);
+	void BakeDistanceField(const std::string& filename);
+	// Turns this level into a copy of other in place, assigning into the vectors it already has instead of
+	// allocating new ones. The distance field and the chunk data are shared, not copied.
+	void ResetFrom(const LevelData& other);
+	// Level names ending in ".chunks" are chunked levels, only the chunks around the players are in lines
+	void SaveChunked(const std::string& filename);
+	bool IsStreaming();
 	// Core Functions
-	Optimize_Step_return Update(float dt,Action action);
+	Simulation_Step_return Update(float dt,Action action);
 	void Draw(sf::RenderWindow& window);
+	void DrawScene(sf::RenderTarget& target);
+	// Everything DrawScene draws, for spectators that only render the level. Returns the shapes written.
+	size_t SnapshotShapes(ShapeSnapshot* shapes, size_t capacity) const;
+	void ApplySnapshot(const ShapeSnapshot* shapes, size_t count);
 	bool IsSimulationRunning();
+	void StartSimulation(bool ai);
+	// Budgets and early cutoffs of the following episodes
+	void SetTermination(const TerminationConfig& config);
+	// Why the last episode ended, None while it runs or when it was stopped by hand
+	EpisodeEnd GetEpisodeEnd();
+	// Multi-agent: every Player shape is an agent and all of them act in the same world in one step.
+	// actions, rewards and terminated hold CountAgents() entries, an agent that was shot stays terminated.
+	int CountAgents();
+	void UpdateAgents(float dt, const Action* actions, float* rewards, bool* terminated);
+	// The level with only this agent's direction marker, so it can tell itself apart from the others
+	void DrawAgentScene(sf::RenderTarget& target, int agent);
 	// Level Editing Functions
 	void PreviewMod(sf::RenderWindow& window);
 	void SetPreviewLineStart(glm::vec2 start);
@@ -45,6 +74,7 @@ public:
 	void ResetPreviewLine();
 	int FindPlayerIndex();
 	int FindFirstEnemyIntex();
+	int CountTargets();
 	// ImGui Functions
 	void SelectModWindow();
 	void SaveLoadWindow();
@@ -55,10 +85,27 @@ public:
 	void PlayerRaycast();
 	float PlayerMovement(float dt);
 	float AIMovement(float dt, Action action);
+	bool MovePlayer(sf::Vector2f displacement);
+	bool PlayerRotationCollides();
+	bool PlayerClearOfWalls(float distance);
+	void BuildKinematics();
+	// Streamed targets of the lines from firstNewLine on join the kinematics, those of dropped chunks are parked
+	void UpdateStreamedKinematics(size_t firstNewLine);
+	TargetMotion StreamedMotion(uint64_t id) const;
+	// Moving targets near the player, only filled while the kinematics own them
+	void CollectMovingTargets(const sf::RectangleShape& shape, sf::Vector2f displacement);
 	void PlayerDirection();
 	float CheckForWinLose(float dt);
 	//score
 	float CheckTarget();
+	// Keeps every stored line index valid after lines.erase(lines.begin() + line)
+	void LineErased(int line);
+	void CollectAgents();
+	void LoadChunked(const std::string& filename);
+	// Swaps chunks in and out when a player moved far enough
+	void StreamChunks();
+	// Centers the view on the player, streamed levels are larger than the window
+	void FollowPlayer(sf::RenderTarget& target);
 	bool IsTraining();
 	sf::Image prevStep;
 	std::string lastLoadedFile = "";
@@ -80,15 +127,24 @@ private:
 	// Game related variable
 	bool runSimulation = false;
 	int lastTargetIndex = -1;
+	bool rayHitWall = false;
 	int playerIndex = -1;
 	const float movementValue = 500.0f;
 	const float rotationForce = 100.0f;
+	const float collisionSkin = 0.01f;
+	const int maxSlideIterations = 3;
 	sf::RectangleShape playerDirection;
 
 	//Debug
 	bool debugLine = false;
 	float timer = 0.0f;
-	float simulationDeadline = 60.0f;
+	//Episode end
+	TerminationConfig termination;
+	TerminationMonitor terminationMonitor;
+	EpisodeEnd episodeEnd = EpisodeEnd::None;
+	bool stepProgress = false;  // A target or agent was hit during this world step
+	bool playerCollided = false;
+	int stepActors = 0, stepPinned = 0;
 	//Rewards
 	float winReward = 1000.0f;
 	float loseReward = -1000.0f;
@@ -99,8 +155,33 @@ private:
 	float hitStaticTargetReward = 100.0f;
 	float hitMovingTargetReward = 200.0f;
 	float missTargetReward = -10.0f;
+	float hitAgentReward = 300.0f;
+	float shotByAgentReward = -500.0f;
 	//Training
 	bool useAI = false;
+	//Agents, the line of each one or -1 once it has been shot
+	std::vector<int> agentLines;
+	std::vector<float> agentPenalties;
+	//Static geometry
+	DistanceField distanceField;
+	bool useDistanceField = false;
+	float distanceFieldCellSize = 4.0f;
+	//Moving targets
+	TargetKinematics kinematics;
+	std::vector<TargetMotion> motions;
+	std::vector<int> movingCandidates;
+	glm::vec2 levelSize = glm::vec2(800.0f, 800.0f);
+	//Streaming, shared between copies of a level so environments of one process read each chunk once
+	std::shared_ptr<const ChunkedLevel> chunked;
+	std::shared_ptr<ChunkCache> chunkCache;
+	std::vector<int> residentChunks, wantedChunks;
+	std::vector<uint64_t> lineIds;             // Chunk and position in it of every line
+	std::unordered_set<uint64_t> removedShapes;  // Targets shot this episode, never streamed in again
+	std::unordered_map<uint64_t, TargetState> parkedTargets;  // Moving targets of dropped chunks, by line id
+	std::vector<std::pair<uint64_t, TargetState>> droppedTargets;
+	glm::vec2 residentMin = glm::vec2(0.0f), residentMax = glm::vec2(0.0f);
+	float streamRadius = 700.0f;  // Around each player, covers the observation and the shooting ray
+	const float chunkSize = 400.0f;
 };
 
 namespace sf {
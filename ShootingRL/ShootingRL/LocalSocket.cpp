@@ -0,0 +1,183 @@
+#include "LocalSocket.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	bool fillAddress(const std::string& path, sockaddr_un& address)
+	{
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+			return false;
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+		return true;
+	}
+
+	bool startup()
+	{
+#ifdef _WIN32
+		static std::once_flag once;
+		static bool started = false;
+		std::call_once(once, []() {
+			WSADATA data;
+			started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		});
+		return started;
+#else
+		return true;
+#endif
+	}
+
+	void removeFile(const std::string& path)
+	{
+#ifdef _WIN32
+		DeleteFileA(path.c_str());
+#else
+		unlink(path.c_str());
+#endif
+	}
+}
+
+LocalSocket::~LocalSocket()
+{
+	Close();
+}
+
+LocalSocket::LocalSocket(LocalSocket&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+LocalSocket& LocalSocket::operator=(LocalSocket&& other) noexcept
+{
+	if (this != &other) {
+		Close();
+		handle = other.handle;
+		path = std::move(other.path);
+		other.handle = invalidHandle;
+		other.path.clear();
+	}
+	return *this;
+}
+
+bool LocalSocket::Listen(const std::string& path, int backlog)
+{
+	Close();
+	sockaddr_un address;
+	if (!startup() || !fillAddress(path, address))
+		return false;
+	handle = static_cast<Handle>(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (handle == invalidHandle)
+		return false;
+
+	removeFile(path);
+	if (bind(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(handle, backlog) != 0) {
+		Close();
+		return false;
+	}
+	this->path = path;
+	return true;
+}
+
+LocalSocket LocalSocket::Accept()
+{
+	LocalSocket client;
+	if (handle != invalidHandle)
+		client.handle = static_cast<Handle>(accept(handle, nullptr, nullptr));
+	return client;
+}
+
+bool LocalSocket::Connect(const std::string& path)
+{
+	Close();
+	sockaddr_un address;
+	if (!startup() || !fillAddress(path, address))
+		return false;
+	handle = static_cast<Handle>(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (handle == invalidHandle)
+		return false;
+	if (connect(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool LocalSocket::SendAll(const void* data, size_t size)
+{
+	const char* bytes = static_cast<const char*>(data);
+	while (size > 0) {
+#ifdef _WIN32
+		int sent = send(handle, bytes, static_cast<int>(std::min<size_t>(size, 1 << 30)), 0);
+#else
+		ssize_t sent = send(handle, bytes, size, MSG_NOSIGNAL);
+#endif
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+bool LocalSocket::ReceiveAll(void* data, size_t size)
+{
+	char* bytes = static_cast<char*>(data);
+	while (size > 0) {
+#ifdef _WIN32
+		int received = recv(handle, bytes, static_cast<int>(std::min<size_t>(size, 1 << 30)), 0);
+#else
+		ssize_t received = recv(handle, bytes, size, 0);
+#endif
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= static_cast<size_t>(received);
+	}
+	return true;
+}
+
+void LocalSocket::Shutdown()
+{
+	if (handle == invalidHandle)
+		return;
+#ifdef _WIN32
+	shutdown(handle, SD_BOTH);
+#else
+	shutdown(handle, SHUT_RDWR);
+#endif
+}
+
+void LocalSocket::Close()
+{
+	if (handle != invalidHandle) {
+#ifdef _WIN32
+		closesocket(handle);
+#else
+		close(handle);
+#endif
+	}
+	if (!path.empty())
+		removeFile(path);
+	handle = invalidHandle;
+	path.clear();
+}
+
+bool LocalSocket::IsOpen() const
+{
+	return handle != invalidHandle;
+}
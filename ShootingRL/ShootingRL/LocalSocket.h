@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Blocking stream socket on a Unix domain socket path, AF_UNIX is also available on Windows 10 and later
+class LocalSocket
+{
+public:
+	LocalSocket() {};
+	~LocalSocket();
+	LocalSocket(const LocalSocket&) = delete;
+	LocalSocket& operator=(const LocalSocket&) = delete;
+	LocalSocket(LocalSocket&& other) noexcept;
+	LocalSocket& operator=(LocalSocket&& other) noexcept;
+
+	// Removes a stale socket file left by an earlier run before binding
+	bool Listen(const std::string& path, int backlog = 64);
+	// Invalid socket once the listener was closed
+	LocalSocket Accept();
+	bool Connect(const std::string& path);
+	// Both return false once the peer is gone
+	bool SendAll(const void* data, size_t size);
+	bool ReceiveAll(void* data, size_t size);
+	// Disables further sends and receives so a thread blocked on this socket returns
+	void Shutdown();
+	void Close();
+	bool IsOpen() const;
+
+private:
+#ifdef _WIN32
+	using Handle = uintptr_t;  // SOCKET
+#else
+	using Handle = int;
+#endif
+	static constexpr Handle invalidHandle = static_cast<Handle>(-1);  // INVALID_SOCKET on Windows
+
+	Handle handle = invalidHandle;
+	std::string path;  // Set on the listening side, unlinked on close
+};
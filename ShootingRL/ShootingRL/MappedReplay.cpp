@@ -0,0 +1,176 @@
+#include "MappedReplay.h"
+#include "DQN.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+namespace {
+    const uint32_t mappedReplayMagic = 0x4d525031;  // "MRP1"
+    const uint32_t mappedReplayVersion = 1;
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+MappedReplay::~MappedReplay()
+{
+    if (header != nullptr)
+        sync();
+}
+
+bool MappedReplay::open(const std::string& path, uint64_t capacity, const ObservationSpec& observation, uint64_t max_bytes)
+{
+    const double gigabyte = 1024.0 * 1024.0 * 1024.0;
+    uint64_t observation_bytes = static_cast<uint64_t>(observation.channels) * observation.height * observation.width;
+    slot_bytes = alignUp(sizeof(Slot) + 2 * observation_bytes, 64);
+    size_t header_bytes = alignUp(sizeof(Header), 4096);
+
+    uint64_t budget_slots = max_bytes > header_bytes ? (max_bytes - header_bytes) / slot_bytes : 0;
+    if (budget_slots == 0)
+    {
+        std::cout << "A replay budget of " << max_bytes / gigabyte << " GB can't hold a single transition of "
+            << slot_bytes / gigabyte << " GB.\n";
+        return false;
+    }
+    if (capacity > budget_slots)
+    {
+        std::cout << "The replay file " << path << " holds " << budget_slots << " transitions instead of " << capacity
+            << " to stay within " << max_bytes / gigabyte << " GB.\n";
+        capacity = budget_slots;
+    }
+
+    // The file is sparse and fills up as the ring does, but it is refused up front when the disk can't hold it
+    // full, a run must not fail hours in when the ring wraps
+    uint64_t file_bytes = header_bytes + slot_bytes * capacity;
+    std::error_code error;
+    std::filesystem::path file(path);
+    uint64_t current = std::filesystem::file_size(file, error);
+    if (error)
+        current = 0;
+    std::filesystem::space_info space = std::filesystem::space(file.has_parent_path() ? file.parent_path() : std::filesystem::current_path(), error);
+    if (!error && file_bytes > current && file_bytes - current > space.available)
+    {
+        std::cout << "The replay file " << path << " needs " << file_bytes / gigabyte << " GB for " << capacity
+            << " transitions, only " << space.available / gigabyte << " GB are free. Lower the replay budget.\n";
+        return false;
+    }
+
+    bool existed = false;
+    if (!memory.MapFile(path, file_bytes, existed))
+        return false;
+
+    uint8_t* base = static_cast<uint8_t*>(memory.Data());
+    header = reinterpret_cast<Header*>(base);
+    slots = base + header_bytes;
+
+    resumed = existed && header->magic == mappedReplayMagic && header->version == mappedReplayVersion &&
+        header->capacity == capacity && header->observation_bytes == observation_bytes &&
+        header->channels == observation.channels && header->height == observation.height && header->width == observation.width &&
+        header->cursor < header->capacity && header->count <= header->capacity;
+    if (existed && !resumed)
+        std::cout << "The replay file " << path << " was written with other settings or is damaged, starting it over.\n";
+
+    if (resumed)
+    {
+        std::istringstream state(std::string(header->rng_state, strnlen(header->rng_state, sizeof(header->rng_state))));
+        state >> rng;
+    }
+    else
+    {
+        std::memset(header, 0, sizeof(Header));
+        header->magic = mappedReplayMagic;
+        header->version = mappedReplayVersion;
+        header->capacity = capacity;
+        header->observation_bytes = observation_bytes;
+        header->channels = observation.channels;
+        header->height = observation.height;
+        header->width = observation.width;
+        rng.seed(std::random_device{}());
+        sync();
+    }
+    return true;
+}
+
+void MappedReplay::add(const Optimize_Step_return& experience)
+{
+    Slot* slot = getSlot(header->cursor);
+    slot->action = static_cast<int32_t>(experience.action);
+    slot->reward = experience.reward;
+    slot->terminated = experience.terminated;
+    slot->truncated = experience.truncated;
+
+    // Observations are [0, 1] floats made from 8 bit pixels, store them back as bytes
+    uint8_t* pixels = reinterpret_cast<uint8_t*>(slot + 1);
+    torch::Tensor state = experience.state.mul(255).round_().to(torch::kByte).contiguous();
+    torch::Tensor next_state = experience.next_state.mul(255).round_().to(torch::kByte).contiguous();
+    std::memcpy(pixels, state.data_ptr<uint8_t>(), header->observation_bytes);
+    std::memcpy(pixels + header->observation_bytes, next_state.data_ptr<uint8_t>(), header->observation_bytes);
+
+    header->cursor = (header->cursor + 1) % header->capacity;
+    header->count = std::min(header->count + 1, header->capacity);
+}
+
+Tensor_step_return MappedReplay::sample(int batch_size)
+{
+    int count = static_cast<int>(std::min<uint64_t>(batch_size, header->count));
+    torch::Tensor states = torch::empty({ count, header->channels, header->height, header->width }, torch::kByte);
+    torch::Tensor next_states = torch::empty_like(states);
+    torch::Tensor actions = torch::empty({ count, 1 }, torch::kFloat);
+    torch::Tensor rewards = torch::empty({ count, 1 }, torch::kFloat);
+    torch::Tensor dones = torch::empty({ count, 1 }, torch::kFloat);
+
+    std::uniform_int_distribution<uint64_t> pick(0, header->count > 0 ? header->count - 1 : 0);
+    for (int i = 0; i < count; i++)
+    {
+        Slot* slot = getSlot(pick(rng));
+        const uint8_t* pixels = reinterpret_cast<const uint8_t*>(slot + 1);
+        std::memcpy(states[i].data_ptr<uint8_t>(), pixels, header->observation_bytes);
+        std::memcpy(next_states[i].data_ptr<uint8_t>(), pixels + header->observation_bytes, header->observation_bytes);
+        actions.data_ptr<float>()[i] = static_cast<float>(slot->action);
+        rewards.data_ptr<float>()[i] = slot->reward;
+        dones.data_ptr<float>()[i] = static_cast<float>(slot->terminated);
+    }
+
+    Tensor_step_return tensor;
+    tensor.states = states.to(torch::kFloat).div_(255);
+    tensor.next_states = next_states.to(torch::kFloat).div_(255);
+    tensor.actions = actions;
+    tensor.rewards = rewards;
+    tensor.dones = dones;
+    return tensor;
+}
+
+void MappedReplay::sync()
+{
+    storeRngState();
+    flush();
+}
+
+void MappedReplay::storeRngState()
+{
+    std::ostringstream state;
+    state << rng;
+    std::string text = state.str();
+    std::memset(header->rng_state, 0, sizeof(header->rng_state));
+    std::memcpy(header->rng_state, text.data(), std::min(text.size(), sizeof(header->rng_state) - 1));
+}
+
+void MappedReplay::flush()
+{
+    memory.Flush();
+}
+
+uint64_t MappedReplay::size() const
+{
+    return header == nullptr ? 0 : header->count;
+}
+
+MappedReplay::Slot* MappedReplay::getSlot(uint64_t index)
+{
+    return reinterpret_cast<Slot*>(slots + index * slot_bytes);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "SharedMemory.h"
+#include "EnviromentObjectsType.h"
+
+struct Tensor_step_return;
+struct Optimize_Step_return;
+struct ObservationSpec;
+
+// Replay ring stored in a memory-mapped file. Transitions are kept as 8 bit pixels and the header holds the
+// write cursor, capacity and sampling RNG, so a resumed run reopens the file and keeps training right away.
+// A transition of two 800x800 RGBA frames takes about 5 MB, so the ring holds as many as fit in a byte
+// budget rather than the in-memory buffer size. Writes only touch mapped pages, the page cache takes care
+// of getting them to disk.
+class MappedReplay
+{
+public:
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t capacity;
+		uint64_t observation_bytes;
+		int32_t channels, height, width;
+		uint64_t cursor;  // Next slot to write
+		uint64_t count;   // Filled slots, at most capacity
+		char rng_state[8192];
+	};
+
+	struct Slot
+	{
+		int32_t action;
+		float reward;
+		uint8_t terminated;
+		uint8_t truncated;
+		// Followed by the state and next state pixels
+	};
+
+	MappedReplay() {};
+	~MappedReplay();
+	// capacity is lowered to the transitions that fit in max_bytes. Fails when the disk can't hold the file.
+	bool open(const std::string& path, uint64_t capacity, const ObservationSpec& observation, uint64_t max_bytes);
+	void add(const Optimize_Step_return& experience);
+	Tensor_step_return sample(int batch_size);
+	// Stores the RNG state in the header and flushes the mapping, called when checkpointing
+	void sync();
+	// The two halves of sync. The RNG state has to be stored by the thread that samples, flush may run
+	// on another thread while experiences are added.
+	void storeRngState();
+	void flush();
+	uint64_t size() const;
+	bool resumed = false;
+
+private:
+	Slot* getSlot(uint64_t index);
+
+	SharedMemory memory;
+	Header* header = nullptr;
+	uint8_t* slots = nullptr;
+	uint64_t slot_bytes = 0;
+	std::mt19937 rng;
+};
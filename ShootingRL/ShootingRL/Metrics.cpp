@@ -0,0 +1,460 @@
+#include "Metrics.h"
+#include "SeriesStore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+namespace {
+    const uint32_t logMagic = 0x31474C4D;  // "MLG1"
+    const size_t drainBatch = 1024;
+
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<uint64_t> nextInstance{ 1 };
+
+    // One row of the binary log, the file starts with logMagic and the row size
+    struct MetricLogRow
+    {
+        double seconds;
+        uint64_t step;
+        uint32_t metric;
+        uint32_t reserved;
+        uint64_t count;
+        uint64_t interval_count;
+        double last;
+        double ema;
+        double window_mean;
+        double min;
+        double max;
+        double p10;
+        double p50;
+        double p90;
+    };
+
+    uint32_t roundUpPowerOfTwo(uint32_t value)
+    {
+        uint32_t power = 1;
+        while (power < value)
+            power <<= 1;
+        return power;
+    }
+}
+
+const char* metricName(Metric metric)
+{
+    switch (metric)
+    {
+    case Metric::EpisodeReturn: return "episode_return";
+    case Metric::EpisodeLength: return "episode_length";
+    case Metric::Loss: return "loss";
+    case Metric::Epsilon: return "epsilon";
+    case Metric::ReplayFill: return "replay_fill";
+    case Metric::StepsPerSecond: return "steps_per_second";
+    case Metric::UpdatesPerSecond: return "updates_per_second";
+    case Metric::ActorAgreement: return "actor_agreement";
+    default: return "unknown";
+    }
+}
+
+size_t MetricRing::BytesFor(uint32_t capacity)
+{
+    return sizeof(MetricRing) + sizeof(MetricRecord) * roundUpPowerOfTwo(std::max<uint32_t>(capacity, 2));
+}
+
+MetricRing* MetricRing::Construct(void* memory, uint32_t capacity)
+{
+    MetricRing* ring = new (memory) MetricRing();
+    ring->head.store(0);
+    ring->tail.store(0);
+    ring->dropped.store(0);
+    ring->capacity = roundUpPowerOfTwo(std::max<uint32_t>(capacity, 2));
+    return ring;
+}
+
+MetricRecord* MetricRing::records()
+{
+    return reinterpret_cast<MetricRecord*>(this + 1);
+}
+
+bool MetricRing::push(const MetricRecord& record)
+{
+    uint64_t position = head.load(std::memory_order_relaxed);
+    if (position - tail.load(std::memory_order_acquire) >= capacity)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    records()[position & (capacity - 1)] = record;
+    head.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+size_t MetricRing::drain(std::vector<MetricRecord>& out, size_t max)
+{
+    uint64_t position = tail.load(std::memory_order_relaxed);
+    uint64_t available = head.load(std::memory_order_acquire) - position;
+    size_t count = static_cast<size_t>(std::min<uint64_t>(available, max));
+    for (size_t i = 0; i < count; i++)
+        out.push_back(records()[(position + i) & (capacity - 1)]);
+    tail.store(position + count, std::memory_order_release);
+    return count;
+}
+
+P2Quantile::P2Quantile(double quantile)
+    : quantile(quantile)
+{
+    reset();
+}
+
+void P2Quantile::reset()
+{
+    count = 0;
+    for (int i = 0; i < 5; i++)
+    {
+        heights[i] = 0.0;
+        positions[i] = i;
+    }
+    desired[0] = 0.0;
+    desired[1] = 2.0 * quantile;
+    desired[2] = 4.0 * quantile;
+    desired[3] = 2.0 + 2.0 * quantile;
+    desired[4] = 4.0;
+    increments[0] = 0.0;
+    increments[1] = quantile / 2.0;
+    increments[2] = quantile;
+    increments[3] = (1.0 + quantile) / 2.0;
+    increments[4] = 1.0;
+}
+
+void P2Quantile::add(double x)
+{
+    // The first five samples are kept as they are and become the initial markers
+    if (count < 5)
+    {
+        heights[count++] = x;
+        if (count == 5)
+            std::sort(heights, heights + 5);
+        return;
+    }
+    count++;
+
+    int cell;
+    if (x < heights[0])
+    {
+        heights[0] = x;
+        cell = 0;
+    }
+    else if (x >= heights[4])
+    {
+        heights[4] = x;
+        cell = 3;
+    }
+    else
+    {
+        cell = 0;
+        while (cell < 3 && x >= heights[cell + 1])
+            cell++;
+    }
+
+    for (int i = cell + 1; i < 5; i++)
+        positions[i] += 1.0;
+    for (int i = 0; i < 5; i++)
+        desired[i] += increments[i];
+
+    // Inner markers that drifted off their desired position move by one
+    for (int i = 1; i < 4; i++)
+    {
+        double drift = desired[i] - positions[i];
+        if ((drift >= 1.0 && positions[i + 1] - positions[i] > 1.0) || (drift <= -1.0 && positions[i - 1] - positions[i] < -1.0))
+        {
+            int direction = drift > 0.0 ? 1 : -1;
+            double candidate = parabolic(i, direction);
+            if (heights[i - 1] < candidate && candidate < heights[i + 1])
+                heights[i] = candidate;
+            else
+                heights[i] = linear(i, direction);
+            positions[i] += direction;
+        }
+    }
+}
+
+double P2Quantile::parabolic(int i, double d) const
+{
+    return heights[i] + d / (positions[i + 1] - positions[i - 1]) *
+        ((positions[i] - positions[i - 1] + d) * (heights[i + 1] - heights[i]) / (positions[i + 1] - positions[i]) +
+            (positions[i + 1] - positions[i] - d) * (heights[i] - heights[i - 1]) / (positions[i] - positions[i - 1]));
+}
+
+double P2Quantile::linear(int i, int d) const
+{
+    return heights[i] + d * (heights[i + d] - heights[i]) / (positions[i + d] - positions[i]);
+}
+
+double P2Quantile::value() const
+{
+    if (count == 0)
+        return 0.0;
+    if (count <= 5)
+    {
+        // Exact on the few samples seen so far
+        double sorted[5];
+        std::copy(heights, heights + count, sorted);
+        std::sort(sorted, sorted + count);
+        size_t index = static_cast<size_t>(std::min<double>(count - 1.0, std::floor(quantile * count)));
+        return sorted[index];
+    }
+    return heights[2];
+}
+
+MetricsPipeline::MetricsPipeline()
+    : instance(nextInstance++)
+{
+}
+
+MetricsPipeline::~MetricsPipeline()
+{
+    stop();
+}
+
+void MetricsPipeline::start(const MetricsConfig& config)
+{
+    stop();
+    this->config = config;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        for (auto& accumulator : accumulators)
+        {
+            accumulator.window.assign(std::max(1, config.window_size), 0.0);
+            accumulator.window_next = 0;
+            accumulator.window_filled = 0;
+            accumulator.window_sum = 0.0;
+        }
+    }
+
+    if (!config.path.empty())
+    {
+        bool exists = std::ifstream(config.path + ".csv").good();
+        csv.open(config.path + ".csv", std::ios::app);
+        if (!exists)
+            csv << "seconds,step,metric,count,interval_count,last,ema,window_mean,min,max,p10,p50,p90\n";
+        // tellp is unreliable on streams opened for appending, the size is taken before opening
+        std::ifstream existing(config.path + ".bin", std::ios::binary | std::ios::ate);
+        bool empty = !existing.is_open() || existing.tellg() <= 0;
+        existing.close();
+        binary.open(config.path + ".bin", std::ios::binary | std::ios::app);
+        if (empty)
+        {
+            uint32_t header[2] = { logMagic, static_cast<uint32_t>(sizeof(MetricLogRow)) };
+            binary.write(reinterpret_cast<const char*>(header), sizeof(header));
+        }
+        if (!csv.is_open() || !binary.is_open())
+            std::cout << "Failed to open the metric logs at " << config.path << "\n";
+    }
+
+    started = Clock::now();
+    stopping = false;
+    aggregator = std::thread(&MetricsPipeline::aggregatorLoop, this);
+}
+
+void MetricsPipeline::stop()
+{
+    if (!aggregator.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    aggregator.join();
+    csv.close();
+    binary.close();
+}
+
+MetricRing* MetricsPipeline::threadRing()
+{
+    // Rings stay registered until the pipeline goes away, a thread that exits leaves its ring behind
+    thread_local uint64_t owner = 0;
+    thread_local MetricRing* ring = nullptr;
+    if (owner == instance)
+        return ring;
+
+    std::lock_guard<std::mutex> lock(sources_mutex);
+    auto memory = std::make_unique<uint8_t[]>(MetricRing::BytesFor(config.ring_capacity));
+    ring = MetricRing::Construct(memory.get(), config.ring_capacity);
+    owned_rings.push_back(std::move(memory));
+    sources.push_back({ ring, static_cast<uint16_t>(owned_rings.size() - 1) });
+    owner = instance;
+    return ring;
+}
+
+void MetricsPipeline::push(Metric metric, uint64_t step, double value)
+{
+    threadRing()->push({ step, value, static_cast<uint16_t>(metric), 0, 0 });
+}
+
+void MetricsPipeline::attach(MetricRing* ring, uint16_t source)
+{
+    std::lock_guard<std::mutex> lock(sources_mutex);
+    sources.push_back({ ring, source });
+}
+
+MetricStats MetricsPipeline::stats(Metric metric)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return accumulators[static_cast<size_t>(metric)].stats;
+}
+
+uint64_t MetricsPipeline::dropped()
+{
+    std::lock_guard<std::mutex> lock(sources_mutex);
+    uint64_t total = 0;
+    for (auto& source : sources)
+        total += source.ring->dropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+void MetricsPipeline::setSeries(SeriesStore* store)
+{
+    series.store(store);
+}
+
+void MetricsPipeline::drainAll(std::vector<MetricRecord>& scratch)
+{
+    scratch.clear();
+    {
+        std::lock_guard<std::mutex> lock(sources_mutex);
+        for (auto& source : sources)
+        {
+            size_t first = scratch.size();
+            while (source.ring->drain(scratch, drainBatch) == drainBatch) {}
+            for (size_t i = first; i < scratch.size(); i++)
+                scratch[i].source = source.id;
+        }
+    }
+    if (scratch.empty())
+        return;
+    if (SeriesStore* store = series.load())
+        store->add(scratch);
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (auto& record : scratch)
+    {
+        if (record.metric >= static_cast<uint16_t>(Metric::Count))
+            continue;
+        Accumulator& accumulator = accumulators[record.metric];
+        MetricStats& stats = accumulator.stats;
+        double value = record.value;
+
+        stats.ema = stats.count == 0 ? value : stats.ema + config.ema_alpha * (value - stats.ema);
+        stats.min = stats.interval_count == 0 ? value : std::min(stats.min, value);
+        stats.max = stats.interval_count == 0 ? value : std::max(stats.max, value);
+        stats.count++;
+        stats.interval_count++;
+        stats.step = std::max(stats.step, record.step);
+        stats.last = value;
+
+        std::vector<double>& window = accumulator.window;
+        if (accumulator.window_filled == window.size())
+            accumulator.window_sum -= window[accumulator.window_next];
+        else
+            accumulator.window_filled++;
+        window[accumulator.window_next] = value;
+        accumulator.window_sum += value;
+        accumulator.window_next = (accumulator.window_next + 1) % window.size();
+        // Recomputed once per lap so the running sum cannot drift
+        if (accumulator.window_next == 0)
+        {
+            accumulator.window_sum = 0.0;
+            for (size_t i = 0; i < accumulator.window_filled; i++)
+                accumulator.window_sum += window[i];
+        }
+        stats.window_mean = accumulator.window_sum / accumulator.window_filled;
+
+        accumulator.p10.add(value);
+        accumulator.p50.add(value);
+        accumulator.p90.add(value);
+        stats.p10 = accumulator.p10.value();
+        stats.p50 = accumulator.p50.value();
+        stats.p90 = accumulator.p90.value();
+    }
+}
+
+void MetricsPipeline::flush(double seconds)
+{
+    // Rows are prepared under the lock, the files are written without it
+    std::vector<MetricLogRow> rows;
+    rows.reserve(static_cast<size_t>(Metric::Count));
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        for (size_t i = 0; i < static_cast<size_t>(Metric::Count); i++)
+        {
+            Accumulator& accumulator = accumulators[i];
+            MetricStats& stats = accumulator.stats;
+            if (stats.interval_count == 0)
+                continue;
+            rows.push_back({ seconds, stats.step, static_cast<uint32_t>(i), 0, stats.count, stats.interval_count,
+                stats.last, stats.ema, stats.window_mean, stats.min, stats.max, stats.p10, stats.p50, stats.p90 });
+            stats.interval_count = 0;
+            accumulator.p10.reset();
+            accumulator.p50.reset();
+            accumulator.p90.reset();
+        }
+    }
+    if (rows.empty())
+        return;
+
+    if (csv.is_open())
+    {
+        for (auto& row : rows)
+            csv << row.seconds << "," << row.step << "," << metricName(static_cast<Metric>(row.metric)) << "," << row.count << ","
+                << row.interval_count << "," << row.last << "," << row.ema << "," << row.window_mean << "," << row.min << ","
+                << row.max << "," << row.p10 << "," << row.p50 << "," << row.p90 << "\n";
+        csv.flush();
+    }
+    if (binary.is_open())
+    {
+        binary.write(reinterpret_cast<const char*>(rows.data()), rows.size() * sizeof(MetricLogRow));
+        binary.flush();
+    }
+
+    if (config.print)
+    {
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << "[" << std::setprecision(0) << seconds << "s]";
+        for (auto& row : rows)
+            line << std::setprecision(3) << " " << metricName(static_cast<Metric>(row.metric)) << " " << row.window_mean
+                << " (p50 " << row.p50 << ")";
+        std::cout << line.str() << "\n";
+    }
+}
+
+void MetricsPipeline::aggregatorLoop()
+{
+    std::vector<MetricRecord> scratch;
+    scratch.reserve(drainBatch);
+    Clock::time_point lastFlush = Clock::now();
+    for (;;)
+    {
+        bool finishing;
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(config.drain_interval_ms), [this] { return stopping; });
+            finishing = stopping;
+        }
+
+        drainAll(scratch);
+        Clock::time_point now = Clock::now();
+        if (finishing || now - lastFlush >= std::chrono::seconds(config.flush_every_seconds))
+        {
+            flush(std::chrono::duration<double>(now - started).count());
+            lastFlush = now;
+        }
+        if (finishing)
+            return;
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SeriesStore;
+
+enum class Metric : uint16_t
+{
+	EpisodeReturn,
+	EpisodeLength,
+	Loss,
+	Epsilon,
+	ReplayFill,         // Fraction of the replay capacity in use
+	StepsPerSecond,     // Environment transitions
+	UpdatesPerSecond,   // Learn steps
+	ActorAgreement,     // Share of actions the reduced precision actor copy picks like the learner network
+	Count
+};
+
+const char* metricName(Metric metric);
+
+// Fixed-size record pushed by the training threads, 24 bytes
+struct MetricRecord
+{
+	uint64_t step;
+	double value;
+	uint16_t metric;
+	uint16_t source;   // Producer ring, actor processes get their own ids
+	uint32_t reserved;
+};
+
+// Single producer, single consumer ring of records. It only holds atomics and plain data and is
+// placed into caller supplied memory, so actor processes can keep theirs in the shared replay segment.
+// A full ring drops the record instead of blocking the producer.
+struct MetricRing
+{
+	std::atomic<uint64_t> head;     // Next record the producer writes
+	uint8_t padding[64 - sizeof(uint64_t)];
+	std::atomic<uint64_t> tail;     // Next record the consumer reads
+	std::atomic<uint64_t> dropped;
+	uint32_t capacity;              // Power of two
+
+	static size_t BytesFor(uint32_t capacity);
+	// capacity is rounded up to a power of two
+	static MetricRing* Construct(void* memory, uint32_t capacity);
+	bool push(const MetricRecord& record);
+	// Appends up to max records to out, returns how many were taken
+	size_t drain(std::vector<MetricRecord>& out, size_t max);
+
+private:
+	MetricRecord* records();
+};
+
+// Quantile estimate of a stream in constant memory (P-square algorithm, Jain and Chlamtac)
+class P2Quantile
+{
+public:
+	explicit P2Quantile(double quantile = 0.5);
+	void reset();
+	void add(double x);
+	double value() const;
+
+private:
+	double parabolic(int i, double d) const;
+	double linear(int i, int d) const;
+
+	double quantile;
+	double heights[5];
+	double positions[5];
+	double desired[5];
+	double increments[5];
+	uint64_t count = 0;
+};
+
+struct MetricStats
+{
+	uint64_t count = 0;          // Records ever received
+	uint64_t interval_count = 0; // Since the last flush
+	uint64_t step = 0;           // Of the latest record
+	double last = 0.0;
+	double ema = 0.0;
+	double window_mean = 0.0;    // Over the last window_size records
+	double min = 0.0;            // Min, max and the quantiles cover the current flush interval
+	double max = 0.0;
+	double p10 = 0.0;
+	double p50 = 0.0;
+	double p90 = 0.0;
+};
+
+struct MetricsConfig
+{
+	std::string path;                // Logs go to <path>.csv and <path>.bin, empty keeps the statistics in memory only
+	uint32_t ring_capacity = 4096;   // Records per producer thread
+	int window_size = 100;
+	double ema_alpha = 0.01;
+	int drain_interval_ms = 20;
+	int flush_every_seconds = 10;
+	bool print = true;               // One summary line per flush on the console
+};
+
+// Collects metrics off the training threads. Every producing thread gets its own ring on its first
+// push, a background aggregator drains all rings, keeps streaming statistics per metric and writes
+// one log row per metric and flush interval. Memory does not grow with the length of the run and
+// push never touches a file; only the first push of a thread takes a lock to register its ring.
+class MetricsPipeline
+{
+public:
+	MetricsPipeline();
+	~MetricsPipeline();
+	void start(const MetricsConfig& config);
+	void stop();
+	void push(Metric metric, uint64_t step, double value);
+	// Drains a ring owned by someone else, e.g. the ring of an actor process in shared memory.
+	// Producer threads of this process get source ids from 0, external rings should start at 256.
+	void attach(MetricRing* ring, uint16_t source);
+	MetricStats stats(Metric metric);
+	uint64_t dropped();
+	// Every drained record is also appended to this store for plotting, nullptr stops that
+	void setSeries(SeriesStore* store);
+
+private:
+	struct Accumulator
+	{
+		MetricStats stats;
+		std::vector<double> window;
+		size_t window_next = 0;
+		size_t window_filled = 0;
+		double window_sum = 0.0;
+		P2Quantile p10{ 0.1 }, p50{ 0.5 }, p90{ 0.9 };
+	};
+	struct Source
+	{
+		MetricRing* ring;
+		uint16_t id;
+	};
+
+	MetricRing* threadRing();
+	void aggregatorLoop();
+	void drainAll(std::vector<MetricRecord>& scratch);
+	void flush(double seconds);
+
+	MetricsConfig config;
+	uint64_t instance;
+
+	std::mutex sources_mutex;
+	std::vector<Source> sources;
+	std::vector<std::unique_ptr<uint8_t[]>> owned_rings;
+
+	std::atomic<SeriesStore*> series{ nullptr };
+
+	std::mutex stats_mutex;
+	Accumulator accumulators[static_cast<size_t>(Metric::Count)];
+
+	std::ofstream csv, binary;
+	std::chrono::steady_clock::time_point started;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread aggregator;
+};
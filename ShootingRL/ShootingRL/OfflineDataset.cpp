@@ -0,0 +1,275 @@
+#include "OfflineDataset.h"
+#include "DQN.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+struct OfflineDataset::Batch
+{
+    Tensor_step_return tensors;
+};
+
+OfflineDataset::~OfflineDataset()
+{
+    close();
+}
+
+bool OfflineDataset::open(const std::vector<std::string>& paths, const ObservationSpec& observation, int batch_size,
+    int decode_threads, size_t shuffle_window, size_t prefetch_batches, unsigned seed)
+{
+    close();
+    channels = observation.channels;
+    height = observation.height;
+    width = observation.width;
+
+    for (auto& path : paths)
+    {
+        // Only the index is read up front, chunk bytes come from the mapping when they are decoded
+        TrajectoryReader reader;
+        if (!reader.open(path))
+            continue;
+        auto file = std::make_unique<SharedMemory>();
+        if (!file->MapReadOnly(reader.data_path))
+            continue;
+        int id = static_cast<int>(files.size());
+        for (auto& entry : reader.entries)
+        {
+            if (entry.offset + entry.bytes > file->Size() || entry.step_count == 0)
+                continue;
+            chunks.push_back({ id, entry });
+            transitions += entry.step_count;
+        }
+        files.push_back(std::move(file));
+    }
+    // Every batch holds batch_size different transitions, a smaller dataset could never fill one
+    this->batch_size = std::max(1, batch_size);
+    if (transitions < static_cast<size_t>(this->batch_size))
+    {
+        close();
+        return false;
+    }
+    // A window larger than the dataset would only hold memory that is never filled
+    this->shuffle_window = std::max<size_t>(std::min(shuffle_window, transitions), this->batch_size);
+    this->prefetch_batches = std::max<size_t>(1, prefetch_batches);
+    order_rng.seed(seed);
+    window_rng.seed(seed + 1);
+    order.resize(chunks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), order_rng);
+    order_position = 0;
+    epochs = 0;
+    corrupt = 0;
+    decoded = 0;
+
+    frame_bytes = static_cast<size_t>(channels) * height * width;
+    slab.assign(this->shuffle_window * 2 * frame_bytes, 0);
+    slot_info.assign(this->shuffle_window, SlotInfo{});
+    free_slots.resize(this->shuffle_window);
+    std::iota(free_slots.begin(), free_slots.end(), 0);
+    window.clear();
+
+    stopping = false;
+    for (int i = 0; i < std::max(1, decode_threads); i++)
+        decoders.emplace_back(&OfflineDataset::decodeLoop, this);
+    batcher = std::thread(&OfflineDataset::batchLoop, this);
+    return true;
+}
+
+void OfflineDataset::close()
+{
+    stopping = true;
+    // Taking the locks once makes sure no thread is between checking stopping and waiting
+    { std::lock_guard<std::mutex> lock(window_mutex); }
+    { std::lock_guard<std::mutex> lock(ready_mutex); }
+    window_space.notify_all();
+    window_ready.notify_all();
+    ready_space.notify_all();
+    ready_available.notify_all();
+    for (auto& decoder : decoders)
+        decoder.join();
+    decoders.clear();
+    if (batcher.joinable())
+        batcher.join();
+
+    window.clear();
+    free_slots.clear();
+    slot_info.clear();
+    slab.clear();
+    slab.shrink_to_fit();
+    ready.clear();
+    chunks.clear();
+    files.clear();
+    transitions = 0;
+}
+
+Tensor_step_return OfflineDataset::next()
+{
+    std::unique_lock<std::mutex> lock(ready_mutex);
+    ready_available.wait(lock, [this]() { return !ready.empty() || stopping; });
+    if (ready.empty())
+        return Tensor_step_return();
+    std::shared_ptr<Batch> batch = std::move(ready.front());
+    ready.pop_front();
+    lock.unlock();
+    ready_space.notify_one();
+    return batch->tensors;
+}
+
+size_t OfflineDataset::transitionCount() const
+{
+    return transitions;
+}
+
+uint64_t OfflineDataset::epoch() const
+{
+    return epochs;
+}
+
+uint64_t OfflineDataset::corruptChunks() const
+{
+    return corrupt;
+}
+
+void OfflineDataset::nextChunk(ChunkRef& chunk)
+{
+    std::lock_guard<std::mutex> lock(order_mutex);
+    if (order_position >= order.size())
+    {
+        std::shuffle(order.begin(), order.end(), order_rng);
+        order_position = 0;
+        epochs++;
+    }
+    chunk = chunks[order[order_position++]];
+}
+
+void OfflineDataset::decodeLoop()
+{
+    TrajectoryChunk chunk;
+    while (!stopping)
+    {
+        {
+            std::unique_lock<std::mutex> lock(window_mutex);
+            window_space.wait(lock, [this]() { return !free_slots.empty() || stopping; });
+            if (stopping)
+                return;
+        }
+
+        ChunkRef ref;
+        nextChunk(ref);
+        const uint8_t* bytes = static_cast<const uint8_t*>(files[ref.file]->Data()) + ref.entry.offset;
+        if (!TrajectoryReader::decodeChunk(bytes, ref.entry.bytes, chunk) ||
+            chunk.frames.size() != chunk.steps.size() + 1 || chunk.frames[0].size() != frame_bytes)
+        {
+            // Nothing usable at all would leave next() waiting forever
+            if (++corrupt >= chunks.size() && decoded == 0)
+            {
+                stopping = true;
+                { std::lock_guard<std::mutex> lock(window_mutex); }
+                { std::lock_guard<std::mutex> lock(ready_mutex); }
+                ready_available.notify_all();
+                window_ready.notify_all();
+                window_space.notify_all();
+            }
+            continue;
+        }
+        decoded++;
+
+        // Each transition is copied into a free slot, the chunk is only kept until its last one is in
+        for (size_t step = 0; step < chunk.steps.size() && !stopping; step++)
+        {
+            size_t slot;
+            {
+                std::unique_lock<std::mutex> lock(window_mutex);
+                window_space.wait(lock, [this]() { return !free_slots.empty() || stopping; });
+                if (stopping)
+                    return;
+                slot = free_slots.back();
+                free_slots.pop_back();
+            }
+            uint8_t* frames = slab.data() + 2 * slot * frame_bytes;
+            std::memcpy(frames, chunk.frames[step].data(), frame_bytes);
+            std::memcpy(frames + frame_bytes, chunk.frames[step + 1].data(), frame_bytes);
+            slot_info[slot] = { chunk.steps[step].action, chunk.steps[step].flags, chunk.steps[step].reward };
+            {
+                std::lock_guard<std::mutex> lock(window_mutex);
+                window.push_back(slot);
+            }
+            window_ready.notify_one();
+        }
+        chunk.steps.clear();
+        chunk.frames.clear();
+        chunk.frames.shrink_to_fit();
+    }
+}
+
+void OfflineDataset::batchLoop()
+{
+    // The window is kept at least this full so batches mix transitions of many chunks
+    size_t fill = std::min(shuffle_window, transitions);
+    std::vector<size_t> picked;
+
+    while (!stopping)
+    {
+        picked.clear();
+        {
+            std::unique_lock<std::mutex> lock(window_mutex);
+            while (static_cast<int>(picked.size()) < batch_size && !stopping)
+            {
+                // Picked slots are only freed once the batch is copied out, the decoders can't fill more than the rest
+                size_t wanted = std::max<size_t>(std::min(fill, shuffle_window - picked.size()), 1);
+                window_ready.wait(lock, [&]() { return window.size() >= wanted || stopping; });
+                while (static_cast<int>(picked.size()) < batch_size && !window.empty())
+                {
+                    std::uniform_int_distribution<size_t> pick(0, window.size() - 1);
+                    size_t index = pick(window_rng);
+                    picked.push_back(window[index]);
+                    window[index] = window.back();
+                    window.pop_back();
+                }
+            }
+        }
+        if (stopping)
+            return;
+
+        int count = static_cast<int>(picked.size());
+        torch::Tensor states = torch::empty({ count, channels, height, width }, torch::kByte);
+        torch::Tensor next_states = torch::empty_like(states);
+        torch::Tensor actions = torch::empty({ count, 1 }, torch::kFloat);
+        torch::Tensor rewards = torch::empty({ count, 1 }, torch::kFloat);
+        torch::Tensor dones = torch::empty({ count, 1 }, torch::kFloat);
+        for (int row = 0; row < count; row++)
+        {
+            size_t slot = picked[row];
+            const uint8_t* frames = slab.data() + 2 * slot * frame_bytes;
+            std::memcpy(states.data_ptr<uint8_t>() + row * frame_bytes, frames, frame_bytes);
+            std::memcpy(next_states.data_ptr<uint8_t>() + row * frame_bytes, frames + frame_bytes, frame_bytes);
+            actions.data_ptr<float>()[row] = static_cast<float>(slot_info[slot].action);
+            rewards.data_ptr<float>()[row] = slot_info[slot].reward;
+            dones.data_ptr<float>()[row] = static_cast<float>(slot_info[slot].flags & 1);
+        }
+        // Copied out, the slots can take new transitions
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            free_slots.insert(free_slots.end(), picked.begin(), picked.end());
+        }
+        window_space.notify_all();
+        picked.clear();
+
+        auto batch = std::make_shared<Batch>();
+        batch->tensors.states = states.to(torch::kFloat).div_(255);
+        batch->tensors.next_states = next_states.to(torch::kFloat).div_(255);
+        batch->tensors.actions = actions;
+        batch->tensors.rewards = rewards;
+        batch->tensors.dones = dones;
+
+        {
+            std::unique_lock<std::mutex> lock(ready_mutex);
+            ready_space.wait(lock, [this]() { return ready.size() < prefetch_batches || stopping; });
+            if (stopping)
+                return;
+            ready.push_back(std::move(batch));
+        }
+        ready_available.notify_one();
+    }
+}
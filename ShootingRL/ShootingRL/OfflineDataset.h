@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SharedMemory.h"
+#include "TrajectoryRecorder.h"
+
+struct Tensor_step_return;
+struct ObservationSpec;
+
+// Streams transitions out of TrajectoryRecorder files for learning without environments.
+// The chunk files are mapped, so only the chunks being decoded are resident. Decode threads copy
+// the frames of every transition into a fixed slab of shuffle_window slots and drop the chunk,
+// and a batcher draws random slots into a queue of ready batches for next(). Resident memory is the
+// slab, 2 * shuffle_window observations, plus one decoded chunk per decode thread.
+class OfflineDataset
+{
+public:
+	OfflineDataset() {};
+	~OfflineDataset();
+	// Every path is a recording prefix as passed to TrajectoryRecorder::open. Fails when the recordings
+	// hold fewer transitions than one batch.
+	bool open(const std::vector<std::string>& paths, const ObservationSpec& observation, int batch_size,
+		int decode_threads, size_t shuffle_window, size_t prefetch_batches, unsigned seed);
+	void close();
+	// Blocks until a batch is ready, the dataset is repeated in a new chunk order every epoch.
+	// Returns undefined tensors once the dataset is closed or turned out to hold no valid chunk
+	Tensor_step_return next();
+
+	size_t transitionCount() const;
+	uint64_t epoch() const;
+	// Chunks that failed their checksum, usually the torn tail of an interrupted recording
+	uint64_t corruptChunks() const;
+
+private:
+	struct ChunkRef
+	{
+		int file;
+		TrajectoryIndexEntry entry;
+	};
+	// Everything of a window slot but its frames, which live in the slab
+	struct SlotInfo
+	{
+		uint8_t action;
+		uint8_t flags;
+		float reward;
+	};
+	struct Batch;
+
+	void decodeLoop();
+	void batchLoop();
+	void nextChunk(ChunkRef& chunk);
+
+	std::vector<std::unique_ptr<SharedMemory>> files;
+	std::vector<ChunkRef> chunks;
+	size_t transitions = 0;
+	int channels = 4, height = 800, width = 800;
+	int batch_size = 64;
+	size_t shuffle_window = 1024;
+	size_t prefetch_batches = 4;
+
+	// Chunk order of the current epoch
+	std::mutex order_mutex;
+	std::vector<size_t> order;
+	size_t order_position = 0;
+	std::atomic<uint64_t> epochs{ 0 };
+	std::atomic<uint64_t> corrupt{ 0 };
+	std::atomic<uint64_t> decoded{ 0 };
+	std::mt19937 order_rng;
+
+	// Slot i holds its state at slab[2 * i * frame_bytes] and the next state right after it.
+	// A slot is free, owned by the decoder filling it, in the window, or owned by the batcher copying it.
+	std::mutex window_mutex;
+	std::condition_variable window_space, window_ready;
+	size_t frame_bytes = 0;
+	std::vector<uint8_t> slab;
+	std::vector<SlotInfo> slot_info;
+	std::vector<size_t> free_slots;
+	std::vector<size_t> window;
+	std::mt19937 window_rng;
+
+	std::mutex ready_mutex;
+	std::condition_variable ready_space, ready_available;
+	std::deque<std::shared_ptr<Batch>> ready;
+
+	std::atomic<bool> stopping{ false };
+	std::vector<std::thread> decoders;
+	std::thread batcher;
+};
@@ -0,0 +1,74 @@
+#include "ReplayRatioController.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double rateSmoothing = 0.3;
+}
+
+void ReplayRatioController::configure(ReplayRatioMode mode, double target_ratio, int max_updates_per_call, double actor_slack)
+{
+    this->mode = mode;
+    this->target_ratio = std::max(0.0, target_ratio);
+    this->max_updates_per_call = std::max(1, max_updates_per_call);
+    this->actor_slack = std::max(1.0, actor_slack);
+}
+
+void ReplayRatioController::recordTransitions(uint64_t count)
+{
+    transitions.fetch_add(count, std::memory_order_relaxed);
+}
+
+void ReplayRatioController::setTransitions(uint64_t total)
+{
+    transitions.store(total, std::memory_order_relaxed);
+}
+
+void ReplayRatioController::recordUpdate()
+{
+    updates++;
+}
+
+int ReplayRatioController::updatesDue(int batch_size)
+{
+    if (mode == ReplayRatioMode::MaxBoth)
+        return 1;
+
+    // Updates owed so far at the target ratio, a learner that fell behind catches up a few per call
+    double owed = static_cast<double>(transitions.load(std::memory_order_relaxed)) * target_ratio / std::max(1, batch_size);
+    double due = std::floor(owed) - static_cast<double>(updates);
+    if (due <= 0.0)
+        return 0;
+    return static_cast<int>(std::min<double>(due, max_updates_per_call));
+}
+
+bool ReplayRatioController::actorsShouldWait(int batch_size) const
+{
+    if (mode != ReplayRatioMode::Target)
+        return false;
+    double owed = static_cast<double>(transitions.load(std::memory_order_relaxed)) * target_ratio / std::max(1, batch_size);
+    return owed - static_cast<double>(updates) > actor_slack;
+}
+
+ReplayRatioTelemetry ReplayRatioController::telemetry(int batch_size)
+{
+    uint64_t total_transitions = transitions.load(std::memory_order_relaxed);
+    auto now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - window_start).count();
+    if (seconds >= 1.0)
+    {
+        double transition_rate = (total_transitions - window_transitions) / seconds;
+        double update_rate = (updates - window_updates) / seconds;
+        bool first = last.transitions_per_second == 0.0 && last.updates_per_second == 0.0;
+        last.transitions_per_second = first ? transition_rate : last.transitions_per_second + rateSmoothing * (transition_rate - last.transitions_per_second);
+        last.updates_per_second = first ? update_rate : last.updates_per_second + rateSmoothing * (update_rate - last.updates_per_second);
+        last.live_ratio = last.transitions_per_second > 0.0 ? last.updates_per_second * batch_size / last.transitions_per_second : 0.0;
+        window_start = now;
+        window_transitions = total_transitions;
+        window_updates = updates;
+    }
+    last.overall_ratio = total_transitions > 0 ? static_cast<double>(updates) * batch_size / total_transitions : 0.0;
+    last.actors_throttled = actorsShouldWait(batch_size);
+    return last;
+}
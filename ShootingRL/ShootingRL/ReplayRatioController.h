@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+enum class ReplayRatioMode
+{
+	Fixed,   // One update every update_every transitions, the original cadence
+	Target,  // Updates are throttled or boosted to replay target_ratio samples per collected transition
+	MaxBoth  // Actors and learner both run flat out, the ratio is only reported
+};
+
+struct ReplayRatioTelemetry
+{
+	double transitions_per_second = 0.0;
+	double updates_per_second = 0.0;
+	double live_ratio = 0.0;        // Over the last measurement window
+	double overall_ratio = 0.0;     // Since the start
+	bool actors_throttled = false;
+};
+
+// Replay ratio = samples the learner trained on / transitions the actors collected.
+// Transitions may be reported from any thread, updatesDue and recordUpdate belong to the learner.
+class ReplayRatioController
+{
+public:
+	void configure(ReplayRatioMode mode, double target_ratio, int max_updates_per_call, double actor_slack);
+	void recordTransitions(uint64_t count);
+	// For actors that keep their own running total, e.g. the shared replay ring
+	void setTransitions(uint64_t total);
+	void recordUpdate();
+	// Learn steps to run now for the given batch size, never more than max_updates_per_call
+	int updatesDue(int batch_size);
+	// Target mode only: the learner is so far behind that actors should pause collecting
+	bool actorsShouldWait(int batch_size) const;
+	ReplayRatioTelemetry telemetry(int batch_size);
+
+	ReplayRatioMode mode = ReplayRatioMode::Fixed;
+	double target_ratio = 64.0 / 108.0;  // batch_size / update_every of the default Hyperparameters
+	int max_updates_per_call = 4;
+	// How many batches the learner may fall behind before actors are held back
+	double actor_slack = 32.0;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	std::atomic<uint64_t> transitions{ 0 };
+	uint64_t updates = 0;
+
+	// Rates are measured over windows of about a second and smoothed
+	Clock::time_point window_start = Clock::now();
+	uint64_t window_transitions = 0;
+	uint64_t window_updates = 0;
+	ReplayRatioTelemetry last;
+};
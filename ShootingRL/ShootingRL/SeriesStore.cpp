@@ -0,0 +1,184 @@
+#include "SeriesStore.h"
+
+#include <algorithm>
+#include <cmath>
+
+DownsampledSeries::DownsampledSeries(int levels, int factor, int bucket_capacity)
+    : factor(std::max(2, factor))
+{
+    this->levels.resize(std::max(1, levels));
+    for (auto& level : this->levels)
+        level.ring.resize(std::max(1, bucket_capacity));
+}
+
+uint64_t DownsampledSeries::span(size_t level) const
+{
+    uint64_t samples = 1;
+    for (size_t i = 0; i < level; i++)
+        samples *= factor;
+    return samples;
+}
+
+void DownsampledSeries::merge(Bucket& into, const Bucket& bucket)
+{
+    if (into.count == 0)
+    {
+        into = bucket;
+        return;
+    }
+    into.min = std::min(into.min, bucket.min);
+    into.max = std::max(into.max, bucket.max);
+    into.sum += bucket.sum;
+    into.count += bucket.count;
+}
+
+void DownsampledSeries::commit(size_t level, const Bucket& bucket)
+{
+    Level& current = levels[level];
+    current.ring[current.committed % current.ring.size()] = bucket;
+    current.committed++;
+    if (level + 1 >= levels.size())
+        return;
+
+    // Every factor finished buckets make one bucket of the next level
+    Level& above = levels[level + 1];
+    merge(above.open, bucket);
+    if (above.open.count == span(level + 1))
+    {
+        Bucket finished = above.open;
+        above.open = Bucket{};
+        commit(level + 1, finished);
+    }
+}
+
+void DownsampledSeries::add(float value)
+{
+    if (!std::isfinite(value))
+        return;
+    samples++;
+    commit(0, { value, value, value, 1 });
+}
+
+uint64_t DownsampledSeries::size() const
+{
+    return samples;
+}
+
+void DownsampledSeries::query(uint64_t first, uint64_t last, size_t max_points, std::vector<SeriesPoint>& out) const
+{
+    out.clear();
+    if (samples == 0 || max_points == 0)
+        return;
+    last = std::min(last, samples - 1);
+    if (first > last)
+        return;
+
+    // The finest level that has the range in its ring with few enough buckets, else the coarsest one
+    size_t chosen = levels.size() - 1;
+    for (size_t k = 0; k < levels.size(); k++)
+    {
+        uint64_t bucketSamples = span(k);
+        uint64_t oldest = levels[k].committed > levels[k].ring.size() ? levels[k].committed - levels[k].ring.size() : 0;
+        if (last / bucketSamples - first / bucketSamples + 1 <= max_points && first / bucketSamples >= oldest)
+        {
+            chosen = k;
+            break;
+        }
+    }
+
+    const Level& level = levels[chosen];
+    uint64_t bucketSamples = span(chosen);
+    uint64_t oldest = level.committed > level.ring.size() ? level.committed - level.ring.size() : 0;
+    for (uint64_t j = std::max(first / bucketSamples, oldest); j <= last / bucketSamples; j++)
+    {
+        // The unfinished bucket keeps the newest samples visible on coarse levels
+        const Bucket* bucket = nullptr;
+        if (j < level.committed)
+            bucket = &level.ring[j % level.ring.size()];
+        else if (j == level.committed && level.open.count > 0)
+            bucket = &level.open;
+        if (bucket == nullptr)
+            break;
+        double start = static_cast<double>(j * bucketSamples);
+        out.push_back({ start, start + bucket->count - 1, bucket->min, bucket->max, static_cast<float>(bucket->sum / bucket->count) });
+    }
+}
+
+std::vector<size_t> largestTriangleThreeBuckets(const std::vector<SeriesPoint>& points, size_t threshold)
+{
+    std::vector<size_t> selected;
+    if (threshold >= points.size() || threshold < 3)
+    {
+        for (size_t i = 0; i < points.size(); i++)
+            selected.push_back(i);
+        return selected;
+    }
+
+    auto x = [&](size_t i) { return (points[i].first + points[i].last) * 0.5; };
+    selected.reserve(threshold);
+    selected.push_back(0);
+    // The inner points are split into threshold - 2 buckets, each keeps the point spanning the largest
+    // triangle with the previously kept point and the average of the next bucket
+    double every = static_cast<double>(points.size() - 2) / (threshold - 2);
+    size_t previous = 0;
+    for (size_t bucket = 0; bucket < threshold - 2; bucket++)
+    {
+        size_t begin = static_cast<size_t>(std::floor(bucket * every)) + 1;
+        size_t end = std::min(points.size() - 1, static_cast<size_t>(std::floor((bucket + 1) * every)) + 1);
+        size_t nextBegin = end;
+        size_t nextEnd = std::min(points.size(), static_cast<size_t>(std::floor((bucket + 2) * every)) + 1);
+
+        double averageX = 0.0, averageY = 0.0;
+        for (size_t i = nextBegin; i < nextEnd; i++)
+        {
+            averageX += x(i);
+            averageY += points[i].mean;
+        }
+        size_t nextCount = std::max<size_t>(1, nextEnd - nextBegin);
+        averageX /= nextCount;
+        averageY /= nextCount;
+
+        double best = -1.0;
+        size_t chosen = begin;
+        for (size_t i = begin; i < end; i++)
+        {
+            double area = std::abs((x(previous) - averageX) * (points[i].mean - points[previous].mean) -
+                (x(previous) - x(i)) * (averageY - points[previous].mean));
+            if (area > best)
+            {
+                best = area;
+                chosen = i;
+            }
+        }
+        selected.push_back(chosen);
+        previous = chosen;
+    }
+    selected.push_back(points.size() - 1);
+    return selected;
+}
+
+void SeriesStore::add(Metric metric, float value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    series[static_cast<size_t>(metric)].add(value);
+}
+
+void SeriesStore::add(const std::vector<MetricRecord>& records)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& record : records)
+        if (record.metric < static_cast<uint16_t>(Metric::Count))
+            series[record.metric].add(static_cast<float>(record.value));
+}
+
+uint64_t SeriesStore::size(Metric metric)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return series[static_cast<size_t>(metric)].size();
+}
+
+void SeriesStore::query(Metric metric, uint64_t first, uint64_t last, size_t max_points, std::vector<SeriesPoint>& out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    series[static_cast<size_t>(metric)].query(first, last, max_points, out);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Metrics.h"
+
+// One plotted column: samples [first, last] of a series reduced to their range and mean
+struct SeriesPoint
+{
+	double first;
+	double last;
+	float min;
+	float max;
+	float mean;
+};
+
+// Keeps a series at several resolutions in fixed memory. Level k stores buckets of factor^k samples
+// in a ring of bucket_capacity entries, so the coarse levels cover the whole run while the fine ones
+// only hold its recent part. Samples are indexed by their position in the series.
+class DownsampledSeries
+{
+public:
+	DownsampledSeries(int levels = 12, int factor = 4, int bucket_capacity = 2048);
+	void add(float value);
+	uint64_t size() const;
+	// Buckets of the finest level that still covers [first, last] with at most max_points of them
+	void query(uint64_t first, uint64_t last, size_t max_points, std::vector<SeriesPoint>& out) const;
+
+private:
+	struct Bucket
+	{
+		float min;
+		float max;
+		double sum;
+		uint64_t count;
+	};
+	struct Level
+	{
+		std::vector<Bucket> ring;
+		uint64_t committed = 0;  // Finished buckets ever written at this level
+		Bucket open{};           // Bucket being filled from the level below
+	};
+
+	void commit(size_t level, const Bucket& bucket);
+	static void merge(Bucket& into, const Bucket& bucket);
+	uint64_t span(size_t level) const;
+
+	int factor;
+	std::vector<Level> levels;
+	uint64_t samples = 0;
+};
+
+// Indices of the points the largest-triangle-three-buckets algorithm keeps when reducing
+// a line to threshold points, always including the first and the last one
+std::vector<size_t> largestTriangleThreeBuckets(const std::vector<SeriesPoint>& points, size_t threshold);
+
+// Series of every metric, fed by the metrics aggregator and read by the dashboard.
+// Training threads never touch it, the lock is only shared between those two.
+class SeriesStore
+{
+public:
+	void add(Metric metric, float value);
+	// A drained batch of records under a single lock
+	void add(const std::vector<MetricRecord>& records);
+	uint64_t size(Metric metric);
+	void query(Metric metric, uint64_t first, uint64_t last, size_t max_points, std::vector<SeriesPoint>& out);
+
+private:
+	std::mutex mutex;
+	DownsampledSeries series[static_cast<size_t>(Metric::Count)];
+};
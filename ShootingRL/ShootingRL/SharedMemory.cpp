@@ -0,0 +1,238 @@
+#include "SharedMemory.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::~SharedMemory()
+{
+	Close();
+}
+
+bool SharedMemory::Create(const std::string& name, size_t size)
+{
+	Close();
+	this->name = name;
+	this->size = size;
+	owner = true;
+#ifdef _WIN32
+	handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size & 0xffffffffull),
+		("Local\\" + name).c_str());
+	if (handle == nullptr)
+		return false;
+	data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+	handle = shm_open(("/" + name).c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (handle == -1)
+		return false;
+	if (ftruncate(handle, static_cast<off_t>(size)) != 0) {
+		Close();
+		return false;
+	}
+	data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	if (data == MAP_FAILED)
+		data = nullptr;
+#endif
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool SharedMemory::Open(const std::string& name)
+{
+	Close();
+	this->name = name;
+	owner = false;
+#ifdef _WIN32
+	handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, ("Local\\" + name).c_str());
+	if (handle == nullptr)
+		return false;
+	data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (data != nullptr) {
+		MEMORY_BASIC_INFORMATION info;
+		VirtualQuery(data, &info, sizeof(info));
+		size = info.RegionSize;
+	}
+#else
+	handle = shm_open(("/" + name).c_str(), O_RDWR, 0600);
+	if (handle == -1)
+		return false;
+	struct stat info;
+	if (fstat(handle, &info) != 0) {
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(info.st_size);
+	data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	if (data == MAP_FAILED)
+		data = nullptr;
+#endif
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool SharedMemory::MapFile(const std::string& path, size_t size, bool& existed)
+{
+	Close();
+	this->size = size;
+	owner = false;
+	existed = false;
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	existed = GetFileSizeEx(file, &fileSize) && static_cast<size_t>(fileSize.QuadPart) == size;
+	if (!existed) {
+		// Recreate at the requested size. Sparse, so NTFS allocates pages as they are written
+		// instead of reserving and zero filling the whole ring up front.
+		DWORD returned = 0;
+		DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+		LARGE_INTEGER zero = {};
+		SetFilePointerEx(file, zero, nullptr, FILE_BEGIN);
+		SetEndOfFile(file);
+		LARGE_INTEGER end;
+		end.QuadPart = static_cast<LONGLONG>(size);
+		if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+			Close();
+			return false;
+		}
+	}
+	handle = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size & 0xffffffffull), nullptr);
+	if (handle == nullptr) {
+		Close();
+		return false;
+	}
+	data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+	handle = open(path.c_str(), O_CREAT | O_RDWR, 0600);
+	if (handle == -1)
+		return false;
+	struct stat info;
+	existed = fstat(handle, &info) == 0 && static_cast<size_t>(info.st_size) == size;
+	if (!existed) {
+		if (ftruncate(handle, 0) != 0 || ftruncate(handle, static_cast<off_t>(size)) != 0) {
+			Close();
+			return false;
+		}
+	}
+	data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	if (data == MAP_FAILED)
+		data = nullptr;
+#endif
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool SharedMemory::MapReadOnly(const std::string& path)
+{
+	Close();
+	owner = false;
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+	handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (handle == nullptr) {
+		Close();
+		return false;
+	}
+	data = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, size);
+#else
+	handle = open(path.c_str(), O_RDONLY);
+	if (handle == -1)
+		return false;
+	struct stat info;
+	if (fstat(handle, &info) != 0 || info.st_size == 0) {
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(info.st_size);
+	data = mmap(nullptr, size, PROT_READ, MAP_SHARED, handle, 0);
+	if (data == MAP_FAILED)
+		data = nullptr;
+#endif
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SharedMemory::Flush()
+{
+	if (data == nullptr)
+		return;
+#ifdef _WIN32
+	FlushViewOfFile(data, 0);
+	if (file != nullptr)
+		FlushFileBuffers(file);
+#else
+	msync(data, size, MS_SYNC);
+#endif
+}
+
+void SharedMemory::Close()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (handle != nullptr)
+		CloseHandle(handle);
+	if (file != nullptr)
+		CloseHandle(file);
+	handle = nullptr;
+	file = nullptr;
+#else
+	if (data != nullptr)
+		munmap(data, size);
+	if (handle != -1) {
+		close(handle);
+		// The name goes away with the learner, mapped actors keep their view until they exit
+		if (owner)
+			shm_unlink(("/" + name).c_str());
+	}
+	handle = -1;
+#endif
+	data = nullptr;
+	size = 0;
+	owner = false;
+}
+
+void* SharedMemory::Data()
+{
+	return data;
+}
+
+size_t SharedMemory::Size() const
+{
+	return size;
+}
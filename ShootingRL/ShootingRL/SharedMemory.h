@@ -0,0 +1,37 @@
+#pragma once
+#include "string"
+#include <cstddef>
+
+// Named memory region shared between the learner and the actor processes,
+// or a file mapped into memory so its contents outlive the process
+class SharedMemory
+{
+public:
+	SharedMemory() {};
+	~SharedMemory();
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	bool Create(const std::string& name, size_t size);
+	bool Open(const std::string& name);
+	// existed is false when the file was missing or had another size and starts out zeroed
+	bool MapFile(const std::string& path, size_t size, bool& existed);
+	// Maps a whole existing file for reading, pages are loaded on access so the file can exceed RAM
+	bool MapReadOnly(const std::string& path);
+	void Flush();
+	void Close();
+	void* Data();
+	size_t Size() const;
+
+private:
+	std::string name;
+	void* data = nullptr;
+	size_t size = 0;
+	bool owner = false;
+#ifdef _WIN32
+	void* handle = nullptr;
+	void* file = nullptr;
+#else
+	int handle = -1;
+#endif
+};
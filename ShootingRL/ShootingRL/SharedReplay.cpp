@@ -0,0 +1,359 @@
+#include "SharedReplay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace {
+    const uint32_t replayMagic = 0x53525034;  // "SRP4"
+    const size_t cacheLine = 64;
+    const uint32_t actorMetricCapacity = 1024;
+
+    size_t AlignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+size_t SharedReplay::SlotBytes(const ObservationSpec& observation)
+{
+    size_t observationBytes = static_cast<size_t>(observation.channels) * observation.height * observation.width;
+    return AlignUp(sizeof(Slot) + 2 * observationBytes, cacheLine);
+}
+
+size_t SharedReplay::MetricRingBytes()
+{
+    return AlignUp(MetricRing::BytesFor(actorMetricCapacity), cacheLine);
+}
+
+NetworkSpec SharedReplay::NetworkLayout::ToSpec() const
+{
+    NetworkSpec spec;
+    spec.input_channels = input_channels;
+    spec.input_height = input_height;
+    spec.input_width = input_width;
+    spec.conv_layers.assign(conv_layers, conv_layers + std::min<size_t>(conv_count, maxConvLayers));
+    spec.hidden_layers.assign(hidden_layers, hidden_layers + std::min<size_t>(hidden_count, maxHiddenLayers));
+    spec.softmax_output = softmax_output != 0;
+    return spec;
+}
+
+size_t SharedReplay::SegmentBytes(int actorCount, int capacityPerActor, const ObservationSpec& observation, int64_t weightCount)
+{
+    size_t headerBytes = AlignUp(sizeof(Header), cacheLine);
+    size_t partitionBytes = AlignUp(sizeof(Partition) * actorCount, cacheLine);
+    size_t weightBytes = AlignUp(sizeof(float) * weightCount, cacheLine);
+    size_t spectatorBytes = AlignUp(sizeof(Spectator), cacheLine);
+    size_t metricBytes = MetricRingBytes() * actorCount;
+    return headerBytes + partitionBytes + spectatorBytes + metricBytes + weightBytes + SlotBytes(observation) * actorCount * capacityPerActor;
+}
+
+bool SharedReplay::Create(const std::string& name, int actorCount, int capacityPerActor, const ObservationSpec& observation, int actionCount, const NetworkSpec& network, int64_t weightCount)
+{
+    if (network.conv_layers.size() > maxConvLayers || network.hidden_layers.size() > maxHiddenLayers)
+        return false;
+
+    size_t headerBytes = AlignUp(sizeof(Header), cacheLine);
+    size_t partitionBytes = AlignUp(sizeof(Partition) * actorCount, cacheLine);
+    size_t weightBytes = AlignUp(sizeof(float) * weightCount, cacheLine);
+    size_t spectatorBytes = AlignUp(sizeof(Spectator), cacheLine);
+    size_t metricBytes = MetricRingBytes() * actorCount;
+    size_t slotBytes = SlotBytes(observation);
+    if (!memory.Create(name, SegmentBytes(actorCount, capacityPerActor, observation, weightCount)))
+        return false;
+
+    uint8_t* base = static_cast<uint8_t*>(memory.Data());
+    header = new (base) Header();
+    header->magic = replayMagic;
+    header->actor_count = actorCount;
+    header->capacity_per_actor = capacityPerActor;
+    header->action_count = actionCount;
+    header->observation = observation;
+    NetworkLayout& layout = header->network;
+    layout.input_channels = network.input_channels;
+    layout.input_height = network.input_height;
+    layout.input_width = network.input_width;
+    layout.conv_count = static_cast<uint32_t>(network.conv_layers.size());
+    std::copy(network.conv_layers.begin(), network.conv_layers.end(), layout.conv_layers);
+    layout.hidden_count = static_cast<uint32_t>(network.hidden_layers.size());
+    std::copy(network.hidden_layers.begin(), network.hidden_layers.end(), layout.hidden_layers);
+    layout.softmax_output = network.softmax_output ? 1 : 0;
+    header->observation_bytes = static_cast<uint64_t>(observation.channels) * observation.height * observation.width;
+    header->slot_bytes = slotBytes;
+    header->weight_count = weightCount;
+    header->weight_version.store(0);
+    header->shutdown.store(0);
+    header->epsilon.store(1.0f);
+    header->throttle.store(0);
+    header->spectated_env.store(-1);
+
+    partitions = reinterpret_cast<Partition*>(base + headerBytes);
+    for (int i = 0; i < actorCount; i++)
+    {
+        Partition* partition = new (&partitions[i]) Partition();
+        partition->written.store(0);
+        partition->episodes.store(0);
+        partition->last_score.store(0.0f);
+    }
+    spectator = new (base + headerBytes + partitionBytes) Spectator();
+    spectator->sequence.store(0);
+    spectator->env = -1;
+    spectator->shape_count = 0;
+    metricRings = base + headerBytes + partitionBytes + spectatorBytes;
+    for (int i = 0; i < actorCount; i++)
+        MetricRing::Construct(metricRings + i * MetricRingBytes(), actorMetricCapacity);
+    weights = reinterpret_cast<float*>(metricRings + metricBytes);
+    slots = metricRings + metricBytes + weightBytes;
+    for (uint64_t i = 0; i < static_cast<uint64_t>(actorCount) * capacityPerActor; i++)
+        new (slots + i * slotBytes) Slot{};
+    return true;
+}
+
+bool SharedReplay::Open(const std::string& name)
+{
+    if (!memory.Open(name))
+        return false;
+
+    uint8_t* base = static_cast<uint8_t*>(memory.Data());
+    header = reinterpret_cast<Header*>(base);
+    if (header->magic != replayMagic)
+        return false;
+    size_t headerBytes = AlignUp(sizeof(Header), cacheLine);
+    size_t partitionBytes = AlignUp(sizeof(Partition) * header->actor_count, cacheLine);
+    size_t spectatorBytes = AlignUp(sizeof(Spectator), cacheLine);
+    size_t metricBytes = MetricRingBytes() * header->actor_count;
+    size_t weightBytes = AlignUp(sizeof(float) * header->weight_count, cacheLine);
+    partitions = reinterpret_cast<Partition*>(base + headerBytes);
+    spectator = reinterpret_cast<Spectator*>(base + headerBytes + partitionBytes);
+    metricRings = base + headerBytes + partitionBytes + spectatorBytes;
+    weights = reinterpret_cast<float*>(metricRings + metricBytes);
+    slots = metricRings + metricBytes + weightBytes;
+    return true;
+}
+
+void SharedReplay::Add(int actor, const uint8_t* state, const uint8_t* nextState, Action action, float reward, bool terminated, bool truncated)
+{
+    Partition& partition = partitions[actor];
+    uint64_t index = partition.written.load(std::memory_order_relaxed);
+    Slot* slot = GetSlot(actor, index % header->capacity_per_actor);
+
+    // Seqlock write, readers that see an odd or changed sequence drop the slot
+    uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->action = static_cast<int32_t>(action);
+    slot->reward = reward;
+    slot->terminated = terminated;
+    slot->truncated = truncated;
+    uint8_t* pixels = reinterpret_cast<uint8_t*>(slot + 1);
+    std::memcpy(pixels, state, header->observation_bytes);
+    std::memcpy(pixels + header->observation_bytes, nextState, header->observation_bytes);
+
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+    partition.written.store(index + 1, std::memory_order_release);
+}
+
+void SharedReplay::EndEpisode(int actor, float score, int steps)
+{
+    partitions[actor].last_score.store(score, std::memory_order_relaxed);
+    partitions[actor].episodes.fetch_add(1, std::memory_order_relaxed);
+    uint64_t written = partitions[actor].written.load(std::memory_order_relaxed);
+    MetricRing* ring = MetricsOf(actor);
+    ring->push({ written, score, static_cast<uint16_t>(Metric::EpisodeReturn), 0, 0 });
+    ring->push({ written, static_cast<double>(steps), static_cast<uint16_t>(Metric::EpisodeLength), 0, 0 });
+}
+
+MetricRing* SharedReplay::MetricsOf(int actor)
+{
+    return reinterpret_cast<MetricRing*>(metricRings + actor * MetricRingBytes());
+}
+
+void SharedReplay::PublishSpectator(int env, uint32_t episode, uint32_t step, float score, const ShapeSnapshot* shapes, size_t count)
+{
+    uint64_t sequence = spectator->sequence.load(std::memory_order_relaxed);
+    spectator->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    count = std::min(count, maxSpectatorShapes);
+    spectator->env = env;
+    spectator->episode = episode;
+    spectator->step = step;
+    spectator->score = score;
+    spectator->shape_count = static_cast<uint32_t>(count);
+    std::memcpy(spectator->shapes, shapes, count * sizeof(ShapeSnapshot));
+
+    spectator->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool SharedReplay::ReadSpectator(SpectatorFrame& frame, uint64_t& sequence)
+{
+    uint64_t before = spectator->sequence.load(std::memory_order_acquire);
+    if (before == sequence || (before & 1) != 0)
+        return false;
+
+    uint32_t count = std::min<uint32_t>(spectator->shape_count, maxSpectatorShapes);
+    frame.shapes.resize(count);
+    std::memcpy(frame.shapes.data(), spectator->shapes, count * sizeof(ShapeSnapshot));
+    frame.env = spectator->env;
+    frame.episode = spectator->episode;
+    frame.step = spectator->step;
+    frame.score = spectator->score;
+
+    // A torn copy is dropped, the next frame picks up the following snapshot
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (spectator->sequence.load(std::memory_order_relaxed) != before)
+        return false;
+    sequence = before;
+    return true;
+}
+
+bool SharedReplay::PullWeights(QNetworkImpl& network, uint64_t& version)
+{
+    uint64_t before = header->weight_version.load(std::memory_order_acquire);
+    if (before == 0 || before % 2 == 1 || before == version)
+        return false;
+
+    weightStaging.resize(header->weight_count);
+    std::memcpy(weightStaging.data(), weights, sizeof(float) * header->weight_count);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->weight_version.load(std::memory_order_relaxed) != before)
+        return false;  // The learner published while we were copying, try again next time
+
+    // A network of another shape would take the right number of floats from the wrong offsets
+    std::vector<torch::Tensor> parameters = network.parameters();
+    int64_t expected = 0;
+    for (auto& parameter : parameters)
+        expected += parameter.numel();
+    if (static_cast<uint64_t>(expected) != header->weight_count)
+        return false;
+
+    torch::NoGradGuard no_grad;
+    size_t offset = 0;
+    for (auto& parameter : parameters)
+    {
+        int64_t count = parameter.numel();
+        parameter.copy_(torch::from_blob(weightStaging.data() + offset, parameter.sizes(), torch::kFloat));
+        offset += count;
+    }
+    version = before;
+    return true;
+}
+
+Tensor_step_return SharedReplay::Sample(int batchSize, std::mt19937& rng)
+{
+    const ObservationSpec& observation = header->observation;
+    torch::Tensor states = torch::empty({ batchSize, observation.channels, observation.height, observation.width }, torch::kByte);
+    torch::Tensor nextStates = torch::empty_like(states);
+    torch::Tensor actions = torch::empty({ batchSize, 1 }, torch::kFloat);
+    torch::Tensor rewards = torch::empty({ batchSize, 1 }, torch::kFloat);
+    torch::Tensor dones = torch::empty({ batchSize, 1 }, torch::kFloat);
+
+    // Pick partitions in proportion to how full they are
+    std::vector<uint64_t> filled(header->actor_count);
+    for (uint32_t actor = 0; actor < header->actor_count; actor++)
+        filled[actor] = std::min<uint64_t>(partitions[actor].written.load(std::memory_order_acquire), header->capacity_per_actor);
+    bool empty = std::all_of(filled.begin(), filled.end(), [](uint64_t value) { return value == 0; });
+    std::discrete_distribution<int> pickActor = empty ? std::discrete_distribution<int>() : std::discrete_distribution<int>(filled.begin(), filled.end());
+
+    int count = 0;
+    int attempts = 0;
+    while (!empty && count < batchSize && attempts < batchSize * 4)
+    {
+        attempts++;
+        int actor = pickActor(rng);
+        if (filled[actor] == 0)
+            continue;
+        uint64_t index = std::uniform_int_distribution<uint64_t>(0, filled[actor] - 1)(rng);
+        if (ReadSlot(GetSlot(actor, index),
+            states[count].data_ptr<uint8_t>(), nextStates[count].data_ptr<uint8_t>(),
+            actions.data_ptr<float>()[count], rewards.data_ptr<float>()[count], dones.data_ptr<float>()[count]))
+        {
+            count++;
+        }
+    }
+
+    Tensor_step_return tensor;
+    tensor.states = states.narrow(0, 0, count).to(torch::kFloat).div_(255);
+    tensor.next_states = nextStates.narrow(0, 0, count).to(torch::kFloat).div_(255);
+    tensor.actions = actions.narrow(0, 0, count);
+    tensor.rewards = rewards.narrow(0, 0, count);
+    tensor.dones = dones.narrow(0, 0, count);
+    return tensor;
+}
+
+void SharedReplay::PublishWeights(QNetworkImpl& network)
+{
+    torch::NoGradGuard no_grad;
+
+    uint64_t version = header->weight_version.load(std::memory_order_relaxed);
+    header->weight_version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t offset = 0;
+    for (auto& parameter : network.parameters())
+    {
+        torch::Tensor values = parameter.detach().to(torch::kFloat).contiguous();
+        int64_t count = values.numel();
+        if (offset + count > header->weight_count)
+            break;
+        std::memcpy(weights + offset, values.data_ptr<float>(), sizeof(float) * count);
+        offset += count;
+    }
+
+    header->weight_version.store(version + 2, std::memory_order_release);
+}
+
+uint64_t SharedReplay::Size()
+{
+    uint64_t size = 0;
+    for (uint32_t actor = 0; actor < header->actor_count; actor++)
+        size += std::min<uint64_t>(partitions[actor].written.load(std::memory_order_relaxed), header->capacity_per_actor);
+    return size;
+}
+
+uint64_t SharedReplay::TotalWritten()
+{
+    uint64_t total = 0;
+    for (uint32_t actor = 0; actor < header->actor_count; actor++)
+        total += partitions[actor].written.load(std::memory_order_relaxed);
+    return total;
+}
+
+void SharedReplay::RequestShutdown()
+{
+    header->shutdown.store(1, std::memory_order_release);
+}
+
+void SharedReplay::ClearShutdown()
+{
+    header->shutdown.store(0, std::memory_order_release);
+}
+
+bool SharedReplay::ShutdownRequested()
+{
+    return header->shutdown.load(std::memory_order_acquire) != 0;
+}
+
+SharedReplay::Slot* SharedReplay::GetSlot(int actor, uint64_t index)
+{
+    uint64_t slotIndex = static_cast<uint64_t>(actor) * header->capacity_per_actor + index;
+    return reinterpret_cast<Slot*>(slots + slotIndex * header->slot_bytes);
+}
+
+bool SharedReplay::ReadSlot(Slot* slot, uint8_t* state, uint8_t* nextState, float& action, float& reward, float& done)
+{
+    uint64_t before = slot->sequence.load(std::memory_order_acquire);
+    if (before % 2 == 1)
+        return false;
+
+    action = static_cast<float>(slot->action);
+    reward = slot->reward;
+    done = static_cast<float>(slot->terminated);
+    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(slot + 1);
+    std::memcpy(state, pixels, header->observation_bytes);
+    std::memcpy(nextState, pixels + header->observation_bytes, header->observation_bytes);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->sequence.load(std::memory_order_relaxed) == before;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DQN.h"
+#include "SharedMemory.h"
+#include "Metrics.h"
+
+// Replay ring living in shared memory. Every actor process owns one partition and is its only writer,
+// the learner samples all partitions directly. The same segment carries the control block:
+// the latest network weights (seqlock), the exploration rate and the shutdown flag, and one metric ring per actor.
+class SharedReplay
+{
+public:
+	static constexpr size_t maxConvLayers = 8;
+	static constexpr size_t maxHiddenLayers = 8;
+
+	// The learner's NetworkSpec as plain data. Weights are published as one flat array, so actors have
+	// to build exactly this network for the offsets to line up.
+	struct NetworkLayout
+	{
+		int32_t input_channels;
+		int32_t input_height;
+		int32_t input_width;
+		uint32_t conv_count;
+		ConvLayerSpec conv_layers[maxConvLayers];
+		uint32_t hidden_count;
+		int32_t hidden_layers[maxHiddenLayers];
+		uint8_t softmax_output;
+
+		NetworkSpec ToSpec() const;
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t actor_count;
+		uint32_t capacity_per_actor;
+		uint32_t action_count;
+		ObservationSpec observation;
+		NetworkLayout network;
+		uint64_t observation_bytes;
+		uint64_t slot_bytes;
+		uint64_t weight_count;
+		std::atomic<uint64_t> weight_version;
+		std::atomic<uint32_t> shutdown;
+		std::atomic<float> epsilon;
+		std::atomic<uint32_t> throttle;  // Set while the learner is too far behind the target replay ratio
+		std::atomic<int32_t> spectated_env;  // actor * environments + environment, -1 when nobody watches
+	};
+
+	struct Partition
+	{
+		std::atomic<uint64_t> written;   // Transitions ever written, the ring cursor is written % capacity
+		std::atomic<uint64_t> episodes;
+		std::atomic<float> last_score;
+		uint8_t padding[64 - 2 * sizeof(uint64_t) - sizeof(float)];
+	};
+
+	static constexpr size_t maxSpectatorShapes = 512;
+
+	// Latest shapes of the watched environment, published by its actor a few times per second (seqlock)
+	struct Spectator
+	{
+		std::atomic<uint64_t> sequence;  // Odd while the actor is writing
+		int32_t env;
+		uint32_t episode;
+		uint32_t step;
+		float score;
+		uint32_t shape_count;
+		ShapeSnapshot shapes[maxSpectatorShapes];
+	};
+
+	// Learner side copy of the spectator block
+	struct SpectatorFrame
+	{
+		int32_t env = -1;
+		uint32_t episode = 0;
+		uint32_t step = 0;
+		float score = 0.0f;
+		std::vector<ShapeSnapshot> shapes;
+	};
+
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence;  // Odd while the actor is writing the slot
+		int32_t action;
+		float reward;
+		uint8_t terminated;
+		uint8_t truncated;
+		// Followed by the state and next state pixels
+	};
+
+	SharedReplay() {};
+	// Fails for specs with more layers than the layout holds
+	bool Create(const std::string& name, int actorCount, int capacityPerActor, const ObservationSpec& observation, int actionCount, const NetworkSpec& network, int64_t weightCount);
+	bool Open(const std::string& name);
+	// Size of the whole segment, dominated by the slots: two raw observations per transition
+	static size_t SegmentBytes(int actorCount, int capacityPerActor, const ObservationSpec& observation, int64_t weightCount);
+	// Actor side
+	void Add(int actor, const uint8_t* state, const uint8_t* nextState, Action action, float reward, bool terminated, bool truncated);
+	void EndEpisode(int actor, float score, int steps);
+	bool PullWeights(QNetworkImpl& network, uint64_t& version);
+	void PublishSpectator(int env, uint32_t episode, uint32_t step, float score, const ShapeSnapshot* shapes, size_t count);
+	// Learner side
+	Tensor_step_return Sample(int batchSize, std::mt19937& rng);
+	void PublishWeights(QNetworkImpl& network);
+	uint64_t Size();
+	uint64_t TotalWritten();
+	void RequestShutdown();
+	bool ShutdownRequested();
+	// Lets actors spawned after a shutdown run again
+	void ClearShutdown();
+	// Each actor pushes its episode statistics here, the learner attaches the rings to its metrics pipeline
+	MetricRing* MetricsOf(int actor);
+	// Copies the spectator block when it changed since sequence, never waits for the writing actor
+	bool ReadSpectator(SpectatorFrame& frame, uint64_t& sequence);
+
+	Header* header = nullptr;
+	Partition* partitions = nullptr;
+
+private:
+	static size_t SlotBytes(const ObservationSpec& observation);
+	static size_t MetricRingBytes();
+	Slot* GetSlot(int actor, uint64_t index);
+	bool ReadSlot(Slot* slot, uint8_t* state, uint8_t* nextState, float& action, float& reward, float& done);
+
+	SharedMemory memory;
+	float* weights = nullptr;
+	uint8_t* slots = nullptr;
+	uint8_t* metricRings = nullptr;
+	Spectator* spectator = nullptr;
+	std::vector<float> weightStaging;
+};
@@ -0,0 +1,435 @@
+#include "Sweep.h"
+#include "ThreadTopology.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+    const double noScore = -std::numeric_limits<double>::infinity();
+
+    using Clock = std::chrono::steady_clock;
+
+    std::string trim(const std::string& text)
+    {
+        size_t begin = text.find_first_not_of(" \t\r\n");
+        size_t end = text.find_last_not_of(" \t\r\n");
+        return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+    }
+
+    sf::Image render(sf::RenderTexture& target, LevelData& level)
+    {
+        target.clear();
+        level.DrawScene(target);
+        target.display();
+        return target.getTexture().copyToImage();
+    }
+
+    // Scores reported at every rung. Trials are judged as they arrive instead of waiting for a full
+    // rung, so a slot never idles; the first few trials at a rung always go on.
+    class RungBoard
+    {
+    public:
+        RungBoard(int rungs, float keep_fraction, int min_trials)
+            : scores(std::max(0, rungs)), keep_fraction(keep_fraction), min_trials(min_trials) {}
+
+        bool keep(int rung, double score)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<double>& reported = scores[rung];
+            reported.push_back(score);
+            if (static_cast<int>(reported.size()) < min_trials)
+                return true;
+            std::vector<double> sorted = reported;
+            std::sort(sorted.begin(), sorted.end(), std::greater<double>());
+            size_t kept = std::max<size_t>(1, static_cast<size_t>(std::ceil(sorted.size() * keep_fraction)));
+            return score >= sorted[std::min(kept, sorted.size()) - 1];
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<std::vector<double>> scores;
+        float keep_fraction;
+        int min_trials;
+    };
+
+    SweepResult runTrial(const SweepConfig& config, const SweepTrial& trial, const LevelData& pristine,
+        RungBoard& board, sf::RenderTexture& target, std::mutex& construct_mutex)
+    {
+        SweepResult result;
+        result.trial = trial.index;
+        result.parameters = trial.describe();
+        Clock::time_point start = Clock::now();
+
+        ObservationSpec observation;
+        std::unique_ptr<DQN> agent;
+        {
+            // QNetwork seeds torch's global generator, trials built side by side would mix their initial weights
+            std::lock_guard<std::mutex> lock(construct_mutex);
+            agent = std::make_unique<DQN>(observation.channels, actionCount, config.seed, NetworkSpec::compact(observation), trial.hyperparameters);
+        }
+        agent->buffer.action_log = std::make_shared<ActionLogReplay>(agent->buffer.buffer_size, observation,
+            std::max(1, config.decode_threads), config.cached_frames);
+
+        uint64_t budget = static_cast<uint64_t>(std::max(1, config.steps_per_trial));
+        std::vector<uint64_t> rungSteps;
+        for (int rung = 0; rung < config.rungs; rung++)
+            rungSteps.push_back(budget * (rung + 1) / (config.rungs + 1));
+        size_t nextRung = 0;
+
+        std::deque<double> recent;
+        double recentSum = 0.0;
+        result.best_return = noScore;
+
+        std::unique_ptr<LevelData> level;
+        sf::Image previous;
+        float score = 0.0f;
+        int episodeSteps = 0;
+        bool done = true;
+        uint64_t steps = 0;
+        while (steps < budget)
+        {
+            if (done)
+            {
+                level = std::make_unique<LevelData>(pristine);
+                level->SetTermination(config.termination);
+                level->StartSimulation(true);
+                agent->beginActionLogEpisode(config.level, config.dt);
+                previous = render(target, *level);
+                score = 0.0f;
+                episodeSteps = 0;
+                done = false;
+            }
+
+            int action = agent->act(previous, agent->hyperparameters.epsilon(steps));
+            Optimize_Step_return step_return = level->Update(config.dt, static_cast<Action>(action));
+            sf::Image next = render(target, *level);
+            episodeSteps++;
+            score += step_return.reward;
+            step_return.truncated = step_return.truncated || (!step_return.terminated && episodeSteps >= config.max_steps);
+            agent->addToActionLog(step_return);
+            agent->step();
+            previous = next;
+            steps++;
+
+            if (step_return.terminated || step_return.truncated)
+            {
+                done = true;
+                result.episodes++;
+                recent.push_back(score);
+                recentSum += score;
+                if (static_cast<int>(recent.size()) > std::max(1, config.score_episodes))
+                {
+                    recentSum -= recent.front();
+                    recent.pop_front();
+                }
+                result.best_return = std::max(result.best_return, recentSum / recent.size());
+            }
+
+            if (nextRung < rungSteps.size() && steps >= rungSteps[nextRung])
+            {
+                double windowMean = recent.empty() ? noScore : recentSum / recent.size();
+                if (!board.keep(static_cast<int>(nextRung), windowMean))
+                {
+                    result.stopped_at_rung = static_cast<int>(nextRung);
+                    break;
+                }
+                nextRung++;
+            }
+        }
+
+        result.steps = steps;
+        result.mean_return = recent.empty() ? noScore : recentSum / recent.size();
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return result;
+    }
+
+    std::string status(const SweepResult& result)
+    {
+        if (result.failed)
+            return "failed";
+        if (result.stopped_at_rung >= 0)
+            return "rung " + std::to_string(result.stopped_at_rung + 1);
+        return "done";
+    }
+
+    std::string formatReturn(double value)
+    {
+        if (!std::isfinite(value))
+            return "-";
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(1) << value;
+        return os.str();
+    }
+}
+
+SweepConfig SweepConfig::fromArguments(int argc, char* argv[])
+{
+    SweepConfig config;
+    if (argc < 4)
+        throw std::runtime_error("Usage: --sweep <grid file> <level> [parallel trials] [steps per trial] [csv]");
+    config.grid_path = argv[2];
+    config.level = argv[3];
+    if (argc > 4) config.parallel_trials = std::max(0, std::stoi(argv[4]));
+    if (argc > 5) config.steps_per_trial = std::max(1, std::stoi(argv[5]));
+    if (argc > 6) config.csv_path = argv[6];
+    return config;
+}
+
+std::string SweepTrial::describe() const
+{
+    std::string text;
+    for (auto& assignment : assignments)
+        text += (text.empty() ? "" : " ") + assignment.first + "=" + assignment.second;
+    return text.empty() ? "defaults" : text;
+}
+
+std::vector<SweepTrial> expandGrid(const std::string& path)
+{
+    std::ifstream is(path);
+    if (!is.is_open())
+        throw std::runtime_error("Could not open the sweep grid " + path + ".");
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> axes;
+    int lineNumber = 0;
+    for (std::string line; std::getline(is, line);)
+    {
+        lineNumber++;
+        line = trim(line.substr(0, line.find('#')));
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            continue;
+        std::string name = trim(line.substr(0, equals));
+        std::vector<std::string> values;
+        std::stringstream ss(line.substr(equals + 1));
+        for (std::string value; std::getline(ss, value, ',');)
+        {
+            value = trim(value);
+            if (value.empty())
+                continue;
+            // Checked here so a bad entry fails the sweep before the first trial trains
+            try
+            {
+                Hyperparameters().set(name, value);
+            }
+            catch (const std::logic_error&)
+            {
+                // stod only reports its own name
+                throw std::runtime_error(path + " line " + std::to_string(lineNumber) + ": \"" + value + "\" is not a number for " + name + ".");
+            }
+            values.push_back(value);
+        }
+        if (!values.empty())
+            axes.emplace_back(name, values);
+    }
+
+    // The last axis of the file varies fastest
+    std::vector<SweepTrial> trials(1);
+    for (auto& axis : axes)
+    {
+        std::vector<SweepTrial> expanded;
+        for (auto& trial : trials)
+            for (auto& value : axis.second)
+            {
+                SweepTrial next = trial;
+                next.assignments.emplace_back(axis.first, value);
+                next.hyperparameters.set(axis.first, value);
+                expanded.push_back(next);
+            }
+        trials = std::move(expanded);
+    }
+    for (size_t i = 0; i < trials.size(); i++)
+        trials[i].index = static_cast<int>(i);
+    return trials;
+}
+
+std::vector<SweepResult> runTrials(const SweepConfig& config, const std::vector<SweepTrial>& trials)
+{
+    std::vector<SweepResult> results(trials.size());
+    if (trials.empty())
+        return results;
+    for (size_t i = 0; i < trials.size(); i++)
+    {
+        results[i].trial = trials[i].index;
+        results[i].parameters = trials[i].describe();
+    }
+
+    // Parsed once, every episode of every trial starts from a copy
+    LevelData pristine;
+    try
+    {
+        pristine.LoadData(config.level);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to load the level " << config.level << ": " << e.what() << "\n";
+        for (auto& result : results)
+        {
+            result.failed = true;
+            result.error = e.what();
+        }
+        return results;
+    }
+
+    // All physical cores, NUMA node by node, cut into one contiguous group per parallel trial
+    ThreadPlanConfig planConfig;
+    ThreadPlan plan = ThreadTopology::BuildPlan(ThreadTopology::DetectCores(), planConfig);
+    int parallel = config.parallel_trials > 0 ? config.parallel_trials : plan.physical_cores / std::max(1, config.cores_per_trial);
+    parallel = std::max(1, std::min(parallel, static_cast<int>(trials.size())));
+    std::vector<std::vector<int>> slotCores = plan.SplitLearnerCores(parallel);
+    std::cout << trials.size() << " trial(s), " << parallel << " at a time";
+    if (!slotCores.empty())
+        std::cout << " on " << slotCores.front().size() << " core(s) each";
+    std::cout << "\n";
+
+    RungBoard board(config.rungs, config.keep_fraction, config.min_trials_per_rung);
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> finished{ 0 };
+    std::mutex construct_mutex;
+    std::mutex print_mutex;
+
+    // The intra-op thread count is a single setting of the process, not one per slot thread, so it is
+    // set once to the smallest core group before any slot starts
+    if (!slotCores.empty())
+    {
+        size_t slotThreads = slotCores.front().size();
+        for (auto& cores : slotCores)
+            slotThreads = std::min(slotThreads, cores.size());
+        torch::set_num_threads(static_cast<int>(std::max<size_t>(1, slotThreads)));
+    }
+
+    auto work = [&](int slot) {
+        // Threads of torch's OpenMP pool are started by this thread and inherit its cores
+        if (!slotCores.empty())
+            ThreadTopology::PinCurrentThread(slotCores[slot % slotCores.size()]);
+
+        ObservationSpec observation;
+        sf::RenderTexture target;
+        if (!target.create(observation.width, observation.height))
+        {
+            std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << "Sweep slot " << slot << " could not create its render texture.\n";
+            return;
+        }
+
+        for (size_t item = next++; item < trials.size(); item = next++)
+        {
+            try
+            {
+                results[item] = runTrial(config, trials[item], pristine, board, target, construct_mutex);
+            }
+            catch (const std::exception& e)
+            {
+                results[item].failed = true;
+                results[item].error = e.what();
+            }
+
+            size_t done = ++finished;
+            const SweepResult& result = results[item];
+            std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << "[" << done << "/" << trials.size() << "] trial " << result.trial << " (" << result.parameters << "): "
+                << status(result) << " after " << result.steps << " steps, return " << formatReturn(result.mean_return);
+            if (result.failed)
+                std::cout << ", " << result.error;
+            std::cout << "\n";
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < parallel; i++)
+        threads.emplace_back(work, i);
+    for (auto& thread : threads)
+        thread.join();
+
+    // A slot without a render texture leaves its trials to the others, only when every slot failed are some never run
+    for (size_t item = next; item < trials.size(); item++)
+    {
+        results[item].failed = true;
+        results[item].error = "no sweep slot could create a render texture";
+    }
+    return results;
+}
+
+int runSweep(const SweepConfig& config)
+{
+    std::vector<SweepTrial> trials;
+    try
+    {
+        trials = expandGrid(config.grid_path);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    std::vector<SweepResult> results = runTrials(config, trials);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Trials that used their whole budget first, then by the rung they got to, the return decides within those
+    std::sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) {
+        if (a.failed != b.failed)
+            return !a.failed;
+        int reachedA = a.stopped_at_rung < 0 ? std::numeric_limits<int>::max() : a.stopped_at_rung;
+        int reachedB = b.stopped_at_rung < 0 ? std::numeric_limits<int>::max() : b.stopped_at_rung;
+        if (reachedA != reachedB)
+            return reachedA > reachedB;
+        return a.mean_return > b.mean_return;
+    });
+
+    std::cout << "\n" << std::setw(4) << "rank" << std::setw(7) << "trial" << "  " << std::left << std::setw(48) << "parameters"
+        << std::right << std::setw(8) << "status" << std::setw(10) << "steps" << std::setw(10) << "episodes"
+        << std::setw(10) << "return" << std::setw(10) << "best" << std::setw(10) << "seconds" << "\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SweepResult& result = results[i];
+        std::cout << std::setw(4) << i + 1 << std::setw(7) << result.trial << "  " << std::left << std::setw(48) << result.parameters
+            << std::right << std::setw(8) << status(result) << std::setw(10) << result.steps << std::setw(10) << result.episodes
+            << std::setw(10) << formatReturn(result.mean_return) << std::setw(10) << formatReturn(result.best_return)
+            << std::fixed << std::setprecision(0) << std::setw(10) << result.seconds << "\n";
+    }
+
+    int stopped = 0;
+    uint64_t steps = 0;
+    for (auto& result : results)
+    {
+        stopped += result.stopped_at_rung >= 0 ? 1 : 0;
+        steps += result.steps;
+    }
+    std::cout << "\n" << results.size() << " trial(s), " << stopped << " stopped early, " << steps << " steps in "
+        << std::fixed << std::setprecision(1) << seconds << " s";
+    if (!results.empty() && !results.front().failed)
+        std::cout << ", best: " << results.front().parameters;
+    std::cout << "\n";
+
+    if (!config.csv_path.empty())
+    {
+        std::ofstream os(config.csv_path);
+        if (!os.is_open())
+        {
+            std::cout << "Could not write " << config.csv_path << "\n";
+            return 1;
+        }
+        os << "rank,trial,parameters,status,steps,episodes,mean_return,best_return,seconds\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const SweepResult& result = results[i];
+            os << i + 1 << "," << result.trial << "," << result.parameters << "," << status(result) << "," << result.steps << ","
+                << result.episodes << "," << formatReturn(result.mean_return) << "," << formatReturn(result.best_return) << ","
+                << result.seconds << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DQN.h"
+
+struct SweepConfig
+{
+	std::string grid_path;     // name = value[, value...] lines, every combination is one trial
+	std::string level;
+	int parallel_trials = 0;   // 0 gives every trial cores_per_trial physical cores
+	int cores_per_trial = 2;
+	int steps_per_trial = 200000;
+	// Early stopping: a trial reaching one of the rungs, spread evenly over its steps, stops when its
+	// return is below the best keep_fraction of the trials that already reached that rung
+	int rungs = 3;
+	float keep_fraction = 0.5f;
+	int min_trials_per_rung = 3;  // Fewer reports than this never stop a trial
+	int score_episodes = 20;      // The latest episodes a trial's return is averaged over
+	float dt = 0.02f;
+	int max_steps = 10000;
+	TerminationConfig termination{ 60.0f, 0, 1500, 250 };
+	int seed = 0;                 // The same for every trial, only the hyperparameters differ
+	// Trials keep their replay as an ActionLogReplay: a step costs a few bytes instead of two float
+	// screenshots, so buffer_size no longer decides whether parallel trials fit in memory. What a trial
+	// holds on top of its network is the decoded frame cache, cached_frames RGBA8 observations (about
+	// 2.5 MB each at 800x800), and the sampled batches.
+	int decode_threads = 2;       // Per trial, re-simulating the sampled episodes
+	size_t cached_frames = 128;
+	std::string csv_path;         // One row per trial, empty only prints them
+
+	// --sweep <grid file> <level> [parallel trials] [steps per trial] [csv]
+	static SweepConfig fromArguments(int argc, char* argv[]);
+};
+
+struct SweepTrial
+{
+	int index = 0;
+	std::vector<std::pair<std::string, std::string>> assignments;  // Only the names the grid sets
+	Hyperparameters hyperparameters;
+
+	std::string describe() const;
+};
+
+struct SweepResult
+{
+	int trial = 0;
+	std::string parameters;
+	uint64_t steps = 0;
+	int episodes = 0;
+	double mean_return = 0.0;   // Over the latest score_episodes episodes
+	double best_return = 0.0;   // Best such average seen during the trial
+	int stopped_at_rung = -1;   // -1 for trials that used their whole budget
+	double seconds = 0.0;
+	bool failed = false;
+	std::string error;
+};
+
+// Every combination of the grid file's values, unknown names are rejected before anything trains
+std::vector<SweepTrial> expandGrid(const std::string& path);
+// Trains the trials parallel_trials at a time, each on its own share of the physical cores with its own
+// DQN and action log replay. The level is loaded once and every episode starts from a copy of it, chunked
+// levels additionally share the process wide chunk cache.
+std::vector<SweepResult> runTrials(const SweepConfig& config, const std::vector<SweepTrial>& trials);
+// Prints the trials ranked by their return, writes the csv when configured
+int runSweep(const SweepConfig& config);
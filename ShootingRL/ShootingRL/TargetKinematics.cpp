@@ -0,0 +1,512 @@
+#include "TargetKinematics.h"
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/gtx/norm.hpp"
+#include "algorithm"
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+#include "Utilities.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TARGET_KINEMATICS_SSE2
+#endif
+
+namespace {
+	const float goldenAngle = 137.50776f;
+	const float arrivalDistance = 0.5f;
+	const float minCellSize = 32.0f;
+}
+
+TargetMotion TargetKinematics::DefaultMotion(uint64_t id)
+{
+	// Spread by the golden angle so neighbouring targets head in different directions
+	TargetMotion motion;
+	motion.target = static_cast<int>(id);
+	if (id < (1ull << 24))
+		motion.direction = 45.0f + goldenAngle * static_cast<float>(id);
+	else
+		motion.direction = 45.0f + static_cast<float>(std::fmod(goldenAngle * static_cast<double>(id % 1000003ull), 360.0));
+	return motion;
+}
+
+void TargetKinematics::Build(const Lines& lines, const std::vector<TargetMotion>& motions, glm::vec2 boundsMin, glm::vec2 boundsMax)
+{
+	*this = TargetKinematics();
+	int targetNumber = 0;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lines[i].second != ShapeType::MovingTarget)
+			continue;
+		auto motion = std::find_if(motions.begin(), motions.end(), [&](const TargetMotion& m) { return m.target == targetNumber; });
+		AddTarget(lines, static_cast<int>(i), static_cast<uint64_t>(targetNumber), motion != motions.end() ? *motion : DefaultMotion(targetNumber), nullptr);
+		targetNumber++;
+	}
+	FinishUpdate(lines, boundsMin, boundsMax);
+}
+
+void TargetKinematics::BeginUpdate(const Lines& lines, const std::vector<uint64_t>& lineIds, std::vector<std::pair<uint64_t, TargetState>>& removed)
+{
+	// The grid is rebuilt by FinishUpdate, targets are moved around freely until then
+	for (auto& list : cells)
+		list.clear();
+	std::unordered_map<uint64_t, int32_t> lineOf;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lines[i].second == ShapeType::MovingTarget)
+			lineOf[lineIds[i]] = static_cast<int32_t>(i);
+	}
+	for (int i = static_cast<int>(x.size()) - 1; i >= 0; i--) {
+		auto found = lineOf.find(id[i]);
+		if (found != lineOf.end()) {
+			line[i] = found->second;
+			continue;
+		}
+		removed.push_back({ id[i], TargetState{ x[i], y[i], vx[i], vy[i], waypoint[i], heading[i] } });
+		int last = static_cast<int>(x.size()) - 1;
+		if (i != last)
+			MoveTarget(last, i);
+		PopTarget();
+	}
+}
+
+void TargetKinematics::AddTarget(const Lines& lines, int lineIndex, uint64_t targetId, const TargetMotion& definition, const TargetState* state)
+{
+	const sf::RectangleShape& shape = lines[lineIndex].first;
+	std::vector<sf::Vector2f> corners = sf::GetRectangleCorners(shape);
+	glm::vec2 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+	for (auto& corner : corners) {
+		low = glm::min(low, glm::vec2(corner.x, corner.y));
+		high = glm::max(high, glm::vec2(corner.x, corner.y));
+	}
+	glm::vec2 center = (low + high) * 0.5f;
+	glm::vec2 half = (high - low) * 0.5f;
+
+	x.push_back(center.x);
+	y.push_back(center.y);
+	halfWidth.push_back(half.x);
+	halfHeight.push_back(half.y);
+	radius.push_back(std::max(half.x, half.y));
+	offsetX.push_back(shape.getPosition().x - center.x);
+	offsetY.push_back(shape.getPosition().y - center.y);
+	speed.push_back(definition.speed);
+	line.push_back(static_cast<int32_t>(lineIndex));
+	id.push_back(targetId);
+	heading.push_back(1);
+	waypoint.push_back(0);
+	cell.push_back(-1);
+	slot.push_back(-1);
+
+	bool followsPath = definition.type != MotionType::Bounce && !definition.waypoints.empty();
+	type.push_back(static_cast<uint8_t>(followsPath ? definition.type : MotionType::Bounce));
+	if (followsPath) {
+		std::vector<glm::vec2> points;
+		for (auto& point : definition.waypoints)
+			points.push_back(glm::vec2(point.x, point.y));
+		path.push_back(static_cast<int32_t>(paths.size()));
+		paths.push_back(points);
+		vx.push_back(0.0f);
+		vy.push_back(0.0f);
+	}
+	else {
+		float radians = glm::radians(definition.direction);
+		path.push_back(-1);
+		vx.push_back(std::cos(radians) * definition.speed);
+		vy.push_back(std::sin(radians) * definition.speed);
+	}
+
+	// A target coming back keeps moving from where it was when its chunk was dropped
+	if (state != nullptr) {
+		size_t i = x.size() - 1;
+		x[i] = state->x;
+		y[i] = state->y;
+		vx[i] = state->vx;
+		vy[i] = state->vy;
+		if (path[i] >= 0 && state->waypoint >= 0 && state->waypoint < static_cast<int32_t>(paths[path[i]].size())) {
+			waypoint[i] = state->waypoint;
+			heading[i] = state->heading;
+		}
+	}
+}
+
+void TargetKinematics::FinishUpdate(const Lines& lines, glm::vec2 boundsMin, glm::vec2 boundsMax)
+{
+	this->boundsMin = boundsMin;
+	this->boundsMax = boundsMax;
+
+	// Paths of removed targets are dropped, the others keep their order
+	size_t pathsInUse = static_cast<size_t>(std::count_if(path.begin(), path.end(), [](int32_t p) { return p >= 0; }));
+	if (pathsInUse != paths.size()) {
+		std::vector<std::vector<glm::vec2>> kept;
+		for (size_t i = 0; i < x.size(); i++) {
+			if (path[i] < 0)
+				continue;
+			kept.push_back(std::move(paths[path[i]]));
+			path[i] = static_cast<int32_t>(kept.size()) - 1;
+		}
+		paths.swap(kept);
+	}
+
+	for (auto* values : { &wallX, &wallY, &wallAxisX, &wallAxisY, &wallHalfWidth, &wallHalfHeight })
+		values->clear();
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lines[i].second != ShapeType::EnvironmentLine)
+			continue;
+		const sf::RectangleShape& shape = lines[i].first;
+		std::vector<sf::Vector2f> corners = sf::GetRectangleCorners(shape);
+		glm::vec2 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+		for (auto& corner : corners) {
+			low = glm::min(low, glm::vec2(corner.x, corner.y));
+			high = glm::max(high, glm::vec2(corner.x, corner.y));
+		}
+		glm::vec2 center = (low + high) * 0.5f;
+		glm::vec2 axis = glm::vec2(corners[1].x - corners[0].x, corners[1].y - corners[0].y);
+		float length = glm::length(axis);
+		wallX.push_back(center.x);
+		wallY.push_back(center.y);
+		wallAxisX.push_back(length > 0.0f ? axis.x / length : 1.0f);
+		wallAxisY.push_back(length > 0.0f ? axis.y / length : 0.0f);
+		wallHalfWidth.push_back(shape.getSize().x * 0.5f);
+		wallHalfHeight.push_back(shape.getSize().y * 0.5f);
+	}
+
+	maxRadius = 0.0f;
+	for (float r : radius)
+		maxRadius = std::max(maxRadius, r);
+
+	// A target only ever overlaps the cells next to the one holding its center
+	cellSize = std::max(minCellSize, maxRadius * 2.0f);
+	columns = std::max(1, static_cast<int>(std::ceil((boundsMax.x - boundsMin.x) / cellSize)));
+	rows = std::max(1, static_cast<int>(std::ceil((boundsMax.y - boundsMin.y) / cellSize)));
+	cells.assign(static_cast<size_t>(columns) * rows, {});
+	visited.assign(cells.size(), 0);
+	visitStamp = 0;
+
+	// Walls go into every cell a target touching them could have its center in
+	std::vector<std::vector<int32_t>> wallCells(cells.size());
+	for (size_t w = 0; w < wallX.size(); w++) {
+		float extentX = std::abs(wallAxisX[w]) * wallHalfWidth[w] + std::abs(wallAxisY[w]) * wallHalfHeight[w] + maxRadius;
+		float extentY = std::abs(wallAxisY[w]) * wallHalfWidth[w] + std::abs(wallAxisX[w]) * wallHalfHeight[w] + maxRadius;
+		int x0 = std::clamp(static_cast<int>((wallX[w] - extentX - boundsMin.x) / cellSize), 0, columns - 1);
+		int x1 = std::clamp(static_cast<int>((wallX[w] + extentX - boundsMin.x) / cellSize), 0, columns - 1);
+		int y0 = std::clamp(static_cast<int>((wallY[w] - extentY - boundsMin.y) / cellSize), 0, rows - 1);
+		int y1 = std::clamp(static_cast<int>((wallY[w] + extentY - boundsMin.y) / cellSize), 0, rows - 1);
+		for (int cy = y0; cy <= y1; cy++)
+			for (int cx = x0; cx <= x1; cx++)
+				wallCells[static_cast<size_t>(cy) * columns + cx].push_back(static_cast<int32_t>(w));
+	}
+	wallStart.assign(cells.size() + 1, 0);
+	wallIndices.clear();
+	for (size_t c = 0; c < wallCells.size(); c++) {
+		wallStart[c + 1] = wallStart[c] + static_cast<int32_t>(wallCells[c].size());
+		wallIndices.insert(wallIndices.end(), wallCells[c].begin(), wallCells[c].end());
+	}
+
+	cell.assign(x.size(), -1);
+	slot.assign(x.size(), -1);
+	for (size_t i = 0; i < x.size(); i++)
+		Insert(static_cast<int>(i), CellOf(x[i], y[i]));
+	active = !x.empty();
+}
+
+void TargetKinematics::MoveTarget(int from, int to)
+{
+	x[to] = x[from]; y[to] = y[from];
+	vx[to] = vx[from]; vy[to] = vy[from];
+	halfWidth[to] = halfWidth[from]; halfHeight[to] = halfHeight[from]; radius[to] = radius[from];
+	offsetX[to] = offsetX[from]; offsetY[to] = offsetY[from];
+	speed[to] = speed[from];
+	line[to] = line[from];
+	id[to] = id[from];
+	type[to] = type[from];
+	path[to] = path[from]; waypoint[to] = waypoint[from]; heading[to] = heading[from];
+	cell[to] = cell[from]; slot[to] = slot[from];
+}
+
+void TargetKinematics::PopTarget()
+{
+	for (auto* values : { &x, &y, &vx, &vy, &halfWidth, &halfHeight, &radius, &offsetX, &offsetY, &speed })
+		values->pop_back();
+	for (auto* values : { &line, &path, &waypoint, &heading, &cell, &slot })
+		values->pop_back();
+	id.pop_back();
+	type.pop_back();
+}
+
+bool TargetKinematics::IsActive() const
+{
+	return active;
+}
+
+size_t TargetKinematics::Count() const
+{
+	return x.size();
+}
+
+int TargetKinematics::CellOf(float px, float py) const
+{
+	int cx = std::clamp(static_cast<int>((px - boundsMin.x) / cellSize), 0, columns - 1);
+	int cy = std::clamp(static_cast<int>((py - boundsMin.y) / cellSize), 0, rows - 1);
+	return cy * columns + cx;
+}
+
+void TargetKinematics::Insert(int target, int cellIndex)
+{
+	cell[target] = cellIndex;
+	slot[target] = static_cast<int32_t>(cells[cellIndex].size());
+	cells[cellIndex].push_back(target);
+}
+
+void TargetKinematics::Unlink(int target)
+{
+	// Swap-remove, the target moved into the hole gets its slot updated
+	std::vector<int32_t>& list = cells[cell[target]];
+	int32_t moved = list.back();
+	list[slot[target]] = moved;
+	slot[moved] = slot[target];
+	list.pop_back();
+	cell[target] = -1;
+	slot[target] = -1;
+}
+
+void TargetKinematics::Step(float dt)
+{
+	if (!active || dt <= 0.0f)
+		return;
+	SteerAlongPaths(dt);
+	Integrate(dt);
+	CollideWithWalls();
+
+	// The broad-phase is only touched by targets that changed cells
+	for (size_t i = 0; i < x.size(); i++) {
+		int now = CellOf(x[i], y[i]);
+		if (now != cell[i]) {
+			Unlink(static_cast<int>(i));
+			Insert(static_cast<int>(i), now);
+		}
+	}
+}
+
+void TargetKinematics::SteerAlongPaths(float dt)
+{
+	for (size_t i = 0; i < x.size(); i++) {
+		if (path[i] < 0)
+			continue;
+		const std::vector<glm::vec2>& points = paths[path[i]];
+		glm::vec2 position(x[i], y[i]);
+		glm::vec2 delta = points[waypoint[i]] - position;
+		float distance = glm::length(delta);
+		if (distance <= std::max(arrivalDistance, speed[i] * dt)) {
+			int count = static_cast<int>(points.size());
+			if (static_cast<MotionType>(type[i]) == MotionType::Loop) {
+				waypoint[i] = (waypoint[i] + 1) % count;
+			}
+			else if (count > 1) {
+				if (waypoint[i] + heading[i] < 0 || waypoint[i] + heading[i] >= count)
+					heading[i] = -heading[i];
+				waypoint[i] += heading[i];
+			}
+			delta = points[waypoint[i]] - position;
+			distance = glm::length(delta);
+		}
+		// Never overshoots the waypoint, the next step turns towards the following one
+		float step = distance > 0.0f ? std::min(speed[i], distance / dt) / distance : 0.0f;
+		vx[i] = delta.x * step;
+		vy[i] = delta.y * step;
+	}
+}
+
+void TargetKinematics::Integrate(float dt)
+{
+	// Moves every target and reflects it off the level bounds without branches
+	size_t count = x.size();
+	size_t i = 0;
+#ifdef TARGET_KINEMATICS_SSE2
+	const __m128 step = _mm_set1_ps(dt);
+	const __m128 minX = _mm_set1_ps(boundsMin.x), maxX = _mm_set1_ps(boundsMax.x);
+	const __m128 minY = _mm_set1_ps(boundsMin.y), maxY = _mm_set1_ps(boundsMax.y);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	auto reflect = [&](__m128& position, __m128& velocity, __m128 half, __m128 low, __m128 high) {
+		__m128 lowest = _mm_add_ps(low, half);
+		__m128 highest = _mm_sub_ps(high, half);
+		__m128 below = _mm_cmplt_ps(position, lowest);
+		__m128 above = _mm_cmpgt_ps(position, highest);
+		// Mirrored back inside, the velocity points away from the crossed bound afterwards
+		__m128 mirroredLow = _mm_sub_ps(_mm_mul_ps(two, lowest), position);
+		__m128 mirroredHigh = _mm_sub_ps(_mm_mul_ps(two, highest), position);
+		position = _mm_or_ps(_mm_andnot_ps(_mm_or_ps(below, above), position),
+			_mm_or_ps(_mm_and_ps(below, mirroredLow), _mm_and_ps(above, mirroredHigh)));
+		__m128 magnitude = _mm_andnot_ps(signMask, velocity);
+		__m128 negative = _mm_or_ps(signMask, magnitude);
+		velocity = _mm_or_ps(_mm_andnot_ps(_mm_or_ps(below, above), velocity),
+			_mm_or_ps(_mm_and_ps(below, magnitude), _mm_and_ps(above, negative)));
+	};
+	for (; i + 4 <= count; i += 4) {
+		__m128 px = _mm_loadu_ps(&x[i]), py = _mm_loadu_ps(&y[i]);
+		__m128 qx = _mm_loadu_ps(&vx[i]), qy = _mm_loadu_ps(&vy[i]);
+		px = _mm_add_ps(px, _mm_mul_ps(qx, step));
+		py = _mm_add_ps(py, _mm_mul_ps(qy, step));
+		reflect(px, qx, _mm_loadu_ps(&halfWidth[i]), minX, maxX);
+		reflect(py, qy, _mm_loadu_ps(&halfHeight[i]), minY, maxY);
+		_mm_storeu_ps(&x[i], px);
+		_mm_storeu_ps(&y[i], py);
+		_mm_storeu_ps(&vx[i], qx);
+		_mm_storeu_ps(&vy[i], qy);
+	}
+#endif
+	for (; i < count; i++) {
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+		float lowX = boundsMin.x + halfWidth[i], highX = boundsMax.x - halfWidth[i];
+		float lowY = boundsMin.y + halfHeight[i], highY = boundsMax.y - halfHeight[i];
+		if (x[i] < lowX) { x[i] = 2.0f * lowX - x[i]; vx[i] = std::abs(vx[i]); }
+		else if (x[i] > highX) { x[i] = 2.0f * highX - x[i]; vx[i] = -std::abs(vx[i]); }
+		if (y[i] < lowY) { y[i] = 2.0f * lowY - y[i]; vy[i] = std::abs(vy[i]); }
+		else if (y[i] > highY) { y[i] = 2.0f * highY - y[i]; vy[i] = -std::abs(vy[i]); }
+	}
+}
+
+void TargetKinematics::CollideWithWalls()
+{
+	if (wallX.empty())
+		return;
+	for (size_t i = 0; i < x.size(); i++) {
+		if (path[i] >= 0)
+			continue;
+		int c = CellOf(x[i], y[i]);
+		for (int32_t k = wallStart[c]; k < wallStart[c + 1]; k++) {
+			int32_t w = wallIndices[k];
+			// Closest point of the wall box to the target center, in the wall's frame
+			float dx = x[i] - wallX[w], dy = y[i] - wallY[w];
+			float u = dx * wallAxisX[w] + dy * wallAxisY[w];
+			float v = -dx * wallAxisY[w] + dy * wallAxisX[w];
+			float cu = std::clamp(u, -wallHalfWidth[w], wallHalfWidth[w]);
+			float cv = std::clamp(v, -wallHalfHeight[w], wallHalfHeight[w]);
+			float nu = u - cu, nv = v - cv;
+			float distance = std::sqrt(nu * nu + nv * nv);
+			float penetration;
+			if (distance > 0.0f) {
+				if (distance >= radius[i])
+					continue;
+				nu /= distance;
+				nv /= distance;
+				penetration = radius[i] - distance;
+			}
+			else {
+				// Center inside the wall, leave through the nearest side
+				float outU = wallHalfWidth[w] - std::abs(u), outV = wallHalfHeight[w] - std::abs(v);
+				nu = outU < outV ? (u < 0.0f ? -1.0f : 1.0f) : 0.0f;
+				nv = outU < outV ? 0.0f : (v < 0.0f ? -1.0f : 1.0f);
+				penetration = std::min(outU, outV) + radius[i];
+			}
+			float normalX = nu * wallAxisX[w] - nv * wallAxisY[w];
+			float normalY = nu * wallAxisY[w] + nv * wallAxisX[w];
+			x[i] += normalX * penetration;
+			y[i] += normalY * penetration;
+			float along = vx[i] * normalX + vy[i] * normalY;
+			if (along < 0.0f) {
+				vx[i] -= 2.0f * along * normalX;
+				vy[i] -= 2.0f * along * normalY;
+			}
+		}
+	}
+}
+
+void TargetKinematics::Apply(Lines& lines) const
+{
+	for (size_t i = 0; i < x.size(); i++)
+		lines[line[i]].first.setPosition(x[i] + offsetX[i], y[i] + offsetY[i]);
+}
+
+void TargetKinematics::LineErased(int erased)
+{
+	int removed = -1;
+	for (size_t i = 0; i < line.size(); i++) {
+		if (line[i] == erased)
+			removed = static_cast<int>(i);
+		else if (line[i] > erased)
+			line[i]--;
+	}
+	if (removed < 0)
+		return;
+
+	// The last target takes the place of the removed one in every array and in its cell
+	Unlink(removed);
+	int last = static_cast<int>(x.size()) - 1;
+	if (removed != last) {
+		int lastCell = cell[last];
+		Unlink(last);
+		MoveTarget(last, removed);
+		Insert(removed, lastCell);
+	}
+	PopTarget();
+	active = !x.empty();
+}
+
+void TargetKinematics::CollectCell(int cellX, int cellY, std::vector<int>& out) const
+{
+	// Neighbours included, a target reaches at most half a cell beyond its own
+	for (int ny = std::max(0, cellY - 1); ny <= std::min(rows - 1, cellY + 1); ny++) {
+		for (int nx = std::max(0, cellX - 1); nx <= std::min(columns - 1, cellX + 1); nx++) {
+			size_t c = static_cast<size_t>(ny) * columns + nx;
+			if (visited[c] == visitStamp)
+				continue;
+			visited[c] = visitStamp;
+			for (int32_t target : cells[c])
+				out.push_back(line[target]);
+		}
+	}
+}
+
+void TargetKinematics::QueryBox(glm::vec2 min, glm::vec2 max, std::vector<int>& out) const
+{
+	out.clear();
+	if (!active)
+		return;
+	visitStamp++;
+	int x0 = CellOf(min.x, min.y) % columns, y0 = CellOf(min.x, min.y) / columns;
+	int x1 = CellOf(max.x, max.y) % columns, y1 = CellOf(max.x, max.y) / columns;
+	for (int cy = y0; cy <= y1; cy++)
+		for (int cx = x0; cx <= x1; cx++)
+			CollectCell(cx, cy, out);
+}
+
+void TargetKinematics::QuerySegment(glm::vec2 start, glm::vec2 end, std::vector<int>& out) const
+{
+	out.clear();
+	if (!active)
+		return;
+	visitStamp++;
+
+	// Walks the cells the segment crosses (Amanatides and Woo)
+	glm::vec2 from = (start - boundsMin) / cellSize;
+	glm::vec2 to = (end - boundsMin) / cellSize;
+	int cx = std::clamp(static_cast<int>(std::floor(from.x)), 0, columns - 1);
+	int cy = std::clamp(static_cast<int>(std::floor(from.y)), 0, rows - 1);
+	int endX = std::clamp(static_cast<int>(std::floor(to.x)), 0, columns - 1);
+	int endY = std::clamp(static_cast<int>(std::floor(to.y)), 0, rows - 1);
+	glm::vec2 direction = to - from;
+	int stepX = direction.x > 0.0f ? 1 : -1;
+	int stepY = direction.y > 0.0f ? 1 : -1;
+	float infinity = std::numeric_limits<float>::max();
+	float deltaX = direction.x != 0.0f ? std::abs(1.0f / direction.x) : infinity;
+	float deltaY = direction.y != 0.0f ? std::abs(1.0f / direction.y) : infinity;
+	float nextX = direction.x != 0.0f ? ((stepX > 0 ? std::floor(from.x) + 1.0f : std::floor(from.x)) - from.x) / direction.x : infinity;
+	float nextY = direction.y != 0.0f ? ((stepY > 0 ? std::floor(from.y) + 1.0f : std::floor(from.y)) - from.y) / direction.y : infinity;
+
+	for (int guard = 0; guard < columns + rows + 2; guard++) {
+		CollectCell(cx, cy, out);
+		if (cx == endX && cy == endY)
+			break;
+		if (nextX < nextY) {
+			cx += stepX;
+			nextX += deltaX;
+		}
+		else {
+			cy += stepY;
+			nextY += deltaY;
+		}
+		if (cx < 0 || cy < 0 || cx >= columns || cy >= rows)
+			break;
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include "SFML/Graphics.hpp"
+#include "glm/glm.hpp"
+#include <cereal/cereal.hpp>
+#include "cereal/types/vector.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "EnviromentObjectsType.h"
+
+enum class MotionType
+{
+	Bounce,  // Straight lines, reflected by walls and the level bounds
+	Patrol,  // Back and forth along the waypoints
+	Loop     // Through the waypoints and back to the first one
+};
+
+struct MotionWaypoint
+{
+	float x = 0.0f;
+	float y = 0.0f;
+
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(x), CEREAL_NVP(y));
+	}
+};
+
+// How one moving target moves, stored in the level file next to the shapes
+struct TargetMotion
+{
+	int target = 0;                 // Index among the level's MovingTarget shapes, in file order
+	MotionType type = MotionType::Bounce;
+	float speed = 120.0f;
+	float direction = 45.0f;        // Start heading of Bounce targets in degrees
+	std::vector<MotionWaypoint> waypoints;
+
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(target), CEREAL_NVP(type), CEREAL_NVP(speed), CEREAL_NVP(direction), CEREAL_NVP(waypoints));
+	}
+};
+
+// What a target carries over while the chunk it belongs to is not resident
+struct TargetState
+{
+	float x, y, vx, vy;
+	int32_t waypoint, heading;
+};
+
+// Moves every MovingTarget of a level. The state lives in flat arrays (structure of arrays) so the
+// integration runs four targets per instruction, walls are looked up in a static grid and the targets
+// themselves sit in a grid that is only touched when one of them crosses into another cell.
+// Targets are treated as circles of their larger half extent when they hit walls.
+class TargetKinematics
+{
+public:
+	using Lines = std::vector<std::pair<sf::RectangleShape, ShapeType>>;
+
+	// Targets without a motion entry bounce in a direction derived from their id
+	static TargetMotion DefaultMotion(uint64_t id);
+	// Every target of the lines, identified by its number among the MovingTarget shapes in file order
+	void Build(const Lines& lines, const std::vector<TargetMotion>& motions, glm::vec2 boundsMin, glm::vec2 boundsMax);
+	// Streamed levels change their lines while running, targets keep their state across such a change.
+	// BeginUpdate finds the new line of every target by its id in lineIds and removes those whose id is
+	// gone, returning their state. AddTarget brings in the targets of newly loaded chunks, with the state
+	// they were removed with if there is one, and FinishUpdate rebuilds the walls and grid of the new bounds.
+	void BeginUpdate(const Lines& lines, const std::vector<uint64_t>& lineIds, std::vector<std::pair<uint64_t, TargetState>>& removed);
+	void AddTarget(const Lines& lines, int lineIndex, uint64_t id, const TargetMotion& motion, const TargetState* state);
+	void FinishUpdate(const Lines& lines, glm::vec2 boundsMin, glm::vec2 boundsMax);
+	bool IsActive() const;
+	size_t Count() const;
+	void Step(float dt);
+	// Writes the positions back into the shapes
+	void Apply(Lines& lines) const;
+	// Keeps the line indices valid after lines.erase(lines.begin() + line)
+	void LineErased(int line);
+	// Lines of the targets that may overlap the box or the segment, a superset of the real hits
+	void QueryBox(glm::vec2 min, glm::vec2 max, std::vector<int>& out) const;
+	void QuerySegment(glm::vec2 start, glm::vec2 end, std::vector<int>& out) const;
+
+private:
+	int CellOf(float x, float y) const;
+	void Insert(int target, int cell);
+	void Unlink(int target);
+	// Copies every array entry of one target over another, the grid is left to the caller
+	void MoveTarget(int from, int to);
+	void PopTarget();
+	void CollectCell(int cellX, int cellY, std::vector<int>& out) const;
+	void Integrate(float dt);
+	void SteerAlongPaths(float dt);
+	void CollideWithWalls();
+
+	// Per target, index i of every array belongs to the same target
+	std::vector<float> x, y, vx, vy;
+	std::vector<float> halfWidth, halfHeight, radius;
+	std::vector<float> offsetX, offsetY;   // Shape position relative to the center
+	std::vector<float> speed;
+	std::vector<int32_t> line;
+	std::vector<uint64_t> id;
+	std::vector<uint8_t> type;
+	std::vector<int32_t> path, waypoint, heading;  // heading is +1 or -1 along a patrol
+	std::vector<int32_t> cell, slot;               // Grid cell and position in its list
+	std::vector<std::vector<glm::vec2>> paths;
+
+	// Walls as oriented boxes
+	std::vector<float> wallX, wallY, wallAxisX, wallAxisY, wallHalfWidth, wallHalfHeight;
+	// Static wall grid in compressed rows, cell c owns wallIndices[wallStart[c] .. wallStart[c + 1])
+	std::vector<int32_t> wallStart, wallIndices;
+
+	std::vector<std::vector<int32_t>> cells;
+	mutable std::vector<uint32_t> visited;
+	mutable uint32_t visitStamp = 0;
+	glm::vec2 boundsMin = glm::vec2(0.0f);
+	glm::vec2 boundsMax = glm::vec2(0.0f);
+	float cellSize = 64.0f;
+	float maxRadius = 0.0f;
+	int columns = 0;
+	int rows = 0;
+	bool active = false;
+};
@@ -0,0 +1,62 @@
+#include "Termination.h"
+
+bool IsTerminal(EpisodeEnd end)
+{
+	return end == EpisodeEnd::Won || end == EpisodeEnd::Eliminated;
+}
+
+bool IsTruncation(EpisodeEnd end)
+{
+	return end != EpisodeEnd::None && !IsTerminal(end);
+}
+
+const char* EpisodeEndName(EpisodeEnd end)
+{
+	switch (end) {
+	case EpisodeEnd::None:       return "None";
+	case EpisodeEnd::Won:        return "Won";
+	case EpisodeEnd::Eliminated: return "Eliminated";
+	case EpisodeEnd::TimeLimit:  return "TimeLimit";
+	case EpisodeEnd::StepLimit:  return "StepLimit";
+	case EpisodeEnd::NoProgress: return "NoProgress";
+	case EpisodeEnd::Pinned:     return "Pinned";
+	default:                     return "Unknown";
+	}
+}
+
+void TerminationMonitor::Reset()
+{
+	elapsed = 0.0;
+	steps = 0;
+	stepsWithoutProgress = 0;
+	stepsPinned = 0;
+}
+
+EpisodeEnd TerminationMonitor::Step(const TerminationConfig& config, float dt, bool progress, bool pinned)
+{
+	elapsed += dt;
+	steps++;
+	stepsWithoutProgress = progress ? 0 : stepsWithoutProgress + 1;
+	stepsPinned = pinned ? stepsPinned + 1 : 0;
+
+	// Half a step of slack, summing dt never lands exactly on the limit
+	if (config.time_limit > 0.0f && elapsed >= config.time_limit - 0.5 * dt)
+		return EpisodeEnd::TimeLimit;
+	if (config.step_limit > 0 && steps >= config.step_limit)
+		return EpisodeEnd::StepLimit;
+	if (config.no_progress_steps > 0 && stepsWithoutProgress >= config.no_progress_steps)
+		return EpisodeEnd::NoProgress;
+	if (config.pinned_steps > 0 && stepsPinned >= config.pinned_steps)
+		return EpisodeEnd::Pinned;
+	return EpisodeEnd::None;
+}
+
+float TerminationMonitor::Elapsed() const
+{
+	return static_cast<float>(elapsed);
+}
+
+int TerminationMonitor::Steps() const
+{
+	return steps;
+}
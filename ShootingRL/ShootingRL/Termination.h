@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+// Why an episode ended. Won and Eliminated are terminal states of the level, the others only cut the
+// episode short, so learners should bootstrap from their last observation instead of treating it as final.
+enum class EpisodeEnd : uint8_t
+{
+	None,
+	Won,         // Every target is gone
+	Eliminated,  // Every agent has been shot
+	TimeLimit,
+	StepLimit,
+	NoProgress,  // Nothing was hit for too long
+	Pinned       // The player kept running into obstacles
+};
+
+bool IsTerminal(EpisodeEnd end);
+bool IsTruncation(EpisodeEnd end);
+const char* EpisodeEndName(EpisodeEnd end);
+
+// Limits of one episode, a value of 0 disables the rule
+struct TerminationConfig
+{
+	float time_limit = 60.0f;    // Simulated seconds
+	int step_limit = 0;
+	int no_progress_steps = 0;   // Steps in a row without hitting a target or another agent
+	int pinned_steps = 0;        // Steps in a row in which every acting player collided
+};
+
+// Counts the budgets of the running episode and decides when it has to be truncated
+class TerminationMonitor
+{
+public:
+	void Reset();
+	// Called once per world step after every player acted
+	EpisodeEnd Step(const TerminationConfig& config, float dt, bool progress, bool pinned);
+	float Elapsed() const;
+	int Steps() const;
+
+private:
+	double elapsed = 0.0;
+	int steps = 0;
+	int stepsWithoutProgress = 0;
+	int stepsPinned = 0;
+};
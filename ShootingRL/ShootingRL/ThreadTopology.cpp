@@ -0,0 +1,282 @@
+#include "ThreadTopology.h"
+
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fstream>
+#endif
+
+namespace {
+#ifndef _WIN32
+	int readNumber(const std::string& path, int fallback)
+	{
+		std::ifstream is(path);
+		int value;
+		return (is >> value) ? value : fallback;
+	}
+
+	int numaNodeOf(int cpu)
+	{
+		std::string directory = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+		DIR* dir = opendir(directory.c_str());
+		if (dir == nullptr)
+			return 0;
+		int node = 0;
+		while (dirent* entry = readdir(dir)) {
+			std::string name = entry->d_name;
+			if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit(static_cast<unsigned char>(name[4]))) {
+				node = std::stoi(name.substr(4));
+				break;
+			}
+		}
+		closedir(dir);
+		return node;
+	}
+#endif
+
+	struct PhysicalCore
+	{
+		int numa_node;
+		std::vector<int> logical;  // First entry is the one used before hyperthreading
+	};
+}
+
+std::vector<CoreInfo> ThreadTopology::DetectCores()
+{
+	std::vector<CoreInfo> cores;
+#ifdef _WIN32
+	// Only processor group 0 is used, which covers every machine with up to 64 logical processors
+	DWORD_PTR processMask = 0, systemMask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+	std::vector<uint8_t> buffer(length);
+	auto* info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+	std::map<int, int> physicalOf, nodeOf;
+	if (length > 0 && GetLogicalProcessorInformationEx(RelationAll, info, &length)) {
+		int physical = 0;
+		for (DWORD offset = 0; offset < length;) {
+			auto* entry = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+			if (entry->Relationship == RelationProcessorCore && entry->Processor.GroupMask[0].Group == 0) {
+				for (int bit = 0; bit < 64; bit++)
+					if (entry->Processor.GroupMask[0].Mask & (1ull << bit))
+						physicalOf[bit] = physical;
+				physical++;
+			}
+			else if (entry->Relationship == RelationNumaNode && entry->NumaNode.GroupMask.Group == 0) {
+				for (int bit = 0; bit < 64; bit++)
+					if (entry->NumaNode.GroupMask.Mask & (1ull << bit))
+						nodeOf[bit] = static_cast<int>(entry->NumaNode.NodeNumber);
+			}
+			offset += entry->Size;
+		}
+	}
+	for (int bit = 0; bit < static_cast<int>(sizeof(DWORD_PTR) * 8); bit++) {
+		if (!(processMask & (static_cast<DWORD_PTR>(1) << bit)))
+			continue;
+		cores.push_back({ bit, physicalOf.count(bit) ? physicalOf[bit] : bit, nodeOf.count(bit) ? nodeOf[bit] : 0 });
+	}
+#else
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++)
+			CPU_SET(i, &allowed);
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+		int package = readNumber(topology + "physical_package_id", 0);
+		int core = readNumber(topology + "core_id", cpu);
+		cores.push_back({ cpu, package * 100000 + core, numaNodeOf(cpu) });
+	}
+#endif
+
+	std::sort(cores.begin(), cores.end(), [](const CoreInfo& a, const CoreInfo& b) {
+		if (a.numa_node != b.numa_node) return a.numa_node < b.numa_node;
+		if (a.physical != b.physical) return a.physical < b.physical;
+		return a.logical < b.logical;
+	});
+	// Physical ids renumbered densely in that order
+	std::map<int, int> dense;
+	for (auto& core : cores) {
+		auto it = dense.find(core.physical);
+		if (it == dense.end())
+			it = dense.emplace(core.physical, static_cast<int>(dense.size())).first;
+		core.physical = it->second;
+	}
+	return cores;
+}
+
+ThreadPlan ThreadTopology::BuildPlan(const std::vector<CoreInfo>& cores, const ThreadPlanConfig& config)
+{
+	ThreadPlan plan;
+	std::vector<PhysicalCore> physical;
+	std::map<int, size_t> indexOf;
+	std::set<int> nodes;
+	for (auto& core : cores) {
+		auto it = indexOf.find(core.physical);
+		if (it == indexOf.end()) {
+			it = indexOf.emplace(core.physical, physical.size()).first;
+			physical.push_back({ core.numa_node, {} });
+		}
+		physical[it->second].logical.push_back(core.logical);
+		nodes.insert(core.numa_node);
+	}
+	plan.logical_cores = static_cast<int>(cores.size());
+	plan.physical_cores = static_cast<int>(physical.size());
+	plan.numa_nodes = std::max<int>(1, static_cast<int>(nodes.size()));
+	if (physical.empty())
+		return plan;
+
+	int total = plan.physical_cores;
+	int learnerCount = config.learner_cores > 0 ? config.learner_cores : (config.actors > 0 ? std::max(1, total / 2) : total);
+	learnerCount = std::min(learnerCount, config.actors > 0 && total > 1 ? total - 1 : total);
+	learnerCount = std::max(1, learnerCount);
+
+	// The learner lives on the node with the most cores so its GEMMs never cross the interconnect
+	std::map<int, int> perNode;
+	for (auto& core : physical) perNode[core.numa_node]++;
+	plan.learner_numa_node = physical.front().numa_node;
+	if (config.numa_aware) {
+		for (auto& node : perNode)
+			if (node.second > perNode[plan.learner_numa_node])
+				plan.learner_numa_node = node.first;
+	}
+
+	std::vector<size_t> order;
+	for (size_t i = 0; i < physical.size(); i++)
+		if (!config.numa_aware || physical[i].numa_node == plan.learner_numa_node) order.push_back(i);
+	for (size_t i = 0; i < physical.size(); i++)
+		if (config.numa_aware && physical[i].numa_node != plan.learner_numa_node) order.push_back(i);
+
+	std::vector<bool> taken(physical.size(), false);
+	for (int i = 0; i < learnerCount; i++) {
+		const PhysicalCore& core = physical[order[i]];
+		taken[order[i]] = true;
+		plan.learner_cores.push_back(core.logical.front());
+		if (config.use_hyperthreads)
+			plan.learner_cores.insert(plan.learner_cores.end(), core.logical.begin() + 1, core.logical.end());
+	}
+	plan.intra_op_threads = config.intra_op_threads > 0 ? config.intra_op_threads : learnerCount;
+	plan.inter_op_threads = 1;
+
+	// Actors fill the remaining physical cores first, then their siblings, and only then share
+	std::vector<int> slots;
+	for (size_t i = 0; i < physical.size(); i++)
+		if (!taken[i]) slots.push_back(physical[i].logical.front());
+	if (config.use_hyperthreads || static_cast<int>(slots.size()) < config.actors) {
+		for (size_t i = 0; i < physical.size(); i++)
+			if (!taken[i])
+				slots.insert(slots.end(), physical[i].logical.begin() + 1, physical[i].logical.end());
+	}
+	if (slots.empty())
+		slots = plan.learner_cores;
+	for (int i = 0; i < config.actors; i++)
+		plan.actor_cores.push_back({ slots[i % slots.size()] });
+	return plan;
+}
+
+bool ThreadTopology::PinCurrentThread(const std::vector<int>& cores)
+{
+	if (cores.empty())
+		return false;
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int core : cores)
+		if (core < static_cast<int>(sizeof(DWORD_PTR) * 8)) mask |= static_cast<DWORD_PTR>(1) << core;
+	return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int core : cores)
+		if (core < CPU_SETSIZE) CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+void ThreadTopology::ApplyLearner(const ThreadPlan& plan)
+{
+	// Threads started afterwards, including torch's pools, inherit this affinity
+	PinCurrentThread(plan.learner_cores);
+	torch::set_num_threads(plan.intra_op_threads);
+	try {
+		torch::set_num_interop_threads(plan.inter_op_threads);
+	}
+	catch (const std::exception&) {
+		// Already started by an earlier torch call, the default size stays
+	}
+}
+
+void ThreadTopology::ApplyActor(const std::vector<int>& cores)
+{
+	PinCurrentThread(cores);
+	torch::set_num_threads(1);
+}
+
+std::string ThreadPlan::Describe() const
+{
+	std::ostringstream os;
+	os << logical_cores << " logical / " << physical_cores << " physical cores on " << numa_nodes << " NUMA node(s)\n";
+	os << "Learner: cores " << FormatCores(learner_cores) << " on node " << learner_numa_node
+		<< ", " << intra_op_threads << " intra-op / " << inter_op_threads << " inter-op threads\n";
+	for (size_t i = 0; i < actor_cores.size(); i++)
+		os << "Actor " << i << ": core " << FormatCores(actor_cores[i]) << ", 1 thread\n";
+	return os.str();
+}
+
+std::vector<std::vector<int>> ThreadPlan::SplitLearnerCores(int parts) const
+{
+	std::vector<std::vector<int>> groups;
+	if (parts <= 0 || learner_cores.empty())
+		return groups;
+	// With fewer cores than replicas the groups overlap, the replicas then share cores
+	size_t count = static_cast<size_t>(parts);
+	groups.resize(count);
+	if (learner_cores.size() < count) {
+		for (size_t i = 0; i < count; i++)
+			groups[i].push_back(learner_cores[i % learner_cores.size()]);
+		return groups;
+	}
+	for (size_t i = 0; i < count; i++) {
+		size_t begin = learner_cores.size() * i / count;
+		size_t end = learner_cores.size() * (i + 1) / count;
+		groups[i].assign(learner_cores.begin() + begin, learner_cores.begin() + end);
+	}
+	return groups;
+}
+
+std::string ThreadPlan::FormatCores(const std::vector<int>& cores)
+{
+	std::string text;
+	for (size_t i = 0; i < cores.size(); i++)
+		text += (i > 0 ? "," : "") + std::to_string(cores[i]);
+	return text.empty() ? "-" : text;
+}
+
+std::vector<int> ThreadPlan::ParseCores(const std::string& text)
+{
+	std::vector<int> cores;
+	std::stringstream ss(text);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty() && item != "-") cores.push_back(std::stoi(item));
+	return cores;
+}
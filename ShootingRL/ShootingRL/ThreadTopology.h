@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// One logical processor the process is allowed to run on
+struct CoreInfo
+{
+	int logical;
+	int physical;   // Hyperthread siblings share this id
+	int numa_node;
+};
+
+struct ThreadPlanConfig
+{
+	int actors = 0;             // Actor processes or threads that each get their own cores
+	int learner_cores = 0;      // Physical cores for the learner, 0 leaves half of them to actors when there are any
+	int intra_op_threads = 0;   // Torch threads of the learner, 0 uses one per learner core
+	bool numa_aware = true;     // Keep the learner on a single NUMA node
+	bool use_hyperthreads = false;  // Let siblings of used cores take work before cores are shared
+};
+
+// Which cores every thread group runs on. The learner owns a set of physical cores and runs torch's
+// intra-op pool on exactly those, actors are pinned to the remaining cores with one inference thread each.
+struct ThreadPlan
+{
+	std::vector<int> learner_cores;
+	int intra_op_threads = 1;
+	int inter_op_threads = 1;
+	int learner_numa_node = 0;
+	std::vector<std::vector<int>> actor_cores;
+	int logical_cores = 0;
+	int physical_cores = 0;
+	int numa_nodes = 1;
+
+	std::string Describe() const;
+	// Disjoint groups of the learner cores for data-parallel replicas, as even as possible
+	std::vector<std::vector<int>> SplitLearnerCores(int parts) const;
+	// Comma separated list of logical processors, the format actor processes receive their cores in
+	static std::string FormatCores(const std::vector<int>& cores);
+	static std::vector<int> ParseCores(const std::string& text);
+};
+
+class ThreadTopology
+{
+public:
+	// Processors in the affinity mask of this process, ordered by NUMA node, physical core and sibling
+	static std::vector<CoreInfo> DetectCores();
+	static ThreadPlan BuildPlan(const std::vector<CoreInfo>& cores, const ThreadPlanConfig& config);
+	// Restricts the calling thread to the given logical processors
+	static bool PinCurrentThread(const std::vector<int>& cores);
+	// Pins the calling thread to the learner cores and sizes torch's thread pools.
+	// Has to run before the first torch operation, the inter-op pool cannot be resized later.
+	static void ApplyLearner(const ThreadPlan& plan);
+	// Actors run one inference at a time, extra torch threads would only compete with the learner
+	static void ApplyActor(const std::vector<int>& cores);
+};
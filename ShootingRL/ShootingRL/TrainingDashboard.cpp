@@ -0,0 +1,106 @@
+#include "TrainingDashboard.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+    const char* rangeNames[] = { "Whole run", "Last 1k", "Last 10k", "Last 100k", "Last 1M" };
+    const uint64_t rangeSamples[] = { 0, 1000, 10000, 100000, 1000000 };
+}
+
+void TrainingDashboard::draw(MetricsPipeline& metrics, SeriesStore& series, bool* visible)
+{
+    ImGui::SetNextWindowSize(ImVec2(520.0f, 720.0f), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Training dashboard", visible))
+    {
+        ImGui::End();
+        return;
+    }
+    ImGui::Combo("Samples", &range, rangeNames, IM_ARRAYSIZE(rangeNames));
+    uint64_t dropped = metrics.dropped();
+    if (dropped > 0)
+        ImGui::Text("%llu records dropped on full rings", static_cast<unsigned long long>(dropped));
+
+    plot("Episode return", Metric::EpisodeReturn, metrics, series);
+    plot("Loss", Metric::Loss, metrics, series);
+    plot("Steps per second", Metric::StepsPerSecond, metrics, series);
+    plot("Replay fill", Metric::ReplayFill, metrics, series);
+    plot("Epsilon", Metric::Epsilon, metrics, series);
+    plot("Actor agreement", Metric::ActorAgreement, metrics, series);
+    ImGui::End();
+}
+
+void TrainingDashboard::plot(const char* label, Metric metric, MetricsPipeline& metrics, SeriesStore& series)
+{
+    MetricStats stats = metrics.stats(metric);
+    uint64_t samples = series.size(metric);
+    ImGui::Text("%s  last %.3g  ema %.3g  mean %.3g  p50 %.3g  (%llu)", label, stats.last, stats.ema, stats.window_mean, stats.p50,
+        static_cast<unsigned long long>(samples));
+
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImVec2 size(std::max(50.0f, ImGui::GetContentRegionAvail().x), plot_height);
+    ImGui::InvisibleButton(label, size);
+    bool hovered = ImGui::IsItemHovered();
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 corner(origin.x + size.x, origin.y + size.y);
+    drawList->AddRectFilled(origin, corner, ImGui::GetColorU32(ImGuiCol_FrameBg));
+
+    size_t columns = static_cast<size_t>(size.x);
+    uint64_t window = rangeSamples[range];
+    uint64_t first = window == 0 || samples <= window ? 0 : samples - window;
+    series.query(metric, first, samples == 0 ? 0 : samples - 1, columns * 2, points);
+    if (points.empty())
+    {
+        drawList->AddText(ImVec2(origin.x + 4.0f, origin.y + 4.0f), ImGui::GetColorU32(ImGuiCol_TextDisabled), "No data");
+        return;
+    }
+
+    float low = points.front().min, high = points.front().max;
+    for (auto& point : points)
+    {
+        low = std::min(low, point.min);
+        high = std::max(high, point.max);
+    }
+    if (high - low < 1e-6f)
+    {
+        low -= 0.5f;
+        high += 0.5f;
+    }
+    float padding = (high - low) * 0.05f;
+    low -= padding;
+    high += padding;
+    double left = points.front().first;
+    double right = std::max(points.back().last + 1.0, left + 1.0);
+
+    auto toX = [&](double sample) { return origin.x + static_cast<float>((sample - left) / (right - left)) * size.x; };
+    auto toY = [&](float value) { return origin.y + (high - value) / (high - low) * size.y; };
+
+    // Range of every bucket as a band, its mean as the line on top
+    ImU32 band = ImGui::GetColorU32(ImGuiCol_PlotLines, 0.35f);
+    for (auto& point : points)
+    {
+        float x0 = toX(point.first);
+        float x1 = std::max(x0 + 1.0f, toX(point.last + 1.0));
+        drawList->AddRectFilled(ImVec2(x0, toY(point.max)), ImVec2(x1, toY(point.min)), band);
+    }
+    line.clear();
+    for (size_t index : largestTriangleThreeBuckets(points, columns))
+        line.push_back(ImVec2(toX((points[index].first + points[index].last + 1.0) * 0.5), toY(points[index].mean)));
+    drawList->AddPolyline(line.data(), static_cast<int>(line.size()), ImGui::GetColorU32(ImGuiCol_PlotLines), ImDrawFlags_None, 1.5f);
+
+    char text[64];
+    std::snprintf(text, sizeof(text), "%.3g", high - padding);
+    drawList->AddText(ImVec2(origin.x + 4.0f, origin.y + 2.0f), ImGui::GetColorU32(ImGuiCol_TextDisabled), text);
+    std::snprintf(text, sizeof(text), "%.3g", low + padding);
+    drawList->AddText(ImVec2(origin.x + 4.0f, corner.y - ImGui::GetTextLineHeight() - 2.0f), ImGui::GetColorU32(ImGuiCol_TextDisabled), text);
+
+    if (!hovered)
+        return;
+    float mouse = ImGui::GetIO().MousePos.x;
+    double sample = left + (mouse - origin.x) / size.x * (right - left);
+    auto it = std::lower_bound(points.begin(), points.end(), sample, [](const SeriesPoint& point, double value) { return point.last + 1.0 <= value; });
+    if (it == points.end())
+        it = points.end() - 1;
+    drawList->AddLine(ImVec2(mouse, origin.y), ImVec2(mouse, corner.y), ImGui::GetColorU32(ImGuiCol_TextDisabled));
+    ImGui::SetTooltip("Samples %.0f - %.0f\nmean %.4g\nmin %.4g  max %.4g", it->first, it->last, it->mean, it->min, it->max);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+
+#include "ImGui/imgui.h"
+#include "Metrics.h"
+#include "SeriesStore.h"
+
+// ImGui window with one plot per training metric. Each plot asks the series store for at most two
+// buckets per pixel column, draws their min/max as a band and their means reduced to one point per
+// column with LTTB, so a frame costs the same after a billion samples as after a hundred.
+class TrainingDashboard
+{
+public:
+	// Call between ImGui::SFML::Update and ImGui::SFML::Render, visible is cleared by the close button
+	void draw(MetricsPipeline& metrics, SeriesStore& series, bool* visible);
+
+	float plot_height = 110.0f;
+
+private:
+	void plot(const char* label, Metric metric, MetricsPipeline& metrics, SeriesStore& series);
+
+	int range = 0;  // Index into the range options, 0 shows the whole run
+	// Reused every frame
+	std::vector<SeriesPoint> points;
+	std::vector<ImVec2> line;
+};
@@ -0,0 +1,403 @@
+#include "TrajectoryRecorder.h"
+#include "DQN.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+    const uint32_t chunkMagic = 0x4b484354;  // "TCHK"
+
+    struct ChunkHeader
+    {
+        uint32_t magic;
+        uint32_t episode;
+        uint32_t first_step;
+        uint32_t step_count;
+        uint32_t frame_count;
+        uint32_t frame_bytes;
+        uint32_t payload_bytes;
+        uint32_t checksum;
+    };
+
+    uint32_t checksum(const uint8_t* bytes, size_t size)
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    void append(std::vector<uint8_t>& out, const T& value)
+    {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    // Frames are XORed with the previous frame of the chunk, which leaves long zero runs since only the
+    // player and a few targets move, then run-length coded: a control byte below 128 is followed by that
+    // many plus one literal bytes, otherwise the next byte repeats control - 126 times
+    void encodeFrame(const std::vector<uint8_t>& frame, const std::vector<uint8_t>* previous, std::vector<uint8_t>& out)
+    {
+        size_t size = frame.size();
+        auto delta = [&](size_t i) -> uint8_t { return previous ? frame[i] ^ (*previous)[i] : frame[i]; };
+
+        size_t i = 0;
+        while (i < size)
+        {
+            uint8_t value = delta(i);
+            size_t run = 1;
+            while (i + run < size && run < 129 && delta(i + run) == value)
+                run++;
+
+            if (run >= 2)
+            {
+                out.push_back(static_cast<uint8_t>(run + 126));
+                out.push_back(value);
+                i += run;
+                continue;
+            }
+
+            // Literal run until the next repeat of at least two bytes
+            size_t start = i;
+            size_t length = 0;
+            while (i < size && length < 128)
+            {
+                if (i + 1 < size && delta(i) == delta(i + 1))
+                    break;
+                i++;
+                length++;
+            }
+            out.push_back(static_cast<uint8_t>(length - 1));
+            for (size_t j = start; j < start + length; j++)
+                out.push_back(delta(j));
+        }
+    }
+
+    bool decodeFrame(const uint8_t* bytes, size_t size, const std::vector<uint8_t>* previous, std::vector<uint8_t>& frame)
+    {
+        size_t position = 0;
+        size_t i = 0;
+        while (i < size)
+        {
+            uint8_t control = bytes[i++];
+            if (control < 128)
+            {
+                size_t length = control + 1;
+                if (i + length > size || position + length > frame.size())
+                    return false;
+                std::memcpy(frame.data() + position, bytes + i, length);
+                i += length;
+                position += length;
+            }
+            else
+            {
+                size_t length = control - 126;
+                if (i >= size || position + length > frame.size())
+                    return false;
+                std::memset(frame.data() + position, bytes[i++], length);
+                position += length;
+            }
+        }
+        if (position != frame.size())
+            return false;
+        if (previous)
+        {
+            for (size_t j = 0; j < frame.size(); j++)
+                frame[j] ^= (*previous)[j];
+        }
+        return true;
+    }
+}
+
+namespace {
+    // A crash can leave half an index entry, or chunk bytes the index never listed. Both files are cut
+    // back to the end of the last chunk that is complete and indexed, so new entries and chunks line up.
+    void truncateToLastChunk(const std::string& path)
+    {
+        std::error_code error;
+        std::string dataPath = path + ".traj";
+        std::string indexPath = path + ".idx";
+        uint64_t dataSize = std::filesystem::file_size(dataPath, error);
+        if (error)
+            dataSize = 0;
+
+        uint64_t entries = 0;
+        uint64_t end = 0;
+        {
+            std::ifstream is(indexPath, std::ios::binary);
+            TrajectoryIndexEntry entry;
+            while (is.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+            {
+                if (entry.offset + entry.bytes > dataSize)
+                    break;
+                entries++;
+                end = entry.offset + entry.bytes;
+            }
+        }
+
+        if (std::filesystem::exists(indexPath, error))
+            std::filesystem::resize_file(indexPath, entries * sizeof(TrajectoryIndexEntry), error);
+        if (dataSize > end)
+            std::filesystem::resize_file(dataPath, end, error);
+    }
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    close();
+}
+
+bool TrajectoryRecorder::open(const std::string& path, const ObservationSpec& observation, int streams, int steps_per_chunk, int max_pending_chunks)
+{
+    close();
+    truncateToLastChunk(path);
+
+    // Continue numbering after the episodes of an earlier run
+    TrajectoryReader existing;
+    if (existing.open(path))
+    {
+        for (auto& entry : existing.entries)
+            next_episode = std::max(next_episode, entry.episode + 1);
+    }
+
+    data.open(path + ".traj", std::ios::binary | std::ios::app);
+    index.open(path + ".idx", std::ios::binary | std::ios::app);
+    if (!data.is_open() || !index.is_open())
+        return false;
+    // tellp is not reliable for append streams before the first write
+    std::ifstream existing_data(path + ".traj", std::ios::binary | std::ios::ate);
+    data_offset = existing_data.is_open() ? static_cast<uint64_t>(existing_data.tellg()) : 0;
+
+    frame_bytes = static_cast<size_t>(observation.channels) * observation.height * observation.width;
+    this->steps_per_chunk = std::max(1, steps_per_chunk);
+    this->max_pending_chunks = std::max(1, max_pending_chunks);
+    this->streams.assign(std::max(1, streams), Stream());
+    stopping = false;
+    writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+    return true;
+}
+
+void TrajectoryRecorder::close()
+{
+    if (!writer.joinable())
+        return;
+
+    // Partially filled chunks are still worth keeping
+    for (auto& stream : streams)
+    {
+        if (stream.open && !stream.chunk.steps.empty())
+            submit(stream.chunk);
+        stream.open = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    has_work.notify_all();
+    writer.join();
+    data.close();
+    index.close();
+}
+
+void TrajectoryRecorder::beginEpisode(int stream)
+{
+    Stream& current = streams[stream];
+    if (current.open && !current.chunk.steps.empty())
+        submit(current.chunk);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current.chunk.episode = next_episode++;
+    }
+    current.chunk.first_step = 0;
+    current.chunk.steps.clear();
+    current.chunk.frames.clear();
+    current.open = true;
+}
+
+void TrajectoryRecorder::record(int stream, const uint8_t* state, const uint8_t* next_state, Action action, float reward, bool terminated, bool truncated)
+{
+    Stream& current = streams[stream];
+    if (!current.open)
+        beginEpisode(stream);
+
+    TrajectoryChunk& chunk = current.chunk;
+    if (chunk.frames.empty())
+        chunk.frames.emplace_back(state, state + frame_bytes);
+    chunk.frames.emplace_back(next_state, next_state + frame_bytes);
+    chunk.steps.push_back({ static_cast<uint8_t>(action), static_cast<uint8_t>((terminated ? 1 : 0) | (truncated ? 2 : 0)), reward });
+
+    bool episode_over = terminated || truncated;
+    if (episode_over || static_cast<int>(chunk.steps.size()) >= steps_per_chunk)
+    {
+        uint32_t episode = chunk.episode;
+        uint32_t next_step = chunk.first_step + static_cast<uint32_t>(chunk.steps.size());
+        submit(chunk);
+        chunk.episode = episode;
+        chunk.first_step = next_step;
+        current.open = !episode_over;
+    }
+}
+
+uint64_t TrajectoryRecorder::chunksWritten() const
+{
+    return written;
+}
+
+void TrajectoryRecorder::submit(TrajectoryChunk& chunk)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // Backpressure keeps memory bounded when the disk falls behind
+    has_space.wait(lock, [this]() { return pending.size() < max_pending_chunks || stopping; });
+    pending.push_back(std::move(chunk));
+    lock.unlock();
+    has_work.notify_one();
+
+    chunk = TrajectoryChunk();
+}
+
+void TrajectoryRecorder::writerLoop()
+{
+    std::vector<uint8_t> payload;
+    while (true)
+    {
+        TrajectoryChunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            has_work.wait(lock, [this]() { return !pending.empty() || stopping; });
+            if (pending.empty())
+                return;
+            chunk = std::move(pending.front());
+            pending.pop_front();
+        }
+        has_space.notify_one();
+
+        payload.clear();
+        for (auto& step : chunk.steps)
+        {
+            append(payload, step.action);
+            append(payload, step.flags);
+            append(payload, step.reward);
+        }
+        std::vector<uint8_t> encoded;
+        for (size_t i = 0; i < chunk.frames.size(); i++)
+        {
+            encoded.clear();
+            encodeFrame(chunk.frames[i], i > 0 ? &chunk.frames[i - 1] : nullptr, encoded);
+            append(payload, static_cast<uint32_t>(encoded.size()));
+            payload.insert(payload.end(), encoded.begin(), encoded.end());
+        }
+
+        ChunkHeader header;
+        header.magic = chunkMagic;
+        header.episode = chunk.episode;
+        header.first_step = chunk.first_step;
+        header.step_count = static_cast<uint32_t>(chunk.steps.size());
+        header.frame_count = static_cast<uint32_t>(chunk.frames.size());
+        header.frame_bytes = static_cast<uint32_t>(frame_bytes);
+        header.payload_bytes = static_cast<uint32_t>(payload.size());
+        header.checksum = checksum(payload.data(), payload.size());
+
+        // The chunk has to be on disk before the index points at it
+        TrajectoryIndexEntry entry;
+        entry.episode = chunk.episode;
+        entry.first_step = chunk.first_step;
+        entry.step_count = header.step_count;
+        entry.bytes = static_cast<uint32_t>(sizeof(header) + payload.size());
+        entry.offset = data_offset;
+        data.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        data.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        data.flush();
+        data_offset += entry.bytes;
+        index.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        index.flush();
+        written++;
+    }
+}
+
+bool TrajectoryReader::open(const std::string& path)
+{
+    data_path = path + ".traj";
+    std::ifstream is(path + ".idx", std::ios::binary);
+    if (!is.is_open())
+        return false;
+
+    entries.clear();
+    TrajectoryIndexEntry entry;
+    // A torn entry at the end of the index is ignored
+    while (is.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+        entries.push_back(entry);
+
+    data.open(data_path, std::ios::binary);
+    return data.is_open();
+}
+
+std::vector<TrajectoryIndexEntry> TrajectoryReader::episodeChunks(uint32_t episode) const
+{
+    std::vector<TrajectoryIndexEntry> chunks;
+    for (auto& entry : entries)
+    {
+        if (entry.episode == episode)
+            chunks.push_back(entry);
+    }
+    std::sort(chunks.begin(), chunks.end(), [](const TrajectoryIndexEntry& a, const TrajectoryIndexEntry& b) { return a.first_step < b.first_step; });
+    return chunks;
+}
+
+bool TrajectoryReader::readChunk(const TrajectoryIndexEntry& entry, TrajectoryChunk& chunk)
+{
+    std::vector<uint8_t> bytes(entry.bytes);
+    data.clear();
+    data.seekg(static_cast<std::streamoff>(entry.offset));
+    if (!data.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+        return false;
+    return decodeChunk(bytes.data(), bytes.size(), chunk);
+}
+
+bool TrajectoryReader::decodeChunk(const uint8_t* bytes, size_t size, TrajectoryChunk& chunk)
+{
+    if (size < sizeof(ChunkHeader))
+        return false;
+    ChunkHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    const uint8_t* payload = bytes + sizeof(header);
+    if (header.magic != chunkMagic || sizeof(header) + header.payload_bytes > size ||
+        checksum(payload, header.payload_bytes) != header.checksum)
+        return false;
+
+    chunk.episode = header.episode;
+    chunk.first_step = header.first_step;
+    chunk.steps.resize(header.step_count);
+    size_t position = 0;
+    for (auto& step : chunk.steps)
+    {
+        if (position + 6 > header.payload_bytes)
+            return false;
+        step.action = payload[position];
+        step.flags = payload[position + 1];
+        std::memcpy(&step.reward, payload + position + 2, sizeof(float));
+        position += 6;
+    }
+
+    chunk.frames.assign(header.frame_count, std::vector<uint8_t>(header.frame_bytes));
+    for (size_t i = 0; i < chunk.frames.size(); i++)
+    {
+        uint32_t encoded_size;
+        if (position + sizeof(encoded_size) > header.payload_bytes)
+            return false;
+        std::memcpy(&encoded_size, payload + position, sizeof(encoded_size));
+        position += sizeof(encoded_size);
+        if (position + encoded_size > header.payload_bytes)
+            return false;
+        if (!decodeFrame(payload + position, encoded_size, i > 0 ? &chunk.frames[i - 1] : nullptr, chunk.frames[i]))
+            return false;
+        position += encoded_size;
+    }
+    return true;
+}
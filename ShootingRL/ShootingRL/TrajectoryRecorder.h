@@ -0,0 +1,104 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EnviromentObjectsType.h"
+
+struct ObservationSpec;
+
+// One recorded step, the observation pixels live in the chunk's frame list
+struct RecordedStep
+{
+	uint8_t action;
+	uint8_t flags;  // bit 0 terminated, bit 1 truncated
+	float reward;
+};
+
+// A run of consecutive steps of one episode, frames[i] is the observation before steps[i]
+// and frames.back() the observation after the last step
+struct TrajectoryChunk
+{
+	uint32_t episode = 0;
+	uint32_t first_step = 0;
+	std::vector<RecordedStep> steps;
+	std::vector<std::vector<uint8_t>> frames;
+};
+
+// Entry of the index file, written only after its chunk is fully on disk
+struct TrajectoryIndexEntry
+{
+	uint32_t episode;
+	uint32_t first_step;
+	uint32_t step_count;
+	uint32_t bytes;
+	uint64_t offset;
+};
+
+// Appends every episode to <path>.traj in compressed chunks from a background thread.
+// Actors only copy pixels into the open chunk; compression and I/O happen on the writer,
+// and at most max_pending_chunks finished chunks wait in memory before record() blocks.
+// A crash loses at most the chunks that were not written yet. Reopening cuts off a torn index entry
+// and any chunk bytes past the last indexed chunk before appending.
+class TrajectoryRecorder
+{
+public:
+	TrajectoryRecorder() {};
+	~TrajectoryRecorder();
+	bool open(const std::string& path, const ObservationSpec& observation, int streams, int steps_per_chunk, int max_pending_chunks);
+	void close();
+	// Each environment records into its own stream
+	void beginEpisode(int stream);
+	void record(int stream, const uint8_t* state, const uint8_t* next_state, Action action, float reward, bool terminated, bool truncated);
+
+	uint64_t chunksWritten() const;
+
+private:
+	struct Stream
+	{
+		TrajectoryChunk chunk;
+		bool open = false;
+	};
+
+	void submit(TrajectoryChunk& chunk);
+	void writerLoop();
+
+	std::ofstream data;
+	std::ofstream index;
+	uint64_t data_offset = 0;
+	size_t frame_bytes = 0;
+	int steps_per_chunk = 256;
+	size_t max_pending_chunks = 8;
+	std::vector<Stream> streams;
+	uint32_t next_episode = 0;
+
+	std::mutex mutex;
+	std::condition_variable has_work, has_space;
+	std::deque<TrajectoryChunk> pending;
+	bool stopping = false;
+	uint64_t written = 0;
+	std::thread writer;
+};
+
+// Random access to a recording through its index file
+class TrajectoryReader
+{
+public:
+	bool open(const std::string& path);
+	// Chunks of an episode in step order
+	std::vector<TrajectoryIndexEntry> episodeChunks(uint32_t episode) const;
+	bool readChunk(const TrajectoryIndexEntry& entry, TrajectoryChunk& chunk);
+	// Decodes a chunk from its on-disk bytes, also used by readers that map the file
+	static bool decodeChunk(const uint8_t* bytes, size_t size, TrajectoryChunk& chunk);
+
+	std::vector<TrajectoryIndexEntry> entries;
+	std::string data_path;
+
+private:
+	std::ifstream data;
+};
@@ -128,7 +128,7 @@ namespace Physics {
 		return hasIntersection;
 	}
 
-	glm::vec2 RotateGlmVector(glm::vec2 vec, float rotation) {
+	static glm::vec2 RotateGlmVector(glm::vec2 vec, float rotation) {
 		float angleInRadians = glm::radians(rotation);
 		glm::mat2 rotationMatrix = glm::mat2(
 			glm::cos(angleInRadians), -glm::sin(angleInRadians),
@@ -198,6 +198,117 @@ namespace Physics {
 		return true;
 	}
 
+	// Result of sweeping one rectangle against another
+	struct SweepResult {
+		bool hit = false;
+		float time = 1.0f;               // Fraction of the displacement travelled before contact
+		glm::vec2 normal = glm::vec2(0.0f); // Contact normal pointing away from the obstacle
+	};
+
+	// Swept Separating Axis Theorem: moves rect1 by displacement against the static rect2 and returns
+	// the time of impact. Walls are thin rectangles so this also covers the oriented box vs. segment case.
+	static SweepResult SweepRectangles(const sf::RectangleShape& rect1, const sf::RectangleShape& rect2, glm::vec2 displacement) {
+		SweepResult result;
+		std::vector<sf::Vector2f> corners1 = GetRectangleCorners(rect1);
+		std::vector<sf::Vector2f> corners2 = GetRectangleCorners(rect2);
+
+		// Edge normals of both rectangles are the only candidate separating axes
+		glm::vec2 axes[4];
+		for (size_t i = 0; i < 2; ++i) {
+			sf::Vector2f edge1 = corners1[i + 1] - corners1[i];
+			sf::Vector2f edge2 = corners2[i + 1] - corners2[i];
+			axes[i] = glm::vec2(-edge1.y, edge1.x);
+			axes[i + 2] = glm::vec2(-edge2.y, edge2.x);
+		}
+
+		float enterTime = -std::numeric_limits<float>::max();
+		float exitTime = std::numeric_limits<float>::max();
+		glm::vec2 enterNormal(0.0f);
+		float minPenetration = std::numeric_limits<float>::max();
+		glm::vec2 penetrationNormal(0.0f);
+
+		for (glm::vec2 axis : axes) {
+			float length = glm::length(axis);
+			if (length == 0.0f)
+				continue;
+			axis /= length;
+
+			float min1 = Project(corners1[0], sf::Vector2f(axis.x, axis.y));
+			float max1 = min1;
+			for (const auto& corner : corners1) {
+				float projection = Project(corner, sf::Vector2f(axis.x, axis.y));
+				min1 = std::min(min1, projection);
+				max1 = std::max(max1, projection);
+			}
+
+			float min2 = Project(corners2[0], sf::Vector2f(axis.x, axis.y));
+			float max2 = min2;
+			for (const auto& corner : corners2) {
+				float projection = Project(corner, sf::Vector2f(axis.x, axis.y));
+				min2 = std::min(min2, projection);
+				max2 = std::max(max2, projection);
+			}
+
+			float velocity = glm::dot(displacement, axis);
+			float axisEnter, axisExit;
+			glm::vec2 axisNormal = velocity > 0.0f ? -axis : axis;
+
+			if (max1 < min2) {
+				// rect1 is before rect2 on this axis, it has to move forward to reach it
+				if (velocity <= 0.0f)
+					return result;
+				axisEnter = (min2 - max1) / velocity;
+				axisExit = (max2 - min1) / velocity;
+			}
+			else if (max2 < min1) {
+				// rect1 is after rect2 on this axis, it has to move backwards to reach it
+				if (velocity >= 0.0f)
+					return result;
+				axisEnter = (max2 - min1) / velocity;
+				axisExit = (min2 - max1) / velocity;
+			}
+			else {
+				// Already overlapping on this axis, remember the shallowest way out
+				axisEnter = -std::numeric_limits<float>::max();
+				if (velocity > 0.0f)
+					axisExit = (max2 - min1) / velocity;
+				else if (velocity < 0.0f)
+					axisExit = (min2 - max1) / velocity;
+				else
+					axisExit = std::numeric_limits<float>::max();
+
+				float penetration = std::min(max2 - min1, max1 - min2);
+				if (penetration < minPenetration) {
+					minPenetration = penetration;
+					penetrationNormal = (max2 - min1) < (max1 - min2) ? axis : -axis;
+				}
+			}
+
+			if (axisEnter > enterTime) {
+				enterTime = axisEnter;
+				enterNormal = axisNormal;
+			}
+			exitTime = std::min(exitTime, axisExit);
+
+			if (enterTime > exitTime || enterTime > 1.0f || exitTime < 0.0f)
+				return result;
+		}
+
+		result.hit = true;
+		if (enterTime < 0.0f) {
+			// Started inside rect2, block only the motion that pushes deeper into it
+			result.time = 0.0f;
+			result.normal = penetrationNormal;
+			if (glm::dot(displacement, penetrationNormal) >= 0.0f)
+				result.hit = false;
+		}
+		else {
+			result.time = enterTime;
+			result.normal = enterNormal;
+		}
+		return result;
+	}
+
 
 
 
@@ -1,13 +1,17 @@
 #include "LevelData.h"
 #include "DQN.h"
-
-float average(std::vector<float>& scores)
-{
-	float total = 0.0f;
-	for (auto& value : scores) total += value;
-	total /= scores.size();
-	return total;
-}
+#include "ActorWorker.h"
+#include "SharedReplay.h"
+#include "TrajectoryRecorder.h"
+#include "OfflineDataset.h"
+#include "InferenceServer.h"
+#include "Evaluator.h"
+#include "ThreadTopology.h"
+#include "Metrics.h"
+#include "SeriesStore.h"
+#include "TrainingDashboard.h"
+#include "Checkpointer.h"
+#include "Sweep.h"
 
 struct TrainingEnv
 {
@@ -31,8 +35,6 @@ float step_score = 0.0f;
 float mean_score = 0.0f;
 float eps;
 int selectedPerspective = 0;
-std::vector<float> scores;
-std::vector<float> mean_scores;
 
 bool done = false;
 bool trainingDone = false;
@@ -45,10 +47,80 @@ unsigned _seed;
 const int max_episodes = 20000;
 const int max_steps = 10000;
 const int print_every = 320;
-
-const float eps_start = 0.9f;
-const float eps_decay = /*0.999f;*/ 500000;
-const float eps_min = 0.01f;
+// Multi-process actors, 0 keeps the single process training loop
+const int actor_processes = 0;
+const int envs_per_actor = 4;
+// Every slot holds two raw observations, 5.12 MB at 800x800 RGBA, so 1024 slots are about 5 GB of
+// shared memory per actor. The size is printed when the replay is created.
+const int replay_capacity_per_actor = 1024;
+const int publish_every = 20;
+// Core placement, 0 lets the plan split the physical cores between the learner and the actors
+const int learner_cores = 0;
+const int learner_intra_op_threads = 0;
+const bool numa_aware_placement = true;
+const bool use_hyperthreads = false;
+ThreadPlan threadPlan;
+// Data-parallel learner, every replica gets its own share of the learner cores
+const int learner_replicas = 1;
+const int learner_batch_size = 0;  // 0 keeps the default batch size
+// Learner updates per collected transition, Fixed keeps the update_every cadence
+const ReplayRatioMode replay_ratio_mode = ReplayRatioMode::Fixed;
+const double target_replay_ratio = 1.0;  // Samples learned per transition collected
+const int max_updates_per_step = 4;
+const double actor_slack_batches = 32.0;
+// Record only actions and rewards and re-simulate observations when sampled
+const bool action_log_replay = false;
+const int action_log_decode_threads = 4;
+const int action_log_cached_frames = 2048;
+// Memory-mapped replay file reopened on the next run, empty keeps the buffer in memory
+const std::string replay_file = "";
+const double replay_file_gigabytes = 64.0;  // Caps the ring, a 800x800 RGBA transition takes about 5 MB
+// Streams every training episode to <file>.traj for offline use, empty disables recording. Actor processes
+// record their own environments into <file>_actor<index>.traj.
+const std::string trajectory_file = "";
+const int trajectory_steps_per_chunk = 128;
+const int trajectory_pending_chunks = 8;
+TrajectoryRecorder recorder;
+// Recordings the agent is pretrained on before any environment runs
+const std::vector<std::string> offline_datasets = {};
+const int offline_pretrain_steps = 0;
+const int offline_decode_threads = 4;
+const int offline_shuffle_window = 512;  // Transitions, each slot keeps two observations: about 2.6 GB at 800x800
+const int offline_prefetch_batches = 4;
+// Episode and learner statistics are aggregated off the training thread, logs go to <file>.csv and <file>.bin
+const std::string metrics_file = "";
+const int metrics_flush_seconds = 10;
+MetricsPipeline metrics;
+// Plotted history of every metric, fed by the metrics aggregator
+SeriesStore series;
+TrainingDashboard dashboard;
+// Network and optimizer are written in the background, only the newest checkpoint_keep stay on disk
+const std::string checkpoint_directory = "Checkpoints";
+const int checkpoint_keep = 5;
+const int checkpoint_interval_seconds = 300;
+AsyncCheckpointer checkpointer;
+
+// Movement is swept so the player no longer tunnels through walls at larger steps
+const float simulation_dt = 0.02f;
+// Episode budgets and early cutoffs, 0 disables a rule. Cut episodes are stored as truncated, not terminal.
+const float episode_time_limit = 60.0f;
+const int no_progress_cutoff_steps = 1500;
+const int pinned_cutoff_steps = 250;
+
+// name = value overrides of the learner and exploration settings, empty trains with the defaults
+const std::string hyperparameter_file = "";
+
+// Observations are drawn offscreen with DrawScene like actors, the evaluator and the action log replay
+// draw them, so the network never sees the ImGui panels of the window
+sf::RenderTexture observationTarget;
+
+sf::Image captureObservation(LevelData& level)
+{
+	observationTarget.clear();
+	level.DrawScene(observationTarget);
+	observationTarget.display();
+	return observationTarget.getTexture().copyToImage();
+}
 
 
 void train(float dt, sf::RenderWindow& window)
@@ -72,10 +144,10 @@ void train(float dt, sf::RenderWindow& window)
 		{
 			if (!env.done)
 			{
-				eps = eps_min + (eps_start - eps_min) * exp(-1. * stepsDone / eps_decay);
+				eps = agent->hyperparameters.epsilon(stepsDone);
 				action = static_cast<Action>(agent->act(
 					env.env->prevStep, eps));
-				step_return = env.env->Update(/*dt*/ 0.005f, action);
+				step_return = env.env->Update(/*dt*/ simulation_dt, action);
 
 				if (!env.env->IsSimulationRunning())
 					env.env->SelectModWindow();
@@ -88,27 +160,26 @@ void train(float dt, sf::RenderWindow& window)
 				ImGui::SFML::Render(window);
 				window.display();
 
-				sf::Texture texture;
-
-				// Capture the window contents to the texture
-				texture.create(window.getSize().x, window.getSize().y);
-				texture.update(window);
-
-				// Create an image from the texture
-				sf::Image screenshot = texture.copyToImage();
+				sf::Image screenshot = captureObservation(*env.env);
+				if (!trajectory_file.empty())
+					recorder.record(0, env.env->prevStep.getPixelsPtr(), screenshot.getPixelsPtr(), action, step_return.reward,
+						step_return.terminated, step_return.truncated || (!step_return.terminated && env.steps + 1 >= max_steps));
 				step_return.state = convertToTensor(env.env->prevStep);
 				env.env->prevStep = screenshot;
 				step_return.next_state = convertToTensor(env.env->prevStep);
 
 				// agent->addToExperienceBuffer(envs[i].env->StepReturnToFullFLoatStepReturn(step_return));
-				steps.push_back(step_return);
+				if (action_log_replay)
+					agent->addToActionLog(step_return);
+				else
+					steps.push_back(step_return);
 				env.steps++;
 				env.step_score = step_return.reward;
 				env.Score += step_return.reward;
 
 				step_score = step_return.reward;
 
-				if (step_return.terminated || env.steps >= max_steps)
+				if (step_return.terminated || step_return.truncated || env.steps >= max_steps)
 				{
 					env.done = true;
 				}
@@ -116,29 +187,42 @@ void train(float dt, sf::RenderWindow& window)
 				stepsDone++;
 			}
 			agent->addToExperienceBufferInBulk(steps);
+			int learnSteps = agent->learn_steps;
 			agent->step();
+			if (agent->learn_steps != learnSteps)
+			{
+				metrics.push(Metric::Loss, stepsDone, agent->last_loss);
+				if (agent->actor_network.mode != ActorPrecision::FP32)
+					metrics.push(Metric::ActorAgreement, stepsDone, agent->actor_agreement);
+			}
 		}
 		else
 		{
 			// debug values
 			Episode = episode;
 			Score = env.Score;
-			scores.push_back(env.Score);
+			metrics.push(Metric::EpisodeReturn, stepsDone, env.Score);
+			metrics.push(Metric::EpisodeLength, stepsDone, env.steps);
+			metrics.push(Metric::Epsilon, stepsDone, eps);
+			metrics.push(Metric::ReplayFill, stepsDone, static_cast<double>(agent->buffer.size()) / agent->buffer.buffer_size);
 			env.env->LoadData(std::string(env.env->lastLoadedFile));
 			env.done = false;
+			if (action_log_replay)
+				agent->beginActionLogEpisode(env.env->lastLoadedFile, simulation_dt);
+			if (!trajectory_file.empty())
+				recorder.beginEpisode(0);
 			env.Score = 0.0f;
 			env.steps = 0;
 			episode++;
 
 			if (episode % print_every == 0)
 			{
-				mean_score = average(scores);
-				mean_scores.push_back(mean_score);
-				std::string path;
-				std::cout << mean_score << "\n";
-				path = "Checkpoints/" + std::to_string(episode);
-				//path = Engine.FileIO().GetPath(bee::FileIO::Directory::Asset, path);
-				//agent->checkpoint(path);
+				mean_score = static_cast<float>(metrics.stats(Metric::EpisodeReturn).window_mean);
+			}
+			if (checkpointer.due())
+			{
+				agent->buffer.storeSamplerState();
+				checkpointer.save(*agent->q_network, *agent->optimizer, agent->checkpointSpec(), stepsDone, episode, metrics.stats(Metric::EpisodeReturn).window_mean);
 			}
 
 			ImGui::End();
@@ -147,15 +231,7 @@ void train(float dt, sf::RenderWindow& window)
 			ImGui::SFML::Render(window);
 			window.display();
 
-			sf::Texture texture;
-
-			// Capture the window contents to the texture
-			texture.create(window.getSize().x, window.getSize().y);
-			texture.update(window);
-
-			// Create an image from the texture
-			sf::Image screenshot = texture.copyToImage();
-			env.env->prevStep = screenshot;
+			env.env->prevStep = captureObservation(*env.env);
 			//step_return.next_state = convertToTensor(env.env->prevStep);
 		}
 	}
@@ -165,13 +241,249 @@ void train(float dt, sf::RenderWindow& window)
 	}
 }
 
-int main()
+void pretrainOffline(const ObservationSpec& observation)
+{
+	if (offline_datasets.empty() || offline_pretrain_steps <= 0)
+		return;
+	OfflineDataset dataset;
+	if (!dataset.open(offline_datasets, observation, agent->buffer.batch_size, offline_decode_threads,
+		offline_shuffle_window, offline_prefetch_batches, _seed))
+	{
+		std::cout << "The offline datasets hold fewer than " << agent->buffer.batch_size << " transitions\n";
+		return;
+	}
+	std::cout << "Pretraining on " << dataset.transitionCount() << " recorded transitions\n";
+	for (int i = 0; i < offline_pretrain_steps; i++)
+	{
+		Tensor_step_return batch = dataset.next();
+		if (!batch.states.defined())
+			break;
+		agent->learn(batch);
+		metrics.push(Metric::Loss, i, agent->last_loss);
+		if ((i + 1) % print_every == 0)
+			std::cout << "Offline step " << i + 1 << " epoch " << dataset.epoch() << "\n";
+	}
+	if (dataset.corruptChunks() > 0)
+		std::cout << "Skipped " << dataset.corruptChunks() << " corrupt chunks\n";
+}
+
+SharedReplay* actorReplay = nullptr;
+std::vector<ActorProcess> actors;
+// Spectator view of one actor environment, selectedPerspective picks it
+bool spectateActors = true;
+LevelData spectatorLevel;
+SharedReplay::SpectatorFrame spectatorFrame;
+uint64_t spectatorSequence = 0;
+
+void stopActors()
+{
+	if (actorReplay == nullptr)
+		return;
+	actorReplay->RequestShutdown();
+	for (auto& actor : actors) actor.join();
+	actors.clear();
+}
+
+// A failed start stops the actors already running, training never continues with part of them
+bool spawnActors()
+{
+	actorReplay->ClearShutdown();
+	for (int i = 0; i < actor_processes; i++)
+	{
+		ActorConfig config;
+		config.index = i;
+		config.shared_name = "ShootingRL_replay";
+		config.level_name = env.env->lastLoadedFile;
+		config.environments = envs_per_actor;
+		config.dt = simulation_dt;
+		config.max_steps = max_steps;
+		config.time_limit = episode_time_limit;
+		config.no_progress_steps = no_progress_cutoff_steps;
+		config.pinned_steps = pinned_cutoff_steps;
+		config.seed = _seed;
+		config.cores = ThreadPlan::FormatCores(threadPlan.actor_cores[i]);
+		if (!trajectory_file.empty())
+			config.trajectory_file = trajectory_file;
+		config.trajectory_steps_per_chunk = trajectory_steps_per_chunk;
+		config.trajectory_pending_chunks = trajectory_pending_chunks;
+		actors.emplace_back();
+		if (!actors.back().spawn(config))
+		{
+			actors.pop_back();
+			std::cout << "Failed to start actor process " << i << "\n";
+			stopActors();
+			return false;
+		}
+	}
+	return true;
+}
+
+void trainWithActors(sf::RenderWindow& window)
+{
+	static std::mt19937 rng(_seed);
+	static int learnSteps = 0;
+	static uint64_t episodesSeen = 0;
+
+	if (actorReplay == nullptr)
+	{
+		int64_t weightCount = 0;
+		for (auto& parameter : agent->q_network->parameters()) weightCount += parameter.numel();
+
+		ObservationSpec observation{ agent->network_spec.input_channels, agent->network_spec.input_height, agent->network_spec.input_width };
+		size_t segmentBytes = SharedReplay::SegmentBytes(actor_processes, replay_capacity_per_actor, observation, weightCount);
+		std::cout << "Shared replay: " << segmentBytes / (1024.0 * 1024.0 * 1024.0) << " GB for " << actor_processes << " actor(s)\n";
+		actorReplay = new SharedReplay();
+		if (!actorReplay->Create("ShootingRL_replay", actor_processes, replay_capacity_per_actor, observation, agent->action_size, agent->network_spec, weightCount))
+			throw std::runtime_error("Failed to create the shared replay.");
+		actorReplay->PublishWeights(*agent->q_network);
+		for (int i = 0; i < actor_processes; i++)
+			metrics.attach(actorReplay->MetricsOf(i), static_cast<uint16_t>(256 + i));
+		if (!spawnActors())
+			throw std::runtime_error("Failed to start the actor processes.");
+	}
+
+	uint64_t stepsDone = actorReplay->TotalWritten();
+	eps = agent->hyperparameters.epsilon(stepsDone);
+	actorReplay->header->epsilon.store(eps, std::memory_order_relaxed);
+
+	// Fixed runs one update per frame as before, the other modes let the controller decide
+	int batchSize = agent->buffer.batch_size;
+	agent->replay_ratio.setTransitions(stepsDone);
+	int updates = agent->replay_ratio.mode == ReplayRatioMode::Fixed ? 1 : agent->replay_ratio.updatesDue(batchSize);
+	// Without actors the replay no longer changes, learning would only overfit what is left in it
+	if (actors.empty())
+		updates = 0;
+	for (int i = 0; i < updates && actorReplay->Size() > static_cast<uint64_t>(batchSize); i++)
+	{
+		agent->learn(actorReplay->Sample(batchSize, rng));
+		learnSteps++;
+		if (learnSteps % publish_every == 0)
+			actorReplay->PublishWeights(*agent->q_network);
+		metrics.push(Metric::Loss, stepsDone, agent->last_loss);
+	}
+	metrics.push(Metric::Epsilon, stepsDone, eps);
+	metrics.push(Metric::ReplayFill, stepsDone, static_cast<double>(actorReplay->Size()) / (static_cast<double>(actor_processes) * replay_capacity_per_actor));
+	actorReplay->header->throttle.store(agent->replay_ratio.actorsShouldWait(batchSize) ? 1 : 0, std::memory_order_relaxed);
+	if (checkpointer.due())
+	{
+		agent->buffer.storeSamplerState();
+		checkpointer.save(*agent->q_network, *agent->optimizer, agent->checkpointSpec(), stepsDone, Episode, metrics.stats(Metric::EpisodeReturn).window_mean);
+	}
+
+	// debug values
+	uint64_t episodes = 0;
+	float lastScores = 0.0f;
+	for (int i = 0; i < actor_processes; i++)
+	{
+		episodes += actorReplay->partitions[i].episodes.load(std::memory_order_relaxed);
+		lastScores += actorReplay->partitions[i].last_score.load(std::memory_order_relaxed);
+	}
+	if (episodes != episodesSeen)
+	{
+		episodesSeen = episodes;
+		Episode = static_cast<int>(episodes);
+		Score = lastScores / actor_processes;
+	}
+
+	ImGui::Text("Actors: %i  Transitions: %llu  Episodes: %i", static_cast<int>(actors.size()), static_cast<unsigned long long>(stepsDone), Episode);
+	if (actors.empty())
+	{
+		if (ImGui::Button("Start Actors"))
+			spawnActors();
+	}
+	else if (ImGui::Button("Stop Actors"))
+		stopActors();
+
+	// The actor owning the watched environment publishes its shapes a few times per second,
+	// reading them never waits for it and drawing costs the actors nothing
+	int environmentCount = actor_processes * envs_per_actor;
+	ImGui::Checkbox("Watch", &spectateActors);
+	ImGui::SameLine();
+	ImGui::SliderInt("Environment", &selectedPerspective, 0, std::max(0, environmentCount - 1));
+	actorReplay->header->spectated_env.store(spectateActors ? selectedPerspective : -1, std::memory_order_relaxed);
+	if (spectateActors && actorReplay->ReadSpectator(spectatorFrame, spectatorSequence))
+		spectatorLevel.ApplySnapshot(spectatorFrame.shapes.data(), spectatorFrame.shapes.size());
+	bool watching = spectateActors && spectatorFrame.env == selectedPerspective;
+	if (watching)
+		ImGui::Text("Actor %i env %i: episode %u  step %u  score %.1f", selectedPerspective / envs_per_actor, selectedPerspective % envs_per_actor,
+			spectatorFrame.episode, spectatorFrame.step, spectatorFrame.score);
+	ImGui::End();
+	window.clear();
+	if (watching)
+		spectatorLevel.Draw(window);
+	else
+		env.env->Draw(window);
+	ImGui::SFML::Render(window);
+	window.display();
+}
+
+int main(int argc, char* argv[])
 {
-	agent = new DQN(4, 7, 0);  //(8, 4, 0);
+	// The learner starts copies of this executable as actor processes
+	if (argc > 1 && std::string(argv[1]) == "--actor")
+		return runActorProcess(ActorConfig::fromArguments(argc, argv));
+	// Headless policy serving for game side clients and its load generator
+	if (argc > 1 && std::string(argv[1]) == "--serve")
+		return runInferenceServer(InferenceServerConfig::fromArguments(argc, argv));
+	if (argc > 1 && std::string(argv[1]) == "--loadgen")
+		return runLoadGenerator(LoadGeneratorConfig::fromArguments(argc, argv));
+	// Greedy evaluation of saved checkpoints on a set of levels, see EvaluationConfig for the arguments
+	if (argc > 1 && std::string(argv[1]) == "--evaluate")
+		return runEvaluation(EvaluationConfig::fromArguments(argc, argv));
+	// Concurrent training trials over a grid of hyperparameters, see SweepConfig for the arguments
+	if (argc > 1 && std::string(argv[1]) == "--sweep")
+		return runSweep(SweepConfig::fromArguments(argc, argv));
+
+	// Placed before anything touches torch so its thread pools start on the learner cores
+	ThreadPlanConfig threadConfig;
+	threadConfig.actors = actor_processes;
+	threadConfig.learner_cores = learner_cores;
+	threadConfig.intra_op_threads = learner_intra_op_threads;
+	threadConfig.numa_aware = numa_aware_placement;
+	threadConfig.use_hyperthreads = use_hyperthreads;
+	threadPlan = ThreadTopology::BuildPlan(ThreadTopology::DetectCores(), threadConfig);
+	std::cout << threadPlan.Describe();
+	if (argc > 1 && std::string(argv[1]) == "--topology")
+		return 0;
+	ThreadTopology::ApplyLearner(threadPlan);
+
+	auto window = sf::RenderWindow({ /*1920u, 1080u*/ 800u,800u }, "CMake SFML Project");
+	// The network input is the scene drawn offscreen at the size of the window
+	ObservationSpec observation{ 4, static_cast<int>(window.getSize().y), static_cast<int>(window.getSize().x) };
+	if (!observationTarget.create(observation.width, observation.height))
+		throw std::runtime_error("Failed to create the observation render texture.");
+	Hyperparameters hyperparameters = hyperparameter_file.empty() ? Hyperparameters() : Hyperparameters::load(hyperparameter_file);
+	agent = new DQN(observation.channels, actionCount, 0, NetworkSpec::compact(observation), hyperparameters);  //(8, 4, 0);
+	agent->setActorPrecision(ActorPrecision::FP32);
+	if (learner_batch_size > 0)
+		agent->buffer.batch_size = learner_batch_size;
+	if (learner_replicas > 1)
+		agent->enableDataParallel(threadPlan.SplitLearnerCores(learner_replicas));
+	if (replay_ratio_mode != ReplayRatioMode::Fixed)
+		agent->replay_ratio.configure(replay_ratio_mode, target_replay_ratio, max_updates_per_step, actor_slack_batches);
+	if (action_log_replay)
+		agent->buffer.action_log = std::make_shared<ActionLogReplay>(agent->buffer.buffer_size, observation, action_log_decode_threads, action_log_cached_frames);
+	else if (!replay_file.empty() && !agent->buffer.openMapped(replay_file, observation,
+		static_cast<uint64_t>(replay_file_gigabytes * 1024.0 * 1024.0 * 1024.0)))
+		std::cout << "Failed to map the replay file " << replay_file << "\n";
+	if (!trajectory_file.empty() && !recorder.open(trajectory_file, observation, 1, trajectory_steps_per_chunk, trajectory_pending_chunks))
+		std::cout << "Failed to open the trajectory file " << trajectory_file << "\n";
+	MetricsConfig metricsConfig;
+	metricsConfig.path = metrics_file;
+	metricsConfig.flush_every_seconds = metrics_flush_seconds;
+	metrics.setSeries(&series);
+	metrics.start(metricsConfig);
+	CheckpointConfig checkpointConfig;
+	checkpointConfig.directory = checkpoint_directory;
+	checkpointConfig.keep = checkpoint_keep;
+	checkpointConfig.interval_seconds = checkpoint_interval_seconds;
+	if (!checkpointer.open(checkpointConfig, []() { agent->buffer.flush(); }))
+		std::cout << "Could not create " << checkpoint_directory << ", checkpoints are disabled\n";
+	pretrainOffline(observation);
 	env = TrainingEnv{};
 	env.env = new LevelData();
+	env.env->SetTermination({ episode_time_limit, max_steps, no_progress_cutoff_steps, pinned_cutoff_steps });
 	//////////////
-	auto window = sf::RenderWindow({ /*1920u, 1080u*/ 800u,800u }, "CMake SFML Project");
 	window.setFramerateLimit(144);
 	if (!ImGui::SFML::Init(window))
 		return -1;
@@ -184,6 +496,23 @@ int main()
 		ImGui::SFML::Update(window, timer = clock.restart());
 		env.env->ResetInput();
 		ImGui::Begin("Hello, world!");
+		if (ImGui::CollapsingHeader("Threads"))
+			ImGui::TextUnformatted(threadPlan.Describe().c_str());
+		ImGui::Text("Episode %i  Score %.1f  Mean %.1f  Epsilon %.3f", Episode, Score, mean_score, eps);
+		ImGui::Checkbox("Training dashboard", &seePreviouseMeanScores);
+		if (seePreviouseMeanScores)
+			dashboard.draw(metrics, series, &seePreviouseMeanScores);
+		ReplayRatioTelemetry ratio = agent->replay_ratio.telemetry(agent->buffer.batch_size);
+		// The rates change once per measurement window, repeating them would only skew the statistics
+		static double reportedRate = -1.0;
+		if (ratio.transitions_per_second != reportedRate)
+		{
+			reportedRate = ratio.transitions_per_second;
+			metrics.push(Metric::StepsPerSecond, agent->learn_steps, ratio.transitions_per_second);
+			metrics.push(Metric::UpdatesPerSecond, agent->learn_steps, ratio.updates_per_second);
+		}
+		ImGui::Text("Replay ratio %.2f (overall %.2f)  %.0f transitions/s  %.1f updates/s%s", ratio.live_ratio, ratio.overall_ratio,
+			ratio.transitions_per_second, ratio.updates_per_second, ratio.actors_throttled ? "  actors throttled" : "");
 
 		for (auto event = sf::Event(); window.pollEvent(event);)
 		{
@@ -221,11 +550,18 @@ int main()
 			if (env.env->IsSimulationRunning())
 				env.env->Update(timer.asSeconds(), Action::Down);
 		}
+		else if (actor_processes > 0) {
+			trainWithActors(window);
+		}
 		else {
 			train(timer.asSeconds(), window);
 		}
 
 	}
 
+	stopActors();
+	recorder.close();
+	checkpointer.close();
+	metrics.stop();
 	ImGui::SFML::Shutdown();
 }
\ No newline at end of file
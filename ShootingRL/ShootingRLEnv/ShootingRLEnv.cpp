@@ -0,0 +1,453 @@
+#include "ShootingRLEnv.h"
+#include "../ShootingRL/LevelData.h"
+
+#include <SFML/OpenGL.hpp>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    // Layout size of the level editor window every level is built in
+    const float levelExtent = 800.0f;
+}
+
+struct srl_env
+{
+    struct Instance
+    {
+        std::unique_ptr<LevelData> level;
+        int steps = 0;
+        bool done = true;
+        bool terminated = false;
+        bool truncated = false;
+        // Per agent, kept to report the final flags while waiting for a reset
+        std::vector<uint8_t> agentTerminated;
+    };
+
+    srl_env_config config;
+    std::string level_name;
+    std::string error;
+    // Parsed once, every reset copies it instead of reading the json again
+    std::unique_ptr<LevelData> pristine;
+    std::vector<Instance> instances;
+    int32_t agents = 0;  // Players in the level, every one of them is an agent in multi-agent steps
+
+    sf::RenderTexture target;
+    int channels = 0;
+    // Scratch space sized when the observation mode changes, rendering never allocates
+    std::vector<uint8_t> row;
+    std::vector<uint8_t> rgba;
+    std::vector<Action> agentActions;
+    std::unique_ptr<bool[]> agentFlags;
+};
+
+namespace {
+    int fail(srl_env* env, int code, const std::string& message)
+    {
+        env->error = message;
+        return code;
+    }
+
+    int64_t observationBytes(const srl_env* env)
+    {
+        return static_cast<int64_t>(env->channels) * env->config.width * env->config.height;
+    }
+
+    int configureObservation(srl_env* env, int32_t mode, int32_t width, int32_t height)
+    {
+        if (mode != SRL_OBSERVATION_NONE && mode != SRL_OBSERVATION_RGBA8 && mode != SRL_OBSERVATION_GRAY8)
+            return fail(env, SRL_ERROR_ARGUMENT, "Unknown observation mode.");
+        if (mode != SRL_OBSERVATION_NONE && (width <= 0 || height <= 0))
+            return fail(env, SRL_ERROR_ARGUMENT, "Observation size has to be positive.");
+
+        env->config.observation_mode = mode;
+        env->config.width = width;
+        env->config.height = height;
+        env->channels = mode == SRL_OBSERVATION_RGBA8 ? 4 : mode == SRL_OBSERVATION_GRAY8 ? 1 : 0;
+        if (mode == SRL_OBSERVATION_NONE)
+            return SRL_OK;
+
+        if (!env->target.create(width, height))
+            return fail(env, SRL_ERROR_RENDER, "Could not create the render texture.");
+        // The whole level is scaled into the observation
+        env->target.setView(sf::View(sf::FloatRect(0.0f, 0.0f, levelExtent, levelExtent)));
+        env->row.resize(static_cast<size_t>(width) * 4);
+        env->rgba.resize(mode == SRL_OBSERVATION_GRAY8 ? static_cast<size_t>(width) * height * 4 : 0);
+        return SRL_OK;
+    }
+
+    // Renders one environment straight into the caller's buffer, as seen by one agent when agent >= 0
+    int render(srl_env* env, LevelData& level, uint8_t* observation, int agent = -1)
+    {
+        if (observation == nullptr || env->channels == 0)
+            return SRL_OK;
+        if (!env->target.setActive(true))
+            return fail(env, SRL_ERROR_RENDER, "Could not activate the render texture.");
+        env->target.clear();
+        if (agent < 0)
+            level.DrawScene(env->target);
+        else
+            level.DrawAgentScene(env->target, agent);
+        env->target.display();
+
+        int width = env->config.width;
+        int height = env->config.height;
+        uint8_t* pixels = env->channels == 4 ? observation : env->rgba.data();
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+        // OpenGL rows start at the bottom, images at the top
+        size_t stride = static_cast<size_t>(width) * 4;
+        for (int y = 0; y < height / 2; y++)
+        {
+            uint8_t* top = pixels + y * stride;
+            uint8_t* bottom = pixels + (height - 1 - y) * stride;
+            std::memcpy(env->row.data(), top, stride);
+            std::memcpy(top, bottom, stride);
+            std::memcpy(bottom, env->row.data(), stride);
+        }
+
+        if (env->channels == 1)
+        {
+            size_t count = static_cast<size_t>(width) * height;
+            for (size_t i = 0; i < count; i++)
+            {
+                const uint8_t* p = pixels + i * 4;
+                observation[i] = static_cast<uint8_t>((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+            }
+        }
+        return SRL_OK;
+    }
+
+    // An instance allocates its level on the first reset, later resets copy the parsed level into it in place
+    int resetInstance(srl_env* env, srl_env::Instance& instance, uint8_t* observation)
+    {
+        if (instance.level == nullptr)
+            instance.level = std::make_unique<LevelData>(*env->pristine);
+        else
+            instance.level->ResetFrom(*env->pristine);
+        instance.level->SetTermination({ env->config.time_limit, env->config.max_steps, env->config.no_progress_steps, env->config.pinned_steps });
+        instance.level->StartSimulation(true);
+        instance.steps = 0;
+        instance.done = false;
+        instance.terminated = false;
+        instance.truncated = false;
+        instance.agentTerminated.assign(env->agents, 0);
+        return render(env, *instance.level, observation);
+    }
+
+    uint8_t* slot(srl_env* env, uint8_t* observations, size_t index)
+    {
+        return observations == nullptr ? nullptr : observations + index * observationBytes(env);
+    }
+
+    // One observation per agent of the environment, in agent order
+    int renderAgents(srl_env* env, size_t index, uint8_t* observations)
+    {
+        for (int32_t agent = 0; agent < env->agents; agent++)
+        {
+            int result = render(env, *env->instances[index].level, slot(env, observations, index * env->agents + agent), agent);
+            if (result != SRL_OK)
+                return result;
+        }
+        return SRL_OK;
+    }
+
+    void useLevel(srl_env* env, std::unique_ptr<LevelData> level)
+    {
+        env->pristine = std::move(level);
+        env->agents = env->pristine->CountAgents();
+        env->agentActions.resize(env->agents);
+        env->agentFlags = std::make_unique<bool[]>(env->agents);
+    }
+}
+
+extern "C" {
+
+SRL_API void srl_env_default_config(srl_env_config* config)
+{
+    if (config == nullptr)
+        return;
+    config->level = "";
+    config->num_envs = 1;
+    config->observation_mode = SRL_OBSERVATION_RGBA8;
+    config->width = 800;
+    config->height = 800;
+    config->dt = 0.02f;
+    config->max_steps = 10000;
+    config->auto_reset = 1;
+    config->time_limit = 60.0f;
+    config->no_progress_steps = 0;
+    config->pinned_steps = 0;
+}
+
+SRL_API srl_env* srl_env_create(const srl_env_config* config)
+{
+    if (config == nullptr || config->num_envs <= 0 || config->dt <= 0.0f || config->level == nullptr)
+        return nullptr;
+    try
+    {
+        auto env = std::make_unique<srl_env>();
+        env->config = *config;
+        env->level_name = config->level;
+        env->config.level = env->level_name.c_str();
+        env->instances.resize(config->num_envs);
+        if (configureObservation(env.get(), config->observation_mode, config->width, config->height) != SRL_OK)
+            return nullptr;
+        auto level = std::make_unique<LevelData>();
+        level->LoadData(env->level_name);
+        useLevel(env.get(), std::move(level));
+        return env.release();
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+SRL_API void srl_env_destroy(srl_env* env)
+{
+    delete env;
+}
+
+SRL_API int32_t srl_env_num_envs(const srl_env* env)
+{
+    return env == nullptr ? 0 : static_cast<int32_t>(env->instances.size());
+}
+
+SRL_API int32_t srl_env_num_actions(const srl_env* env)
+{
+    return actionCount;
+}
+
+SRL_API int64_t srl_env_observation_bytes(const srl_env* env)
+{
+    return env == nullptr ? 0 : observationBytes(env);
+}
+
+SRL_API int srl_env_observation_shape(const srl_env* env, int32_t* channels, int32_t* height, int32_t* width)
+{
+    if (env == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    if (channels) *channels = env->channels;
+    if (height) *height = env->channels == 0 ? 0 : env->config.height;
+    if (width) *width = env->channels == 0 ? 0 : env->config.width;
+    return SRL_OK;
+}
+
+SRL_API int srl_env_load_level(srl_env* env, const char* level, uint8_t* observations)
+{
+    if (env == nullptr || level == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    try
+    {
+        auto loaded = std::make_unique<LevelData>();
+        loaded->LoadData(level);
+        useLevel(env, std::move(loaded));
+        env->level_name = level;
+        env->config.level = env->level_name.c_str();
+    }
+    catch (const std::exception& e)
+    {
+        return fail(env, SRL_ERROR_LEVEL, e.what());
+    }
+    return srl_env_reset(env, observations);
+}
+
+SRL_API int srl_env_set_observation_mode(srl_env* env, int32_t mode, int32_t width, int32_t height)
+{
+    if (env == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    return configureObservation(env, mode, width, height);
+}
+
+SRL_API int srl_env_reset(srl_env* env, uint8_t* observations)
+{
+    if (env == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    try
+    {
+        for (size_t i = 0; i < env->instances.size(); i++)
+        {
+            int result = resetInstance(env, env->instances[i], slot(env, observations, i));
+            if (result != SRL_OK)
+                return result;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        return fail(env, SRL_ERROR_INTERNAL, e.what());
+    }
+    return SRL_OK;
+}
+
+SRL_API int srl_env_reset_one(srl_env* env, int32_t index, uint8_t* observation)
+{
+    if (env == nullptr || index < 0 || index >= static_cast<int32_t>(env->instances.size()))
+        return SRL_ERROR_ARGUMENT;
+    try
+    {
+        return resetInstance(env, env->instances[index], observation);
+    }
+    catch (const std::exception& e)
+    {
+        return fail(env, SRL_ERROR_INTERNAL, e.what());
+    }
+}
+
+SRL_API int srl_env_step(srl_env* env, const int32_t* actions, uint8_t* observations, float* rewards,
+    uint8_t* terminated, uint8_t* truncated)
+{
+    if (env == nullptr || actions == nullptr || rewards == nullptr || terminated == nullptr || truncated == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    for (size_t i = 0; i < env->instances.size(); i++)
+    {
+        if (actions[i] < 0 || actions[i] >= actionCount)
+            return fail(env, SRL_ERROR_ARGUMENT, "Action out of range.");
+        if (env->instances[i].level == nullptr)
+            return fail(env, SRL_ERROR_ARGUMENT, "Environments have to be reset before stepping.");
+    }
+
+    try
+    {
+        for (size_t i = 0; i < env->instances.size(); i++)
+        {
+            srl_env::Instance& instance = env->instances[i];
+            uint8_t* observation = slot(env, observations, i);
+            if (instance.done && !env->config.auto_reset)
+            {
+                // Finished environments wait for reset_one and keep reporting their final flags
+                rewards[i] = 0.0f;
+                terminated[i] = instance.terminated;
+                truncated[i] = instance.truncated;
+                int result = render(env, *instance.level, observation);
+                if (result != SRL_OK)
+                    return result;
+                continue;
+            }
+
+            Simulation_Step_return step_return = instance.level->Update(env->config.dt, static_cast<Action>(actions[i]));
+            instance.steps++;
+            instance.terminated = step_return.terminated;
+            instance.truncated = !step_return.terminated && (step_return.truncated ||
+                (env->config.max_steps > 0 && instance.steps >= env->config.max_steps));
+            instance.done = instance.terminated || instance.truncated;
+            rewards[i] = step_return.reward;
+            terminated[i] = instance.terminated;
+            truncated[i] = instance.truncated;
+
+            int result = instance.done && env->config.auto_reset
+                ? resetInstance(env, instance, observation)
+                : render(env, *instance.level, observation);
+            if (result != SRL_OK)
+                return result;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        return fail(env, SRL_ERROR_INTERNAL, e.what());
+    }
+    return SRL_OK;
+}
+
+SRL_API int32_t srl_env_num_agents(const srl_env* env)
+{
+    return env == nullptr ? 0 : env->agents;
+}
+
+SRL_API int srl_env_reset_agents(srl_env* env, uint8_t* observations)
+{
+    if (env == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    try
+    {
+        for (size_t i = 0; i < env->instances.size(); i++)
+        {
+            int result = resetInstance(env, env->instances[i], nullptr);
+            if (result == SRL_OK)
+                result = renderAgents(env, i, observations);
+            if (result != SRL_OK)
+                return result;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        return fail(env, SRL_ERROR_INTERNAL, e.what());
+    }
+    return SRL_OK;
+}
+
+SRL_API int srl_env_step_agents(srl_env* env, const int32_t* actions, uint8_t* observations, float* rewards,
+    uint8_t* terminated, uint8_t* truncated)
+{
+    if (env == nullptr || actions == nullptr || rewards == nullptr || terminated == nullptr || truncated == nullptr)
+        return SRL_ERROR_ARGUMENT;
+    if (env->agents == 0)
+        return fail(env, SRL_ERROR_LEVEL, "The level has no players.");
+    size_t agents = static_cast<size_t>(env->agents);
+    for (size_t i = 0; i < env->instances.size(); i++)
+    {
+        for (size_t agent = 0; agent < agents; agent++)
+            if (actions[i * agents + agent] < 0 || actions[i * agents + agent] >= actionCount)
+                return fail(env, SRL_ERROR_ARGUMENT, "Action out of range.");
+        if (env->instances[i].level == nullptr)
+            return fail(env, SRL_ERROR_ARGUMENT, "Environments have to be reset before stepping.");
+    }
+
+    try
+    {
+        for (size_t i = 0; i < env->instances.size(); i++)
+        {
+            srl_env::Instance& instance = env->instances[i];
+            size_t first = i * agents;
+            if (instance.done && !env->config.auto_reset)
+            {
+                for (size_t agent = 0; agent < agents; agent++)
+                {
+                    rewards[first + agent] = 0.0f;
+                    terminated[first + agent] = instance.agentTerminated[agent];
+                    truncated[first + agent] = !instance.agentTerminated[agent];
+                }
+                int result = renderAgents(env, i, observations);
+                if (result != SRL_OK)
+                    return result;
+                continue;
+            }
+
+            for (size_t agent = 0; agent < agents; agent++)
+                env->agentActions[agent] = static_cast<Action>(actions[first + agent]);
+            instance.level->UpdateAgents(env->config.dt, env->agentActions.data(), rewards + first, env->agentFlags.get());
+            instance.steps++;
+            instance.truncated = IsTruncation(instance.level->GetEpisodeEnd()) ||
+                (instance.level->IsSimulationRunning() && env->config.max_steps > 0 && instance.steps >= env->config.max_steps);
+            instance.terminated = !instance.truncated && !instance.level->IsSimulationRunning();
+            instance.done = instance.terminated || instance.truncated;
+            for (size_t agent = 0; agent < agents; agent++)
+            {
+                instance.agentTerminated[agent] = env->agentFlags[agent];
+                terminated[first + agent] = env->agentFlags[agent];
+                truncated[first + agent] = instance.truncated && !env->agentFlags[agent];
+            }
+
+            int result = instance.done && env->config.auto_reset ? resetInstance(env, instance, nullptr) : SRL_OK;
+            if (result == SRL_OK)
+                result = renderAgents(env, i, observations);
+            if (result != SRL_OK)
+                return result;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        return fail(env, SRL_ERROR_INTERNAL, e.what());
+    }
+    return SRL_OK;
+}
+
+SRL_API const char* srl_env_last_error(const srl_env* env)
+{
+    return env == nullptr ? "No environment." : env->error.c_str();
+}
+
+}
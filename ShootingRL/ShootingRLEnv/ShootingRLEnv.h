@@ -0,0 +1,100 @@
+#pragma once
+/*
+ * C interface of the ShootingRL simulation, built as libshootingrl_env.
+ *
+ * One handle steps a batch of environments on the same level. Observations, rewards and done flags
+ * are written straight into buffers owned by the caller, laid out contiguously per environment, and
+ * are not copied through intermediate objects. A step that finishes no episode does not allocate.
+ * Each environment allocates its level on its first reset; later resets, including automatic ones
+ * inside a step, copy the parsed level into it in place and reuse its buffers. Rendering needs an
+ * OpenGL context, so all calls on one handle have to come from the same thread.
+ *
+ * Functions returning int return SRL_OK or a negative error code; srl_env_last_error describes the
+ * most recent failure.
+ */
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef SHOOTINGRL_ENV_EXPORTS
+#define SRL_API __declspec(dllexport)
+#else
+#define SRL_API __declspec(dllimport)
+#endif
+#else
+#define SRL_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SRL_OK 0
+#define SRL_ERROR_ARGUMENT -1
+#define SRL_ERROR_LEVEL -2
+#define SRL_ERROR_RENDER -3
+#define SRL_ERROR_INTERNAL -4
+
+typedef enum srl_observation_mode
+{
+	SRL_OBSERVATION_NONE = 0,   /* No rendering, only rewards and done flags */
+	SRL_OBSERVATION_RGBA8 = 1,  /* 4 x height x width bytes, DrawScene into an offscreen texture as the training binary renders its observations */
+	SRL_OBSERVATION_GRAY8 = 2   /* 1 x height x width bytes of luminance */
+} srl_observation_mode;
+
+typedef struct srl_env_config
+{
+	const char* level;          /* Level name as saved by the editor, loaded from ../assets/levels/<level>.json */
+	int32_t num_envs;
+	int32_t observation_mode;   /* srl_observation_mode */
+	int32_t width;              /* Observation size, the level is scaled from its 800x800 layout */
+	int32_t height;
+	float dt;                   /* Simulation step in seconds */
+	int32_t max_steps;          /* Episodes are truncated after this many steps, 0 for no limit */
+	int32_t auto_reset;         /* Finished environments restart and report the new episode's first observation */
+	float time_limit;           /* Simulated seconds before an episode is truncated, 0 for no limit */
+	int32_t no_progress_steps;  /* Truncate after this many steps without hitting anything, 0 disables */
+	int32_t pinned_steps;       /* Truncate after this many steps of the player colliding, 0 disables */
+} srl_env_config;
+
+typedef struct srl_env srl_env;
+
+/* Fills a config with the defaults the training binary uses */
+SRL_API void srl_env_default_config(srl_env_config* config);
+SRL_API srl_env* srl_env_create(const srl_env_config* config);
+SRL_API void srl_env_destroy(srl_env* env);
+
+SRL_API int32_t srl_env_num_envs(const srl_env* env);
+SRL_API int32_t srl_env_num_actions(const srl_env* env);
+/* Bytes of one environment's observation, 0 without rendering */
+SRL_API int64_t srl_env_observation_bytes(const srl_env* env);
+SRL_API int srl_env_observation_shape(const srl_env* env, int32_t* channels, int32_t* height, int32_t* width);
+
+/* Switches every environment to another level and resets them */
+SRL_API int srl_env_load_level(srl_env* env, const char* level, uint8_t* observations);
+SRL_API int srl_env_set_observation_mode(srl_env* env, int32_t mode, int32_t width, int32_t height);
+
+/* observations: num_envs * observation_bytes, may be NULL to skip rendering */
+SRL_API int srl_env_reset(srl_env* env, uint8_t* observations);
+SRL_API int srl_env_reset_one(srl_env* env, int32_t index, uint8_t* observation);
+/* actions: num_envs values in [0, num_actions); rewards, terminated and truncated: num_envs entries each */
+SRL_API int srl_env_step(srl_env* env, const int32_t* actions, uint8_t* observations, float* rewards,
+	uint8_t* terminated, uint8_t* truncated);
+
+/*
+ * Multi-agent levels: every player of the level is an agent and all agents of an environment act in the
+ * same world in one step, so walls, moving targets and the win check are processed once per step.
+ * Agents block each other and shots hit other agents, which leave the episode. Buffers hold
+ * num_envs * num_agents entries with the agents of one environment next to each other, every agent
+ * observes the level with only its own direction marker drawn.
+ */
+SRL_API int32_t srl_env_num_agents(const srl_env* env);
+SRL_API int srl_env_reset_agents(srl_env* env, uint8_t* observations);
+/* An agent that was shot reports terminated until its environment resets */
+SRL_API int srl_env_step_agents(srl_env* env, const int32_t* actions, uint8_t* observations, float* rewards,
+	uint8_t* terminated, uint8_t* truncated);
+
+SRL_API const char* srl_env_last_error(const srl_env* env);
+
+#ifdef __cplusplus
+}
+#endif